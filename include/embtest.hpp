@@ -7,8 +7,25 @@
  */
 #pragma once
 
-#include <iostream>
+/*
+ * This header declares what test files need: the test macros, the
+ * assertions and their support. The runner API, e.g. RunOptions and
+ * Reporter, is in embtest_runner.hpp.
+ *
+ * Of the standard library, the header itself only needs <iosfwd>,
+ * <new>, <cstddef> and <cstdint>. Unless EMBTEST_LEAN_HEADER is
+ * defined, it also includes <iostream>, as it always has, which test
+ * files may rely on. A lean test file includes what it uses, e.g.
+ * <ostream> to write FAIL() << "message", or to compare values of
+ * its own types that have an operator<<.
+ */
+#include <iosfwd>
+#include <new>
+#include <cstddef>
 #include <cstdint>
+#if !defined(EMBTEST_LEAN_HEADER)
+#include <iostream>
+#endif
 
 #define EMBTEST_VERSION_MAJOR 1
 #define EMBTEST_VERSION_MINOR 2
@@ -55,6 +72,12 @@ constexpr const char *versionString =
  *  4. ::TearDown() is called
  *  5. destruction
  *
+ * A fixture may also define static SetUpTestSuite() and
+ * TearDownTestSuite() methods for state shared by all of its
+ * tests. SetUpTestSuite() runs before the first test of the
+ * suite that runs, and TearDownTestSuite() after the last one.
+ * Suites without any test to run are never set up.
+ *
  * As an implementation note, the block of code that represents
  * a test is the body of the ::TestBody() method.
  *
@@ -65,6 +88,9 @@ class Test
   public:
     Test() {}
 
+    static void SetUpTestSuite() {}     ///< hide in a fixture to set up shared state
+    static void TearDownTestSuite() {}  ///< hide in a fixture to release shared state
+
     virtual void SetUp() {}       ///< SetUp() is not used for tests, but override for test fixtures
     virtual void TestBody() = 0;  ///< TestBody() contains the test code proper
     virtual void TearDown() {}    ///< TearDown() is not used for tests, but override for test fixtures
@@ -73,291 +99,1525 @@ class Test
 };
 
 /**
- * TestFactoryBase is an abstract base class that provides
- * a simple interface: a method to create instances of a
- * embtest::Test.
+ * Benchmark is the base class of tests declared with BENCHMARK().
+ * The runner calls RunIterations() with an iteration count it
+ * calibrates to a target time, and times each call with a
+ * monotonic clock. RunIterations() is generated by BENCHMARK()
+ * as a loop around the benchmark body.
+ *
+ * When a Benchmark is run as a plain test, the body runs once.
  *
  * IMPLEMENTATION DETAIL
  */
-class TestFactoryBase
+class Benchmark : public Test
 {
   public:
-    /**
-     * Destructor must be public and virtual.
-     */
-    virtual ~TestFactoryBase() {}
+    virtual void RunIterations(uint64_t iterations) = 0;
+    virtual void TestBody() { RunIterations(1); }
+};
 
-    /**
-     * To get a new Test instance, call makeTest().
-     */
-    virtual Test* makeTest() = 0;
+/**
+ * DoNotOptimize() forces the compiler to materialize \c value,
+ * so a benchmark body whose result is otherwise unused is not
+ * optimized away. ClobberMemory() forces pending writes to
+ * memory to be performed.
+ *
+ * PUBLIC
+ */
+#if defined(__GNUC__)
+template <typename T>
+inline void DoNotOptimize(T const &value)
+{
+    asm volatile("" : : "r,m"(value) : "memory");
+}
 
-  protected:
-    /**
-     * Construction is only possible by subclasses.
-     */
-    TestFactoryBase() {}
+inline void ClobberMemory()
+{
+    asm volatile("" : : : "memory");
+}
+#else
+void useCharPointer(char const volatile *p);
+
+template <typename T>
+inline void DoNotOptimize(T const &value)
+{
+    useCharPointer(&reinterpret_cast<char const volatile&>(value));
+}
+
+inline void ClobberMemory()
+{
+    useCharPointer(0);
+}
+#endif
+
+/**
+ * The TestFactory template class knows how to make one
+ * type of Test. In fact, this is all it does. Registrations
+ * refer to TestFactory<T>::create as a plain function pointer,
+ * so no factory object is ever allocated.
+ *
+ * IMPLEMENTATION DETAIL
+ */
+template <typename T>
+class TestFactory
+{
+  public:
+    static Test* create() { return new T(); }
+};
+
+/**
+ * A RegToken is essentially a handle into the internal
+ * storage of tests and their registrations.
+ *
+ * IMPLEMENTATION DETAIL
+ */
+typedef int RegToken;
+
+/**
+ * RunningTestToken stands for the test running on the calling
+ * thread, in code that has no token of its own, such as a static
+ * member of a parameterized fixture. Tokens below it stand for a
+ * TEST_P(), whose running case is found when an assertion fails.
+ *
+ * IMPLEMENTATION DETAIL
+ */
+static const RegToken RunningTestToken = -1;
+
+/**
+ * The kinds of registered tests. Benchmarks only run when
+ * selected with RunOptions::benchmarks.
+ *
+ * IMPLEMENTATION DETAIL
+ */
+enum TestKind { KindTest, KindBenchmark };
+
+/**
+ * A TestRegistration describes one test: its suite name, its own
+ * test name, the function that creates instances of it, its kind,
+ * and its suite's SetUpTestSuite() and TearDownTestSuite(). TEST()
+ * and friends define one per test as a static object with constant
+ * initialization, so it costs no heap and no code before main()
+ * beyond linking it into the list of tests.
+ *
+ * A TYPED_TEST() has one registration per type of its suite's
+ * type list, told apart by typeIndex.
+ *
+ * IMPLEMENTATION DETAIL
+ */
+struct TestRegistration
+{
+    char const       *suiteName;
+    char const       *testName;
+    Test*           (*create)();
+    TestKind          kind;
+    unsigned          typeIndex; ///< 1 + position in a type list, or 0
+    void            (*setUpSuite)();
+    void            (*tearDownSuite)();
+    TestRegistration *next;      ///< set by registerTest()
+};
+
+/**
+ * Internal function registerTest() appends a test's registration
+ * to embtest's list of tests, and if all is successful, returns a
+ * RegToken for later use. The registration must outlive the run.
+ *
+ * IMPLEMENTATION DETAIL
+ */
+RegToken registerTest(TestRegistration *registration);
+
+/**
+ * A compile-time list of types for TYPED_TEST_SUITE().
+ *
+ * PUBLIC
+ */
+template <typename... T>
+struct Types { };
+
+/**
+ * TypedTestRegistrar<0, TestClass, Types<...> >::registerAll()
+ * registers TestClass<T> for each type T of the list, in order.
+ * Each instantiation has its own static registration and token.
+ *
+ * IMPLEMENTATION DETAIL
+ */
+template <unsigned Index, template <typename> class TestClass, typename TypeList>
+struct TypedTestRegistrar;
+
+template <unsigned Index, template <typename> class TestClass>
+struct TypedTestRegistrar<Index, TestClass, Types<> >
+{
+    static bool registerAll() { return true; }
+};
+
+template <unsigned Index, template <typename> class TestClass, typename Head, typename... Tail>
+struct TypedTestRegistrar<Index, TestClass, Types<Head, Tail...> >
+{
+    static bool registerAll()
+    {
+        TestClass<Head>::s_registration.typeIndex = Index + 1;
+        TestClass<Head>::s_registrationToken = registerTest(&TestClass<Head>::s_registration);
+        return TypedTestRegistrar<Index + 1, TestClass, Types<Tail...> >::registerAll();
+    }
+};
+/**
+ * Internally, tests are assumed to pass. Once a test condition
+ * fails, the test is marked as failing.
+ *
+ * recordTestFailure() uses the RegToken from registerTest() to
+ * note a test has failed.
+ *
+ * IMPLEMENTATION DETAIL
+ */
+void recordTestFailure(RegToken token);
+
+/**
+ * Retrieve the current output stream.
+ *
+ * PUBLIC
+ */
+std::ostream& getOutstream();
+
+/**
+ * Start reporting a failure of the test with \c token at \c line
+ * of \c file, and return the stream that takes its message. This
+ * may be called from any thread of the test.
+ *
+ * IMPLEMENTATION DETAIL
+ */
+std::ostream& beginFailure(int line, char const* file, RegToken token);
+
+/**
+ * EMBTEST_LIKELY() tells the compiler which way a condition
+ * usually goes, so the passing path of an assertion falls through
+ * and the failure path is laid out of the way. EMBTEST_COLD marks
+ * a function only called on failure.
+ *
+ * IMPLEMENTATION DETAIL
+ */
+#if defined(__GNUC__)
+#define EMBTEST_LIKELY(cond) __builtin_expect(!!(cond), 1)
+#define EMBTEST_COLD __attribute__((cold, noinline))
+#else
+#define EMBTEST_LIKELY(cond) (!!(cond))
+#define EMBTEST_COLD
+#endif
+
+/**
+ * The few type traits this header uses, written out so it needs
+ * neither <type_traits> nor <utility>. Each behaves like its std::
+ * namesake for the types embtest gives it. IsEnum and
+ * UnderlyingType use the compiler builtins that the standard
+ * library's own traits are built on.
+ *
+ * IMPLEMENTATION DETAIL
+ */
+template <typename T> T&& declval();
+
+template <bool Condition, typename T = void> struct EnableIf { };
+template <typename T> struct EnableIf<true, T> { typedef T type; };
+
+template <bool Condition, typename T, typename F> struct Conditional { typedef T type; };
+template <typename T, typename F> struct Conditional<false, T, F> { typedef F type; };
+
+template <typename T, typename U> struct IsSame { static const bool value = false; };
+template <typename T> struct IsSame<T, T> { static const bool value = true; };
+
+template <typename T> struct RemoveReference { typedef T type; };
+template <typename T> struct RemoveReference<T&> { typedef T type; };
+template <typename T> struct RemoveReference<T&&> { typedef T type; };
+
+template <typename T> struct RemoveCV { typedef T type; };
+template <typename T> struct RemoveCV<T const> { typedef T type; };
+template <typename T> struct RemoveCV<T volatile> { typedef T type; };
+template <typename T> struct RemoveCV<T const volatile> { typedef T type; };
+
+template <typename T> struct Decay { typedef typename RemoveCV<T>::type type; };
+template <typename T> struct Decay<T&> : Decay<T> { };
+template <typename T> struct Decay<T&&> : Decay<T> { };
+template <typename T, size_t N> struct Decay<T[N]> { typedef T *type; };
+
+template <typename... T> struct CommonType;
+template <typename T> struct CommonType<T> { typedef typename Decay<T>::type type; };
+template <typename T, typename U, typename... Rest>
+struct CommonType<T, U, Rest...>
+    : CommonType<decltype(true ? declval<typename Decay<T>::type>()
+                               : declval<typename Decay<U>::type>()), Rest...> { };
+
+template <typename T> struct IsIntegral { static const bool value = false; };
+template <typename T> struct IsIntegral<T const> : IsIntegral<T> { };
+
+#define EMBTEST_INTEGRAL(type)                                       \
+template <> struct IsIntegral<type> { static const bool value = true; };
+
+EMBTEST_INTEGRAL(bool)
+EMBTEST_INTEGRAL(char)
+EMBTEST_INTEGRAL(signed char)
+EMBTEST_INTEGRAL(unsigned char)
+EMBTEST_INTEGRAL(wchar_t)
+EMBTEST_INTEGRAL(char16_t)
+EMBTEST_INTEGRAL(char32_t)
+EMBTEST_INTEGRAL(short)
+EMBTEST_INTEGRAL(unsigned short)
+EMBTEST_INTEGRAL(int)
+EMBTEST_INTEGRAL(unsigned int)
+EMBTEST_INTEGRAL(long)
+EMBTEST_INTEGRAL(unsigned long)
+EMBTEST_INTEGRAL(long long)
+EMBTEST_INTEGRAL(unsigned long long)
+
+#undef EMBTEST_INTEGRAL
+
+template <typename T> struct IsPointer { static const bool value = false; };
+template <typename T> struct IsPointer<T*> { static const bool value = true; };
+
+template <typename T> struct IsEnum { static const bool value = __is_enum(T); };
+template <typename T> struct UnderlyingType { typedef __underlying_type(T) type; };
+
+/**
+ * A ValuePrinter writes the operand at \c value to \c out. The
+ * failure reports take operands through a ValuePrinter, so the
+ * formatting code is compiled once instead of inlined into every
+ * assertion.
+ *
+ * IMPLEMENTATION DETAIL
+ */
+typedef void (*ValuePrinter)(std::ostream &out, void const *value);
+
+/**
+ * HasStreamOperator<T>::value is true if a non-member operator<<
+ * writes a T to a std::ostream. Only non-members are found, so this
+ * also works where std::ostream is incomplete.
+ *
+ * IMPLEMENTATION DETAIL
+ */
+template <typename T>
+class HasStreamOperator
+{
+    template <typename U>
+    static char test(typename RemoveReference<decltype(
+        operator<<(declval<std::ostream&>(), declval<U const&>()))>::type *);
+    template <typename U>
+    static long test(...);
+
+  public:
+    static const bool value = sizeof(test<T>(0)) == 1;
+};
+
+/**
+ * IsString<T>::value is true for a string class of char with
+ * c_str() and size(), such as std::string. Strings are written
+ * by the library, so this header needn't include <string>.
+ *
+ * IMPLEMENTATION DETAIL
+ */
+template <typename T>
+class IsString
+{
+    template <typename U>
+    static char test(decltype(static_cast<char const*>(declval<U const&>().c_str())) *,
+                     decltype(static_cast<size_t>(declval<U const&>().size())) *);
+    template <typename U>
+    static long test(...);
+
+  public:
+    static const bool value = sizeof(test<T>(0, 0)) == 1;
+};
+
+/**
+ * Write \c length characters at \c text.
+ *
+ * IMPLEMENTATION DETAIL
+ */
+void printString(std::ostream &out, char const *text, size_t length);
+
+/**
+ * ValueFormat<T>::print is the ValuePrinter of a T. It writes the
+ * value with operator<<, which needs the complete std::ostream.
+ * The common scalar types, strings and pointers are written out of
+ * line by the library instead, so comparing them needs only
+ * <iosfwd>. Enums without an operator<< of their own are written
+ * as their integer value.
+ *
+ * IMPLEMENTATION DETAIL
+ */
+template <typename T, typename Enable = void>
+struct ValueFormat
+{
+    static void print(std::ostream &out, void const *value)
+    {
+        out << *static_cast<T const*>(value);
+    }
+};
+
+#define EMBTEST_VALUE_FORMAT(type)                                   \
+template <> struct ValueFormat<type>                                 \
+{                                                                    \
+    static void print(std::ostream &out, void const *value);         \
+};
+
+EMBTEST_VALUE_FORMAT(bool)
+EMBTEST_VALUE_FORMAT(char)
+EMBTEST_VALUE_FORMAT(signed char)
+EMBTEST_VALUE_FORMAT(unsigned char)
+EMBTEST_VALUE_FORMAT(short)
+EMBTEST_VALUE_FORMAT(unsigned short)
+EMBTEST_VALUE_FORMAT(int)
+EMBTEST_VALUE_FORMAT(unsigned int)
+EMBTEST_VALUE_FORMAT(long)
+EMBTEST_VALUE_FORMAT(unsigned long)
+EMBTEST_VALUE_FORMAT(long long)
+EMBTEST_VALUE_FORMAT(unsigned long long)
+EMBTEST_VALUE_FORMAT(float)
+EMBTEST_VALUE_FORMAT(double)
+EMBTEST_VALUE_FORMAT(long double)
+EMBTEST_VALUE_FORMAT(char const*)
+EMBTEST_VALUE_FORMAT(char*)
+EMBTEST_VALUE_FORMAT(void const*)
+EMBTEST_VALUE_FORMAT(std::nullptr_t)
+
+#undef EMBTEST_VALUE_FORMAT
+
+template <typename T>
+struct ValueFormat<T*>
+{
+    static void print(std::ostream &out, void const *value)
+    {
+        // A C-style cast, as it also takes function pointers.
+        void const *address = (void const*)(*static_cast<T* const*>(value));
+        ValueFormat<void const*>::print(out, &address);
+    }
+};
+
+template <typename T, size_t N>
+struct ValueFormat<T[N]>
+{
+    static void print(std::ostream &out, void const *value)
+    {
+        T const *first = *static_cast<T const (*)[N]>(value);
+        ValueFormat<T const*>::print(out, &first);
+    }
+};
+
+template <typename T>
+struct ValueFormat<T, typename EnableIf<IsEnum<T>::value &&
+                                        !HasStreamOperator<T>::value>::type>
+{
+    typedef typename UnderlyingType<T>::type Underlying;
+    typedef typename Conditional<(static_cast<Underlying>(-1) < static_cast<Underlying>(0)),
+                                 long long, unsigned long long>::type Integer;
+
+    static void print(std::ostream &out, void const *value)
+    {
+        Integer integer = static_cast<Integer>(*static_cast<T const*>(value));
+        ValueFormat<Integer>::print(out, &integer);
+    }
 };
 
+template <typename T>
+struct ValueFormat<T, typename EnableIf<IsString<T>::value>::type>
+{
+    static void print(std::ostream &out, void const *value)
+    {
+        T const &text = *static_cast<T const*>(value);
+        printString(out, text.c_str(), static_cast<size_t>(text.size()));
+    }
+};
+
+/**
+ * Report a failed comparison of two operands, \c lval \c oper
+ * \c rval, and mark the test as failing.
+ *
+ * IMPLEMENTATION DETAIL
+ */
+EMBTEST_COLD
+void conditionFailed(bool asserted,
+                     char const* lstr, char const* rstr,
+                     void const* lval, ValuePrinter lprint,
+                     void const* rval, ValuePrinter rprint,
+                     int line, char const* file, char const* oper, RegToken token);
+
+/**
+ * Report that \c lstr isn't \c expected, "true" or "false", and
+ * mark the test as failing.
+ *
+ * IMPLEMENTATION DETAIL
+ */
+EMBTEST_COLD
+void truthFailed(bool asserted, char const* lstr, char const* expected,
+                 int line, char const* file, RegToken token);
+
+/**
+ * Templatized function assert_eq() provides a safe workspace
+ * to evaluate equality of two operands (left and right).
+ *
+ * Since the left and right expressions are written as parameters
+ * in the caller, they are guaranteed to be invoked once, while
+ * maintaining any side effects they may have. Only their values
+ * are compared here. They are taken by reference, so a passing
+ * assertion costs a comparison and a branch, without copying.
+ *
+ * If the operands are inequal, the error is reported and the
+ * test is marked as failing.
+ *
+ * Return value is true if the two operands are equal.
+ *
+ * IMPLEMENTATION DETAIL
+ */
+template <typename LType, typename RType>
+inline bool assert_eq(bool asserted,
+                      char const* lstr, char const* rstr,
+                      LType const& lval, RType const& rval,
+                      int line, char const* file, RegToken token)
+{
+    if (EMBTEST_LIKELY(lval == rval))
+        return true;
+    conditionFailed(asserted, lstr, rstr, &lval, &ValueFormat<LType>::print,
+                    &rval, &ValueFormat<RType>::print,
+                    line, file, "==", token);
+    return false;
+}
+
+/**
+ * See assert_eq().
+ * This method, assert_ne(), tests inequality of two operands.
+ * Return value is true if the two operands are not equal.
+ *
+ * IMPLEMENTATION DETAIL
+ */
+template <typename LType, typename RType>
+inline bool assert_ne(bool asserted,
+                      char const* lstr, char const* rstr,
+                      LType const& lval, RType const& rval,
+                      int line, char const* file, RegToken token)
+{
+    if (EMBTEST_LIKELY(lval != rval))
+        return true;
+    conditionFailed(asserted, lstr, rstr, &lval, &ValueFormat<LType>::print,
+                    &rval, &ValueFormat<RType>::print,
+                    line, file, "!=", token);
+    return false;
+}
+
+template <typename LType, typename RType>
+inline bool assert_lt(bool asserted,
+                      char const* lstr, char const* rstr,
+                      LType const& lval, RType const& rval,
+                      int line, char const* file, RegToken token)
+{
+    if (EMBTEST_LIKELY(lval < rval))
+        return true;
+    conditionFailed(asserted, lstr, rstr, &lval, &ValueFormat<LType>::print,
+                    &rval, &ValueFormat<RType>::print,
+                    line, file, "<", token);
+    return false;
+}
+
+template <typename LType, typename RType>
+inline bool assert_le(bool asserted,
+                      char const* lstr, char const* rstr,
+                      LType const& lval, RType const& rval,
+                      int line, char const* file, RegToken token)
+{
+    if (EMBTEST_LIKELY(lval <= rval))
+        return true;
+    conditionFailed(asserted, lstr, rstr, &lval, &ValueFormat<LType>::print,
+                    &rval, &ValueFormat<RType>::print,
+                    line, file, "<=", token);
+    return false;
+}
+
+template <typename LType, typename RType>
+inline bool assert_gt(bool asserted,
+                      char const* lstr, char const* rstr,
+                      LType const& lval, RType const& rval,
+                      int line, char const* file, RegToken token)
+{
+    if (EMBTEST_LIKELY(lval > rval))
+        return true;
+    conditionFailed(asserted, lstr, rstr, &lval, &ValueFormat<LType>::print,
+                    &rval, &ValueFormat<RType>::print,
+                    line, file, ">", token);
+    return false;
+}
+
+template <typename LType, typename RType>
+inline bool assert_ge(bool asserted,
+                      char const* lstr, char const* rstr,
+                      LType const& lval, RType const& rval,
+                      int line, char const* file, RegToken token)
+{
+    if (EMBTEST_LIKELY(lval >= rval))
+        return true;
+    conditionFailed(asserted, lstr, rstr, &lval, &ValueFormat<LType>::print,
+                    &rval, &ValueFormat<RType>::print,
+                    line, file, ">=", token);
+    return false;
+}
+
+
+template <typename LType, typename RType>
+inline bool assert_fpeq(bool asserted,
+                        char const* lstr, char const* rstr,
+                        LType const& lval, RType const& rval, float eps,
+                        int line, char const* file, RegToken token)
+{
+    if (EMBTEST_LIKELY(lval - rval < eps && rval - lval < eps))
+        return true;
+    conditionFailed(asserted, lstr, rstr, &lval, &ValueFormat<LType>::print,
+                    &rval, &ValueFormat<RType>::print,
+                    line, file, "==", token);
+    return false;
+}
+/**
+ * Assert that some expression is true
+ *
+ * IMPLEMENTATION DETAIL
+ */
+template <typename LType>
+inline bool assert_true(bool asserted,
+                        char const* lstr,
+                        LType const& lval,
+                        int line, char const* file, RegToken token)
+{
+    if (EMBTEST_LIKELY(lval))
+        return true;
+    truthFailed(asserted, lstr, "true", line, file, token);
+    return false;
+}
+
+/**
+ * Assert that some expression is false
+ *
+ * IMPLEMENTATION DETAIL
+ */
+template <typename LType>
+inline bool assert_false(bool asserted,
+                         char const* lstr,
+                         LType const& lval,
+                         int line, char const* file, RegToken token)
+{
+    if (EMBTEST_LIKELY(!(lval)))
+        return true;
+    truthFailed(asserted, lstr, "false", line, file, token);
+    return false;
+}
+
+/**
+ * Compare \c length bytes at \c left and \c right, and on a
+ * difference report how many bytes differ, the offset of the first
+ * one, and the bytes around it in hex. See EXPECT_BYTES_EQ().
+ *
+ * IMPLEMENTATION DETAIL
+ */
+bool checkBytesEqual(bool asserted,
+                     char const *lstr, char const *rstr, char const *nstr,
+                     void const *left, void const *right, size_t length,
+                     int line, char const *file, RegToken token);
+
+/**
+ * Compare two arrays of elements of \c elementSize bytes, whose
+ * values are equal if their bytes are, and report the differences
+ * as checkBytesEqual() does, with the first differing elements
+ * written by \c print.
+ *
+ * IMPLEMENTATION DETAIL
+ */
+bool checkRangeBytes(bool asserted,
+                     char const *lstr, char const *rstr,
+                     void const *left, size_t leftSize,
+                     void const *right, size_t rightSize,
+                     size_t elementSize, ValuePrinter print,
+                     int line, char const *file, RegToken token);
+
+/**
+ * Report ranges that differ in size, or in \c differ elements of
+ * which the first, at index \c first, are \c lval and \c rval.
+ *
+ * IMPLEMENTATION DETAIL
+ */
+EMBTEST_COLD
+void rangeFailed(bool asserted,
+                 char const *lstr, char const *rstr,
+                 size_t leftSize, size_t rightSize, size_t differ, size_t first,
+                 void const *lval, ValuePrinter lprint,
+                 void const *rval, ValuePrinter rprint,
+                 int line, char const *file, RegToken token);
+
+/**
+ * RangeAccess<R> walks the elements of a range R: a C array, or a
+ * container with begin() and end(). Arrays, and containers with
+ * data() and size() such as std::vector and std::string, are
+ * contiguous, and walked with pointers.
+ *
+ * IMPLEMENTATION DETAIL
+ */
+template <typename R>
+class HasData
+{
+    template <typename U>
+    static char test(typename RemoveReference<decltype(*declval<U const&>().data())>::type *,
+                     decltype(declval<U const&>().size()) * = 0);
+    template <typename U>
+    static long test(...);
+
+  public:
+    static const bool value = sizeof(test<R>(0)) == 1;
+};
+
+template <typename R, bool Contiguous = HasData<R>::value>
+struct RangeAccess
+{
+    typedef decltype(declval<R const&>().begin()) Iterator;
+    typedef typename Decay<decltype(*declval<Iterator>())>::type Element;
+    static const bool contiguous = false;
+
+    static Iterator begin(R const &range) { return range.begin(); }
+    static Iterator end(R const &range)   { return range.end(); }
+};
+
+template <typename R>
+struct RangeAccess<R, true>
+{
+    typedef typename RemoveCV<typename RemoveReference<
+        decltype(*declval<R const&>().data())>::type>::type Element;
+    typedef Element const *Iterator;
+    static const bool contiguous = true;
+
+    static Iterator begin(R const &range) { return range.data(); }
+    static Iterator end(R const &range)   { return range.data() + range.size(); }
+};
+
+template <typename T, size_t N>
+struct RangeAccess<T[N], false>
+{
+    typedef T const *Iterator;
+    typedef typename RemoveCV<T>::type Element;
+    static const bool contiguous = true;
+
+    static Iterator begin(T const (&range)[N]) { return range; }
+    static Iterator end(T const (&range)[N])   { return range + N; }
+};
+
+/**
+ * Ranges are compared as bytes when both are contiguous, and hold
+ * the same integer, enum or pointer type, whose values are equal
+ * exactly when their bytes are. Other ranges are compared element
+ * by element with ==.
+ *
+ * IMPLEMENTATION DETAIL
+ */
+template <typename L, typename R,
+          bool Bytewise = L::contiguous && R::contiguous &&
+                          IsSame<typename L::Element, typename R::Element>::value &&
+                          (IsIntegral<typename L::Element>::value ||
+                           IsEnum<typename L::Element>::value ||
+                           IsPointer<typename L::Element>::value)>
+struct RangeCompare
+{
+    template <typename LRange, typename RRange>
+    static bool check(bool asserted, char const *lstr, char const *rstr,
+                      LRange const &left, RRange const &right,
+                      int line, char const *file, RegToken token)
+    {
+        typename L::Iterator l = L::begin(left), lend = L::end(left), lfirst = l;
+        typename R::Iterator r = R::begin(right), rend = R::end(right), rfirst = r;
+        size_t index = 0, differ = 0, first = 0;
+        for (; l != lend && r != rend; ++l, ++r, ++index)
+        {
+            if (EMBTEST_LIKELY(*l == *r))
+                continue;
+            if (differ++ == 0)
+            {
+                first = index;
+                lfirst = l;
+                rfirst = r;
+            }
+        }
+        if (EMBTEST_LIKELY(differ == 0 && l == lend && r == rend))
+            return true;
+
+        size_t leftSize = index, rightSize = index;
+        for (; l != lend; ++l)
+            leftSize++;
+        for (; r != rend; ++r)
+            rightSize++;
+        if (differ == 0)
+        {
+            rangeFailed(asserted, lstr, rstr, leftSize, rightSize, 0, 0, 0, 0, 0, 0,
+                        line, file, token);
+            return false;
+        }
+        typename L::Element const &lval = *lfirst;
+        typename R::Element const &rval = *rfirst;
+        rangeFailed(asserted, lstr, rstr, leftSize, rightSize, differ, first,
+                    &lval, &ValueFormat<typename L::Element>::print,
+                    &rval, &ValueFormat<typename R::Element>::print,
+                    line, file, token);
+        return false;
+    }
+};
+
+template <typename L, typename R>
+struct RangeCompare<L, R, true>
+{
+    template <typename LRange, typename RRange>
+    static bool check(bool asserted, char const *lstr, char const *rstr,
+                      LRange const &left, RRange const &right,
+                      int line, char const *file, RegToken token)
+    {
+        typename L::Iterator l = L::begin(left);
+        typename R::Iterator r = R::begin(right);
+        return checkRangeBytes(asserted, lstr, rstr,
+                               l, static_cast<size_t>(L::end(left) - l),
+                               r, static_cast<size_t>(R::end(right) - r),
+                               sizeof(typename L::Element), &ValueFormat<typename L::Element>::print,
+                               line, file, token);
+    }
+};
+
+/**
+ * Compare the ranges \c left and \c right: see EXPECT_RANGE_EQ().
+ *
+ * IMPLEMENTATION DETAIL
+ */
+template <typename LRange, typename RRange>
+inline bool assert_range_eq(bool asserted, char const *lstr, char const *rstr,
+                            LRange const &left, RRange const &right,
+                            int line, char const *file, RegToken token)
+{
+    return RangeCompare<RangeAccess<LRange>, RangeAccess<RRange> >::check(
+        asserted, lstr, rstr, left, right, line, file, token);
+}
+
+/**
+ * Compare \c length floating point values at \c left and \c right,
+ * each pair within an absolute plus relative tolerance, and on a
+ * failure report the largest errors and a histogram of them. See
+ * EXPECT_ARRAY_NEAR().
+ *
+ * IMPLEMENTATION DETAIL
+ */
+bool checkArrayNear(bool asserted,
+                    char const *lstr, char const *rstr, char const *nstr,
+                    float const *left, float const *right, size_t length,
+                    double absTolerance, double relTolerance,
+                    int line, char const *file, RegToken token);
+bool checkArrayNear(bool asserted,
+                    char const *lstr, char const *rstr, char const *nstr,
+                    double const *left, double const *right, size_t length,
+                    double absTolerance, double relTolerance,
+                    int line, char const *file, RegToken token);
+
+/**
+ * Compare \c length floating point values at \c left and \c right,
+ * each pair at most \c maxUlps units in the last place apart, and
+ * report a failure as checkArrayNear() does. See EXPECT_ARRAY_ULPS().
+ *
+ * IMPLEMENTATION DETAIL
+ */
+bool checkArrayUlps(bool asserted,
+                    char const *lstr, char const *rstr, char const *nstr,
+                    float const *left, float const *right, size_t length,
+                    uint64_t maxUlps,
+                    int line, char const *file, RegToken token);
+bool checkArrayUlps(bool asserted,
+                    char const *lstr, char const *rstr, char const *nstr,
+                    double const *left, double const *right, size_t length,
+                    uint64_t maxUlps,
+                    int line, char const *file, RegToken token);
+
+/**
+ * Force a test failure outside of an assertion.
+ *
+ * Indicate a test failure by specifying the file and line number,
+ * and the test RegToken for bookkeeping.
+ *
+ * @return Reference to the output stream for trailing messages.
+ *
+ * @see the @ref FAIL()
+ *
+ * IMPLEMENTATION DETAIL, use FAIL() instead.
+ */
+std::ostream& forceFailure(int line, char const* file, RegToken token);
+
+/**
+ * Performance assertions measure callables through a PerfBody,
+ * which calls \c callable \c iterations times.
+ *
+ * IMPLEMENTATION DETAIL
+ */
+typedef void (*PerfBody)(void *callable, uint64_t iterations);
+
+template <typename Callable>
+void runPerfBody(void *callable, uint64_t iterations)
+{
+    Callable &call = *static_cast<Callable*>(callable);
+    for (uint64_t i=0; i < iterations; ++i)
+        call();
+}
+
+/**
+ * Time \c baseline and \c candidate in interleaved samples, and
+ * fail unless the candidate takes at most \c ratio times as long
+ * as the baseline. See EXPECT_FASTER_THAN().
+ *
+ * IMPLEMENTATION DETAIL
+ */
+bool checkFasterThan(bool asserted,
+                     char const *bstr, PerfBody baseline, void *baselineCallable,
+                     char const *cstr, PerfBody candidate, void *candidateCallable,
+                     char const *rstr, double ratio,
+                     int line, char const *file, RegToken token);
+
+/**
+ * Time \c body in repeated samples, and fail unless it takes less
+ * than \c budgetNs nanoseconds. See EXPECT_DURATION_LT().
+ *
+ * IMPLEMENTATION DETAIL
+ */
+bool checkDurationLess(bool asserted,
+                       char const *stmt, PerfBody body, void *callable,
+                       char const *bstr, double budgetNs,
+                       int line, char const *file, RegToken token);
+
+/**
+ * Templatized wrappers of the performance checks, which take any
+ * callables and std::chrono durations.
+ *
+ * IMPLEMENTATION DETAIL
+ */
+template <typename Baseline, typename Candidate>
+bool assert_faster_than(bool asserted,
+                        char const *bstr, char const *cstr, char const *rstr,
+                        Baseline baseline, Candidate candidate, double ratio,
+                        int line, char const *file, RegToken token)
+{
+    return checkFasterThan(asserted,
+                           bstr, &runPerfBody<Baseline>, &baseline,
+                           cstr, &runPerfBody<Candidate>, &candidate,
+                           rstr, ratio, line, file, token);
+}
+
+template <typename Callable, typename Duration>
+bool assert_duration_lt(bool asserted, char const *stmt, char const *bstr,
+                        Callable body, Duration budget,
+                        int line, char const *file, RegToken token)
+{
+    typedef typename Duration::period Period;
+    double budgetNs = static_cast<double>(budget.count()) * 1e9 * Period::num / Period::den;
+    return checkDurationLess(asserted, stmt, &runPerfBody<Callable>, &body,
+                             bstr, budgetNs, line, file, token);
+}
+
+/**
+ * Predicates on how the child process of a death test ended, given
+ * its wait status: ExitedWithCode(n) holds if it exited with code
+ * n, and KilledBySignal(s) if it was killed by signal s.
+ *
+ * PUBLIC
+ */
+class ExitedWithCode
+{
+  public:
+    explicit ExitedWithCode(int code) : m_code(code) {}
+    bool operator()(int status) const;
+
+  private:
+    int m_code;
+};
+
+class KilledBySignal
+{
+  public:
+    explicit KilledBySignal(int signal) : m_signal(signal) {}
+    bool operator()(int status) const;
+
+  private:
+    int m_signal;
+};
+
+/**
+ * The predicate of EXPECT_DEATH(): the child was killed by a
+ * signal, or exited with a nonzero code.
+ *
+ * IMPLEMENTATION DETAIL
+ */
+class DiedAbnormally
+{
+  public:
+    bool operator()(int status) const;
+};
+
+/**
+ * A DeathTest runs one statement of a death test in a child
+ * process. The constructor forks; in the child, isChild() is true,
+ * the statement runs with its stderr captured, and childFinished()
+ * ends the child if the statement completes, throws, or leaves the
+ * test with a return, e.g. of a failed ASSERT_*(). The parent collects the
+ * child's stderr and wait status with wait(), and check() reports
+ * a failure if the child didn't end as expected.
+ *
+ * IMPLEMENTATION DETAIL, use EXPECT_DEATH() and friends instead.
+ */
+class DeathTest
+{
+  public:
+    DeathTest(char const *statement, char const *regex, int line, char const *file);
+    ~DeathTest();
+
+    /** How the statement ended in a child that didn't die. */
+    enum Outcome { Returned = 'R', Threw = 'T', LeftTest = 'L' };
+
+    bool isChild() const { return m_child; }
+
+    /** End the child, whose statement didn't kill it. */
+    void childFinished(Outcome outcome);
+
+    /** Wait for the child, and return its wait status. */
+    int wait();
+
+    /**
+     * Report a failure unless the child died, its status satisfied
+     * the predicate, and its stderr matches the regex.
+     */
+    bool check(bool asserted, bool statusMatched, char const *predicate, RegToken token);
+
+  private:
+    DeathTest(DeathTest const &) = delete;
+    DeathTest& operator=(DeathTest const &) = delete;
+
+    char const  *m_statement;
+    char const  *m_regex;
+    int          m_line;
+    char const  *m_file;
+    bool         m_child;
+    int          m_pid;
+    int          m_errFd;       ///< the child's stderr
+    int          m_outcomeFd;   ///< tells if the statement returned
+    int          m_status;
+    char         m_outcome;     ///< an Outcome, or 0 if the child died
+    char const  *m_error;       ///< why the child couldn't be run, or null
+
+    struct Output;
+    Output      *m_stderr;      ///< the child's stderr, read by wait()
+};
+
+/**
+ * A DeathTestSentinel guards the statement in the child. If the
+ * statement leaves the block it runs in, e.g. with the return of a
+ * failed ASSERT_*(), the sentinel ends the child, so the child never
+ * goes on to run the rest of the test and the tests after it.
+ *
+ * IMPLEMENTATION DETAIL
+ */
+class DeathTestSentinel
+{
+  public:
+    explicit DeathTestSentinel(DeathTest &test) : m_test(test) {}
+    ~DeathTestSentinel() { m_test.childFinished(DeathTest::LeftTest); }
+
+  private:
+    DeathTestSentinel(DeathTestSentinel const &) = delete;
+    DeathTestSentinel& operator=(DeathTestSentinel const &) = delete;
+
+    DeathTest &m_test;
+};
+
+/**
+ * Apply a death test's predicate to the child's wait status.
+ *
+ * IMPLEMENTATION DETAIL
+ */
+template <typename Predicate>
+bool statusMatches(Predicate const &predicate, int status)
+{
+    return predicate(status);
+}
+
+/**
+ * Allocation accounting. To count a program's heap allocations per
+ * test, link the embtest_alloc objects into it; they replace the
+ * global operator new and delete. An allocator of its own, e.g. on
+ * an embedded target, instead calls noteAllocation() for each block
+ * it hands out, keeps the returned tag with the block, and passes
+ * it back to noteDeallocation() when the block is freed. A tag of 0
+ * means the block isn't counted; an allocator that can't keep the
+ * tags may pass 0, and then gets no leak detection.
+ *
+ * Both are called from within allocators, so they never allocate,
+ * lock or throw.
+ *
+ * PUBLIC
+ */
+typedef uint32_t AllocationTag;
+
+AllocationTag noteAllocation(size_t size);
+void noteDeallocation(size_t size, AllocationTag tag);
+
+/**
+ * An AllocationBudget counts the allocations made by the test's
+ * thread during a block, and reports a failure if there were more
+ * than \c maxAllocations. The check runs when the block is left,
+ * however that happens. Without allocation tracking, it always
+ * passes.
+ *
+ * IMPLEMENTATION DETAIL, use EXPECT_MAX_ALLOCATIONS() instead.
+ */
+class AllocationBudget
+{
+  public:
+    AllocationBudget(uint64_t maxAllocations, int line, char const *file, RegToken token);
+    ~AllocationBudget();
+
+    /** True only on the first call, so a for loop runs the block once. */
+    bool once()
+    {
+        bool first = m_first;
+        m_first = false;
+        return first;
+    }
+
+  private:
+    AllocationBudget(AllocationBudget const &) = delete;
+    AllocationBudget& operator=(AllocationBudget const &) = delete;
+
+    uint64_t     m_maxAllocations;
+    int          m_line;
+    char const  *m_file;
+    RegToken     m_token;
+    bool         m_first;
+    uint64_t     m_startAllocations;
+    uint64_t     m_startBytes;
+};
+
+/**
+ * TestWithParam<T> is the base of fixtures for value-parameterized
+ * tests. TEST_P() declares a test of such a fixture, and each
+ * INSTANTIATE_TEST_SUITE_P() of the fixture runs it once for every
+ * value of a parameter generator.
+ *
+ * GetParam() returns the value of the running case. It is set
+ * after construction, so it is valid from SetUp() on, but not in
+ * the fixture's constructor.
+ *
+ * PUBLIC
+ */
+template <typename T>
+class TestWithParam : public Test
+{
+  public:
+    typedef T ParamType;
+
+    TestWithParam() : m_hasParam(false) {}
+    virtual ~TestWithParam()
+    {
+        if (m_hasParam)
+            param().~T();
+    }
+
+    T const& GetParam() const { return param(); }
+
+    /**
+     * Give the instance its case's parameter, kept in the instance.
+     *
+     * IMPLEMENTATION DETAIL
+     */
+    void setParam(T const &value)
+    {
+        if (m_hasParam)
+            param() = value;
+        else
+            new (&m_param) T(value);
+        m_hasParam = true;
+    }
+
+  protected:
+    /*
+     * Assertions in the fixture's static members, e.g. its
+     * SetUpTestSuite(), are of the case running on the thread.
+     * TEST_P() classes hide this with the token of the TEST_P().
+     */
+    static const RegToken s_registrationToken = RunningTestToken;
+
+  private:
+    TestWithParam(TestWithParam const &) = delete;
+    TestWithParam& operator=(TestWithParam const &) = delete;
+
+    T& param()             { return *reinterpret_cast<T*>(&m_param); }
+    T const& param() const { return *reinterpret_cast<T const*>(&m_param); }
+
+    alignas(T) unsigned char m_param[sizeof(T)];
+    bool m_hasParam;
+};
+
+/**
+ * A ParamTestRegistration describes one TEST_P(): its fixture and
+ * test names, the function that creates instances of it, and the
+ * fixture's suite setup and teardown. Like TestRegistration, it is
+ * a constant-initialized static object.
+ *
+ * IMPLEMENTATION DETAIL
+ */
+struct ParamTestRegistration
+{
+    char const            *fixtureName;
+    char const            *testName;
+    Test*                (*create)();
+    void                 (*setUpSuite)();
+    void                 (*tearDownSuite)();
+    ParamTestRegistration *next;    ///< set by registerParamTest()
+};
+
+/**
+ * Add a TEST_P() to the list of parameterized tests. It is run for
+ * each instantiation of its fixture. The returned token stands for
+ * whichever case of the TEST_P() is running; see RunningTestToken.
+ *
+ * IMPLEMENTATION DETAIL
+ */
+RegToken registerParamTest(ParamTestRegistration *registration);
+
+/**
+ * A ParamInstantiation is one INSTANTIATE_TEST_SUITE_P(): a name
+ * prefix, the fixture it instantiates, and a generator of the
+ * parameter values. Values are produced one at a time by index,
+ * when a case is created to run, so the cases of a large sweep
+ * never exist all at once.
+ *
+ * IMPLEMENTATION DETAIL
+ */
+class ParamInstantiation
+{
+  public:
+    ParamInstantiation(char const *prefix, char const *fixtureName);
+    virtual ~ParamInstantiation() {}
+
+    char const* prefix() const       { return m_prefix; }
+    char const* fixtureName() const  { return m_fixtureName; }
+
+    /** The number of parameter values. */
+    virtual size_t size() const = 0;
+
+    /**
+     * Create a test with \c create, and give it parameter value
+     * \c index.
+     */
+    virtual Test* create(Test* (*create)(), size_t index) const = 0;
+
+    ParamInstantiation *next;       ///< set by the constructor
+
+  private:
+    char const *m_prefix;
+    char const *m_fixtureName;
+};
+
+template <typename... G> class CombineGenerator;
+
+/**
+ * Value \c index of a generator, as the parameter type T.
+ * Combine() builds its values as T directly.
+ *
+ * IMPLEMENTATION DETAIL
+ */
+template <typename T, typename G>
+T paramValue(G const &generator, size_t index)
+{
+    return T(generator.at(index));
+}
+
+template <typename T, typename... G>
+T paramValue(CombineGenerator<G...> const &generator, size_t index)
+{
+    return generator.template make<T>(index);
+}
+
 /**
- * The TestFactory template class knows how to make one
- * type of Test. In fact, this is all it does.
+ * The ParamInstantiation of a fixture with parameter type T
+ * and a generator of type G.
  *
  * IMPLEMENTATION DETAIL
  */
-template <typename T>
-class TestFactory : public TestFactoryBase
+template <typename T, typename G>
+class ParamInstantiationOf : public ParamInstantiation
 {
   public:
-    virtual Test* makeTest() { return new T(); }
+    ParamInstantiationOf(char const *prefix, char const *fixtureName, G const &generator)
+        : ParamInstantiation(prefix, fixtureName)
+        , m_generator(generator)
+    { }
+
+    virtual size_t size() const { return m_generator.size(); }
+
+    virtual Test* create(Test* (*create)(), size_t index) const
+    {
+        Test *test = create();
+        static_cast<TestWithParam<T>*>(test)->setParam(paramValue<T>(m_generator, index));
+        return test;
+    }
+
+  private:
+    G m_generator;
 };
 
-/**
- * A RegToken is essentially a handle into the internal
- * storage of tests and their registrations.
+/*
+ * Parameter generators. A generator has a value_type, a size(),
+ * and at(i), which computes value i on demand. Combine() is the
+ * exception: it builds its values as the fixture's parameter type.
  *
- * IMPLEMENTATION DETAIL
+ * PUBLIC
  */
-typedef int RegToken;
 
 /**
- * Internal function registerTest() accepts a test's suite name,
- * its own test name, and a factory object for this test type.
- *
- * registerTest() then registers the test with embtest's test
- * registration mechanism, and if all is successful, returns a
- * RegToken for later use.
+ * The number of values of a RangeGenerator, computed rather than
+ * counted, so a large sweep costs nothing at static initialization.
  *
  * IMPLEMENTATION DETAIL
  */
-RegToken registerTest(char const *suitename,
-                      char const *testname,
-                      TestFactoryBase *factory);
+template <typename T, bool Integral = IsIntegral<T>::value>
+struct RangeSize
+{
+    static size_t of(T begin, T end, T step)
+    {
+        if (!(begin < end))
+            return 0;
+        T steps = (end - begin) / step;
+        size_t size = static_cast<size_t>(steps);
+        if (static_cast<T>(size) < steps)
+            size++;
+        // Agree with RangeGenerator::at() where rounding differs.
+        while (size > 0 && !(begin + static_cast<T>(size - 1) * step < end))
+            size--;
+        return size;
+    }
+};
+
+template <typename T>
+struct RangeSize<T, true>
+{
+    static size_t of(T begin, T end, T step)
+    {
+        // The difference of the values converted to unsigned is
+        // the span even when it doesn't fit in T.
+        typedef unsigned long long U;
+        if (!(begin < end))
+            return 0;
+        U span = static_cast<U>(end) - static_cast<U>(begin);
+        return static_cast<size_t>((span - 1) / static_cast<U>(step) + 1);
+    }
+};
+
 /**
- * Internally, tests are assumed to pass. Once a test condition
- * fails, the test is marked as failing.
- *
- * recordTestFailure() uses the RegToken from registerTest() to
- * note a test has failed.
+ * Throw std::invalid_argument for a Range() whose step isn't
+ * positive.
  *
  * IMPLEMENTATION DETAIL
  */
-void recordTestFailure(RegToken token);
+[[noreturn]] void rangeStepInvalid();
 
 /**
- * Retrieve the current output stream.
- *
- * PUBLIC
+ * The values begin, begin+step, ... up to but excluding end. The
+ * step must be positive; std::invalid_argument is thrown otherwise.
  */
-std::ostream& getOutstream();
+template <typename T>
+class RangeGenerator
+{
+  public:
+    typedef T value_type;
 
-/**
- * Templatized function to provide consistent error formatting
- * for assertion failures.
- */
-template <typename LType, typename RType>
-void logConditionFailure(bool asserted,
-                        char const* lstr, char const* rstr,
-                        LType const& lval, RType const& rval,
-                        int line, char const* file, char const* oper)
-{
-    getOutstream()
-        << "Failure: (line " << line << ") " << file << std::endl
-        << "       : It is " << (asserted ? "asserted":"expected")
-        << " that left " << oper << " right:" << std::endl
-        << "   left: " << lstr << " = " << lval << std::endl
-        << "  right: " << rstr << " = " << rval << std::endl;
+    RangeGenerator(T begin, T end, T step)
+        : m_begin(begin), m_step(step), m_size(0)
+    {
+        if (!(step > T(0)))
+            rangeStepInvalid();
+        m_size = RangeSize<T>::of(begin, end, step);
+    }
+
+    size_t size() const          { return m_size; }
+    T at(size_t index) const     { return m_begin + static_cast<T>(index) * m_step; }
+
+  private:
+    T      m_begin;
+    T      m_step;
+    size_t m_size;
+};
+
+template <typename T>
+RangeGenerator<T> Range(T begin, T end, T step)
+{
+    return RangeGenerator<T>(begin, end, step);
 }
 
-/**
- * Templatized function assert_eq() provides a safe workspace
- * to evaluate equality of two operands (left and right).
- *
- * Since the left and right expressions are written as parameters
- * in the caller, they are guaranteed to be invoked once, while
- * maintaining any side effects they may have. Only their values
- * are compared here.
- *
- * If the operands are inequal, the error is reported and the
- * test is marked as failing.
- *
- * Return value is true if the two operands are equal.
- *
- * IMPLEMENTATION DETAIL
- */
-template <typename LType, typename RType>
-bool assert_eq(bool asserted,
-               char const* lstr, char const* rstr,
-               LType lval, RType rval,
-               int line, char const* file, RegToken token)
+template <typename T>
+RangeGenerator<T> Range(T begin, T end)
 {
-    bool failed = !(lval == rval);
-    if (failed)
-    {
-        logConditionFailure(asserted, lstr, rstr, lval, rval, line, file, "==");
-        recordTestFailure(token);
-    }
-    return !failed;
+    return RangeGenerator<T>(begin, end, 1);
 }
 
 /**
- * See assert_eq().
- * This method, assert_ne(), tests inequality of two operands.
- * Return value is true if the two operands are not equal.
- *
- * IMPLEMENTATION DETAIL
+ * A fixed list of values, kept in the generator without
+ * allocating.
  */
-template <typename LType, typename RType>
-bool assert_ne(bool asserted,
-               char const* lstr, char const* rstr,
-               LType lval, RType rval,
-               int line, char const* file, RegToken token)
+template <typename T, size_t N>
+class ValueListGenerator
 {
-    bool failed = !(lval != rval);
-    if (failed)
-    {
-        logConditionFailure(asserted, lstr, rstr, lval, rval, line, file, "!=");
-        recordTestFailure(token);
-    }
-    return !failed;
+  public:
+    typedef T value_type;
+
+    template <typename... Args>
+    explicit ValueListGenerator(Args const&... values)
+        : m_values{ T(values)... }
+    { }
+
+    size_t size() const          { return N; }
+    T at(size_t index) const     { return m_values[index]; }
+
+  private:
+    T m_values[N];
+};
+
+template <typename... Args>
+ValueListGenerator<typename CommonType<Args...>::type, sizeof...(Args)>
+Values(Args const&... values)
+{
+    return ValueListGenerator<typename CommonType<Args...>::type,
+                              sizeof...(Args)>(values...);
 }
 
-template <typename LType, typename RType>
-bool assert_lt(bool asserted,
-               char const* lstr, char const* rstr,
-               LType lval, RType rval,
-               int line, char const* file, RegToken token)
+inline ValueListGenerator<bool, 2> Bool()
 {
-    bool failed = !(lval < rval);
-    if (failed)
-    {
-        logConditionFailure(asserted, lstr, rstr, lval, rval, line, file, "<");
-        recordTestFailure(token);
-    }
-    return !failed;
+    return Values(false, true);
 }
 
-template <typename LType, typename RType>
-bool assert_le(bool asserted,
-               char const* lstr, char const* rstr,
-               LType lval, RType rval,
-               int line, char const* file, RegToken token)
+/**
+ * The values of a container or array, copied into the generator.
+ * They are kept in storage of its own rather than a std::vector,
+ * so this header needn't include <vector>.
+ */
+template <typename T>
+class ValuesInGenerator
 {
-    bool failed = !(lval <= rval);
-    if (failed)
+  public:
+    typedef T value_type;
+
+    template <typename Iterator>
+    ValuesInGenerator(Iterator begin, Iterator end)
+        : m_values(0), m_size(0)
     {
-        logConditionFailure(asserted, lstr, rstr, lval, rval, line, file, "<=");
-        recordTestFailure(token);
+        copy(begin, end);
     }
-    return !failed;
-}
 
-template <typename LType, typename RType>
-bool assert_gt(bool asserted,
-               char const* lstr, char const* rstr,
-               LType lval, RType rval,
-               int line, char const* file, RegToken token)
-{
-    bool failed = !(lval > rval);
-    if (failed)
+    ValuesInGenerator(ValuesInGenerator const &other)
+        : m_values(0), m_size(0)
     {
-        logConditionFailure(asserted, lstr, rstr, lval, rval, line, file, ">");
-        recordTestFailure(token);
+        copy(other.m_values, other.m_values + other.m_size);
     }
-    return !failed;
-}
 
-template <typename LType, typename RType>
-bool assert_ge(bool asserted,
-               char const* lstr, char const* rstr,
-               LType lval, RType rval,
-               int line, char const* file, RegToken token)
-{
-    bool failed = !(lval >= rval);
-    if (failed)
+    ~ValuesInGenerator()
     {
-        logConditionFailure(asserted, lstr, rstr, lval, rval, line, file, ">=");
-        recordTestFailure(token);
+        for (size_t i=0; i < m_size; ++i)
+            m_values[i].~T();
+        ::operator delete(m_values);
     }
-    return !failed;
-}
 
+    size_t size() const          { return m_size; }
+    T at(size_t index) const     { return m_values[index]; }
 
-template <typename LType, typename RType>
-bool assert_fpeq(bool asserted,
-                 char const* lstr, char const* rstr,
-                 LType lval, RType rval, float eps,
-                 int line, char const* file, RegToken token)
-{
-    bool failed = !(std::abs(lval - rval) < eps);
-    if (failed)
+  private:
+    ValuesInGenerator& operator=(ValuesInGenerator const &) = delete;
+
+    template <typename Iterator>
+    void copy(Iterator begin, Iterator end)
     {
-        logConditionFailure(asserted, lstr, rstr, lval, rval, line, file, "==");
-        recordTestFailure(token);
+        size_t count = 0;
+        for (Iterator i = begin; i != end; ++i)
+            count++;
+        m_values = static_cast<T*>(::operator new(count * sizeof(T)));
+        for (; begin != end; ++begin, ++m_size)
+            new (m_values + m_size) T(*begin);
     }
-    return !failed;
+
+    T      *m_values;
+    size_t  m_size;
+};
+
+template <typename Container>
+ValuesInGenerator<typename Container::value_type> ValuesIn(Container const &values)
+{
+    return ValuesInGenerator<typename Container::value_type>(values.begin(), values.end());
 }
-/**
- * Assert that some expression is true
- *
- * IMPLEMENTATION DETAIL
- */
-template <typename LType>
-bool assert_true(bool asserted,
-                 char const* lstr,
-                 LType lval,
-                 int line, char const* file, RegToken token)
+
+template <typename T, size_t N>
+ValuesInGenerator<T> ValuesIn(T const (&values)[N])
 {
-    bool failed = !(lval);
-    if (failed)
-    {
-        getOutstream()
-            << "Failure: (line " << line << ") " << file << std::endl
-            << "       : It is " << (asserted ? "asserted":"expected")
-            << " that this is true:" << std::endl
-            << "   expr: " << lstr << std::endl;
-        recordTestFailure(token);
-    }
-    return !failed;
+    return ValuesInGenerator<T>(values, values + N);
 }
 
 /**
- * Assert that some expression is false
+ * The generators of a Combine(), held without std::tuple.
+ * make<T>(index, values...) appends the value of each generator
+ * for combination \c index to \c values, and builds a T of them.
+ * The last generator varies fastest.
  *
  * IMPLEMENTATION DETAIL
  */
-template <typename LType>
-bool assert_false(bool asserted,
-                 char const* lstr,
-                 LType lval,
-                 int line, char const* file, RegToken token)
+template <typename... G>
+struct GeneratorList
+{
+    size_t size() const { return 1; }
+
+    template <typename T, typename... V>
+    T make(size_t, V const&... values) const { return T(values...); }
+};
+
+template <typename G, typename... Rest>
+struct GeneratorList<G, Rest...>
 {
-    bool failed = !!(lval);
-    if (failed)
+    GeneratorList(G const &generator, Rest const&... others)
+        : first(generator), rest(others...)
+    { }
+
+    size_t size() const { return first.size() * rest.size(); }
+
+    template <typename T, typename... V>
+    T make(size_t index, V const&... values) const
     {
-        getOutstream()
-            << "Failure: (line " << line << ") " << file << std::endl
-            << "       : It is " << (asserted ? "asserted":"expected")
-            << " that this is false:" << std::endl
-            << "   expr: " << lstr << std::endl;
-        recordTestFailure(token);
+        size_t restSize = rest.size();
+        return rest.template make<T>(index % restSize, values..., first.at(index / restSize));
     }
-    return !failed;
-}
+
+    G                      first;
+    GeneratorList<Rest...> rest;
+};
 
 /**
- * Force a test failure outside of an assertion.
- *
- * Indicate a test failure by specifying the file and line number,
- * and the test RegToken for bookkeeping.
- *
- * @return Reference to the output stream for trailing messages.
- *
- * @see the @ref FAIL()
- *
- * IMPLEMENTATION DETAIL, use FAIL() instead.
+ * Every combination of the values of several generators. Each is
+ * built as the fixture's parameter type, e.g. a std::tuple of the
+ * generators' value types, from one value of each generator in
+ * order, so any type with a matching constructor works. Value i is
+ * decoded from i, so no combination is stored.
  */
-std::ostream& forceFailure(int line, char const* file, RegToken token);
+template <typename... G>
+class CombineGenerator
+{
+  public:
+    explicit CombineGenerator(G const&... generators)
+        : m_generators(generators...)
+    { }
+
+    size_t size() const          { return m_generators.size(); }
+
+    template <typename T>
+    T make(size_t index) const   { return m_generators.template make<T>(index); }
+
+  private:
+    GeneratorList<G...> m_generators;
+};
+
+template <typename... G>
+CombineGenerator<G...> Combine(G const&... generators)
+{
+    return CombineGenerator<G...>(generators...);
+}
 
 /*============================================
  * Start of truly public functions and macros
@@ -368,7 +1628,9 @@ std::ostream& forceFailure(int line, char const* file, RegToken token);
 /**
  * Provide a basic function to run all tests, and
  * print a final summary of the number of passed,
- * failed, and disabled tests.
+ * failed, and disabled tests. embtest_runner.hpp
+ * declares the options, reporters and environments
+ * that control a run.
  *
  * @param[in] out The output stream to write progress and summary information.
  * @returns Integer suitable for an exit code (0=success, 1=error)
@@ -392,6 +1654,51 @@ int runAndReport(std::ostream &out);
 #if defined(TEST_F)
 #error TEST_F macro already defined
 #endif
+#if defined(BENCHMARK)
+#error BENCHMARK macro already defined
+#endif
+#if defined(TEST_P)
+#error TEST_P macro already defined
+#endif
+#if defined(TYPED_TEST)
+#error TYPED_TEST macro already defined
+#endif
+#if defined(EXPECT_DEATH)
+#error EXPECT_DEATH macro already defined
+#endif
+#if defined(TYPED_TEST_SUITE)
+#error TYPED_TEST_SUITE macro already defined
+#endif
+#if defined(INSTANTIATE_TEST_SUITE_P)
+#error INSTANTIATE_TEST_SUITE_P macro already defined
+#endif
+#if defined(EXPECT_MAX_ALLOCATIONS)
+#error EXPECT_MAX_ALLOCATIONS macro already defined
+#endif
+#if defined(EXPECT_NO_ALLOCATIONS)
+#error EXPECT_NO_ALLOCATIONS macro already defined
+#endif
+#if defined(EXPECT_FASTER_THAN)
+#error EXPECT_FASTER_THAN macro already defined
+#endif
+#if defined(EXPECT_DURATION_LT)
+#error EXPECT_DURATION_LT macro already defined
+#endif
+#if defined(EXPECT_BYTES_EQ)
+#error EXPECT_BYTES_EQ macro already defined
+#endif
+#if defined(EXPECT_RANGE_EQ)
+#error EXPECT_RANGE_EQ macro already defined
+#endif
+#if defined(EXPECT_FPEQ)
+#error EXPECT_FPEQ macro already defined
+#endif
+#if defined(EXPECT_ARRAY_NEAR)
+#error EXPECT_ARRAY_NEAR macro already defined
+#endif
+#if defined(EXPECT_ARRAY_ULPS)
+#error EXPECT_ARRAY_ULPS macro already defined
+#endif
 
 /**
  * The TEST_CLASS_NAME(suite,test) macro provides
@@ -421,12 +1728,19 @@ class TEST_CLASS_NAME(suitename,testname): public embtest::Test      \
   public:                                                            \
     void TestBody();                                                 \
   private:                                                           \
+    static embtest::TestRegistration s_registration;                 \
     static embtest::RegToken s_registrationToken;                    \
 };                                                                   \
+/* describe the test with constant initialization */                 \
+embtest::TestRegistration TEST_CLASS_NAME(suitename,testname)::s_registration = { \
+    #suitename, #testname,                                           \
+    &embtest::TestFactory< TEST_CLASS_NAME(suitename,testname) >::create, \
+    embtest::KindTest, 0,                                            \
+    &TEST_CLASS_NAME(suitename,testname)::SetUpTestSuite,            \
+    &TEST_CLASS_NAME(suitename,testname)::TearDownTestSuite, 0 };    \
 /* invoke static-initialization registration */                      \
 embtest::RegToken TEST_CLASS_NAME(suitename,testname)::s_registrationToken =  \
-embtest::registerTest(#suitename, #testname,                         \
-new embtest::TestFactory< TEST_CLASS_NAME(suitename,testname) >());  \
+embtest::registerTest(&TEST_CLASS_NAME(suitename,testname)::s_registration); \
 /* implement test body as following block */                         \
 void TEST_CLASS_NAME(suitename,testname)::TestBody()
 
@@ -446,15 +1760,165 @@ class TEST_CLASS_NAME(fixture,testname): public fixture              \
   public:                                                            \
     void TestBody();                                                 \
   private:                                                           \
+    static embtest::TestRegistration s_registration;                 \
     static embtest::RegToken s_registrationToken;                    \
 };                                                                   \
+/* describe the test with constant initialization */                 \
+embtest::TestRegistration TEST_CLASS_NAME(fixture,testname)::s_registration = { \
+    #fixture, #testname,                                             \
+    &embtest::TestFactory< TEST_CLASS_NAME(fixture,testname) >::create, \
+    embtest::KindTest, 0,                                            \
+    &TEST_CLASS_NAME(fixture,testname)::SetUpTestSuite,              \
+    &TEST_CLASS_NAME(fixture,testname)::TearDownTestSuite, 0 };      \
 /* invoke static-initialization registration */                      \
 embtest::RegToken TEST_CLASS_NAME(fixture,testname)::s_registrationToken =  \
-embtest::registerTest(#fixture, #testname,                           \
-new embtest::TestFactory< TEST_CLASS_NAME(fixture,testname) >());    \
+embtest::registerTest(&TEST_CLASS_NAME(fixture,testname)::s_registration); \
+/* implement test body as following block */                         \
+void TEST_CLASS_NAME(fixture,testname)::TestBody()
+
+/**
+ * Declare the types of a typed test suite with
+ * TYPED_TEST_SUITE(fixture, embtest::Types<...>), where fixture is
+ * a class template deriving from embtest::Test.
+ *
+ * PUBLIC
+ */
+#define TYPED_TEST_SUITE(fixture, ...)                               \
+typedef __VA_ARGS__ fixture##_EmbtestTypes
+
+/**
+ * Declare a typed test with TYPED_TEST(fixture, testname). The
+ * body is compiled once for each type of the fixture's type list,
+ * as a separate class with its own registration, and runs in the
+ * suite "fixture/N" for type N of the list. In the body, TypeParam
+ * is the type and TestFixture the fixture class; members of the
+ * fixture are reached through this->.
+ *
+ * PUBLIC
+ */
+#define TYPED_TEST(fixture, testname)                                \
+/* Define test class template */                                     \
+template <typename TypeParam>                                        \
+class TEST_CLASS_NAME(fixture,testname): public fixture<TypeParam>   \
+{                                                                    \
+  public:                                                            \
+    typedef fixture<TypeParam> TestFixture;                          \
+    void TestBody();                                                 \
+    static embtest::TestRegistration s_registration;                 \
+    static embtest::RegToken s_registrationToken;                    \
+};                                                                   \
+/* describe each instantiation with constant initialization */       \
+template <typename TypeParam>                                        \
+embtest::TestRegistration TEST_CLASS_NAME(fixture,testname)<TypeParam>::s_registration = { \
+    #fixture, #testname,                                             \
+    &embtest::TestFactory< TEST_CLASS_NAME(fixture,testname)<TypeParam> >::create, \
+    embtest::KindTest, 0,                                            \
+    &TEST_CLASS_NAME(fixture,testname)<TypeParam>::SetUpTestSuite,   \
+    &TEST_CLASS_NAME(fixture,testname)<TypeParam>::TearDownTestSuite, 0 }; \
+template <typename TypeParam>                                        \
+embtest::RegToken TEST_CLASS_NAME(fixture,testname)<TypeParam>::s_registrationToken = 0; \
+/* register one test per type of the suite's type list */            \
+static bool fixture##_##testname##_TypedRegistered =                 \
+    embtest::TypedTestRegistrar<0, TEST_CLASS_NAME(fixture,testname), \
+                                fixture##_EmbtestTypes>::registerAll(); \
+/* implement test body as following block */                         \
+template <typename TypeParam>                                        \
+void TEST_CLASS_NAME(fixture,testname)<TypeParam>::TestBody()
+
+/**
+ * Declare a value-parameterized test with TEST_P(fixture, testname),
+ * where fixture derives from embtest::TestWithParam<T>. The test
+ * body reads its parameter with GetParam().
+ *
+ * The test runs once for each value of each instantiation of the
+ * fixture. A case is named "prefix/fixture.testname/index", and is
+ * filtered, scheduled and reported like any other test.
+ *
+ * PUBLIC
+ */
+#define TEST_P(fixture, testname)                                    \
+/* Define parameterized test class */                                \
+class TEST_CLASS_NAME(fixture,testname): public fixture              \
+{                                                                    \
+  public:                                                            \
+    void TestBody();                                                 \
+  private:                                                           \
+    static embtest::ParamTestRegistration s_registration;            \
+    static embtest::RegToken s_registrationToken;                    \
+};                                                                   \
+/* describe the test with constant initialization */                 \
+embtest::ParamTestRegistration TEST_CLASS_NAME(fixture,testname)::s_registration = { \
+    #fixture, #testname,                                             \
+    &embtest::TestFactory< TEST_CLASS_NAME(fixture,testname) >::create, \
+    &TEST_CLASS_NAME(fixture,testname)::SetUpTestSuite,              \
+    &TEST_CLASS_NAME(fixture,testname)::TearDownTestSuite, 0 };      \
+/* invoke static-initialization registration */                      \
+embtest::RegToken TEST_CLASS_NAME(fixture,testname)::s_registrationToken = \
+embtest::registerParamTest(&TEST_CLASS_NAME(fixture,testname)::s_registration); \
 /* implement test body as following block */                         \
 void TEST_CLASS_NAME(fixture,testname)::TestBody()
 
+/**
+ * Instantiate the TEST_P() tests of \c fixture with the values of
+ * a parameter generator, e.g.
+ *
+ *     INSTANTIATE_TEST_SUITE_P(Small, SizeTest, embtest::Range(1, 100));
+ *     INSTANTIATE_TEST_SUITE_P(Grid, GridTest,
+ *         embtest::Combine(embtest::Values(1, 2, 4), embtest::Bool()));
+ *
+ * Generators compute each value when its case runs, so the values
+ * of a large sweep are never held at once.
+ *
+ * PUBLIC
+ */
+#define INSTANTIATE_TEST_SUITE_P(prefix, fixture, ...)               \
+static embtest::ParamInstantiationOf<fixture::ParamType, decltype(__VA_ARGS__)> \
+    prefix##_##fixture##_Instantiation(#prefix, #fixture, __VA_ARGS__)
+
+/**
+ * Declare a new benchmark with BENCHMARK(suitename, benchname).
+ *
+ * The block of code following the macro is one iteration of the
+ * measured work. The runner repeats it enough times to measure
+ * reliably, and reports the time per iteration as the median,
+ * median absolute deviation, minimum and maximum over several
+ * repetitions. Use embtest::DoNotOptimize() on results the body
+ * would otherwise discard.
+ *
+ * Benchmarks are not run with the tests; see RunOptions::benchmarks.
+ * Assertions may be used in the body, and a failure stops the
+ * benchmark at the end of the current repetition.
+ *
+ * PUBLIC
+ */
+#define BENCHMARK(suitename, benchname)                              \
+/* Define benchmark class */                                         \
+class TEST_CLASS_NAME(suitename,benchname): public embtest::Benchmark \
+{                                                                    \
+  public:                                                            \
+    void BenchmarkBody();                                            \
+    void RunIterations(uint64_t iterations)                          \
+    {                                                                \
+        for (uint64_t i=0; i < iterations; ++i)                      \
+            BenchmarkBody();                                         \
+    }                                                                \
+  private:                                                           \
+    static embtest::TestRegistration s_registration;                 \
+    static embtest::RegToken s_registrationToken;                    \
+};                                                                   \
+/* describe the benchmark with constant initialization */            \
+embtest::TestRegistration TEST_CLASS_NAME(suitename,benchname)::s_registration = { \
+    #suitename, #benchname,                                          \
+    &embtest::TestFactory< TEST_CLASS_NAME(suitename,benchname) >::create, \
+    embtest::KindBenchmark, 0,                                       \
+    &TEST_CLASS_NAME(suitename,benchname)::SetUpTestSuite,           \
+    &TEST_CLASS_NAME(suitename,benchname)::TearDownTestSuite, 0 };   \
+/* invoke static-initialization registration */                      \
+embtest::RegToken TEST_CLASS_NAME(suitename,benchname)::s_registrationToken = \
+embtest::registerTest(&TEST_CLASS_NAME(suitename,benchname)::s_registration); \
+/* implement one benchmark iteration as following block */           \
+void TEST_CLASS_NAME(suitename,benchname)::BenchmarkBody()
+
 /*
  * Assertion types. These evaluate the one or two arguments given the
  * condition, and report errors if the condition is not satisfied.
@@ -498,15 +1962,157 @@ void TEST_CLASS_NAME(fixture,testname)::TestBody()
 #define ASSERT_TRUE(expr) \
     if (!embtest::assert_true(true, #expr, expr, __LINE__, __FILE__, s_registrationToken)) return
 #define EXPECT_TRUE(expr) \
-    (void)embtest::assert_true(true, #expr, expr, __LINE__, __FILE__, s_registrationToken)
+    (void)embtest::assert_true(false, #expr, expr, __LINE__, __FILE__, s_registrationToken)
 
 #define ASSERT_FALSE(expr) \
     if (!embtest::assert_false(true, #expr, expr, __LINE__, __FILE__, s_registrationToken)) return
 #define EXPECT_FALSE(expr) \
-    (void)embtest::assert_false(true, #expr, expr, __LINE__, __FILE__, s_registrationToken)
+    (void)embtest::assert_false(false, #expr, expr, __LINE__, __FILE__, s_registrationToken)
 
 #define ASSERT_FPEQ(left,right,eps) \
     if (!embtest::assert_fpeq(true, #left, #right, left, right, eps, __LINE__, __FILE__, s_registrationToken)) return
+#define EXPECT_FPEQ(left,right,eps) \
+    (void)embtest::assert_fpeq(false, #left, #right, left, right, eps, __LINE__, __FILE__, s_registrationToken)
+
+/*
+ * Floating point array comparisons, of \c length floats or doubles
+ * at two pointers. EXPECT_ARRAY_NEAR() expects each pair of values
+ * to be equal, or to differ by at most \c abs + \c rel times the
+ * larger magnitude of the two. EXPECT_ARRAY_ULPS() expects each pair
+ * to be at most \c maxUlps representable values apart. NaNs are
+ * never near anything. The values are checked with SIMD
+ * instructions, and a failure reports how many values are out of
+ * tolerance, the largest absolute, relative and ULP errors, and a
+ * histogram of the errors.
+ *
+ * PUBLIC
+ */
+#define ASSERT_ARRAY_NEAR(left,right,length,abs,rel) \
+    if (!embtest::checkArrayNear(true, #left, #right, #length, left, right, length, abs, rel, __LINE__, __FILE__, s_registrationToken)) return
+#define EXPECT_ARRAY_NEAR(left,right,length,abs,rel) \
+    (void)embtest::checkArrayNear(false, #left, #right, #length, left, right, length, abs, rel, __LINE__, __FILE__, s_registrationToken)
+
+#define ASSERT_ARRAY_ULPS(left,right,length,maxUlps) \
+    if (!embtest::checkArrayUlps(true, #left, #right, #length, left, right, length, maxUlps, __LINE__, __FILE__, s_registrationToken)) return
+#define EXPECT_ARRAY_ULPS(left,right,length,maxUlps) \
+    (void)embtest::checkArrayUlps(false, #left, #right, #length, left, right, length, maxUlps, __LINE__, __FILE__, s_registrationToken)
+
+/*
+ * Buffer and range comparisons. EXPECT_BYTES_EQ() compares \c length
+ * bytes at two pointers, and EXPECT_RANGE_EQ() the elements of two
+ * arrays or containers, which must have the same size. The search
+ * for differences is vectorized, and a failure reports how many
+ * bytes or elements differ, the first one, and the bytes around it
+ * in hex, instead of one line per difference.
+ *
+ * PUBLIC
+ */
+#define ASSERT_BYTES_EQ(left,right,length) \
+    if (!embtest::checkBytesEqual(true, #left, #right, #length, left, right, length, __LINE__, __FILE__, s_registrationToken)) return
+#define EXPECT_BYTES_EQ(left,right,length) \
+    (void)embtest::checkBytesEqual(false, #left, #right, #length, left, right, length, __LINE__, __FILE__, s_registrationToken)
+
+#define ASSERT_RANGE_EQ(left,right) \
+    if (!embtest::assert_range_eq(true, #left, #right, left, right, __LINE__, __FILE__, s_registrationToken)) return
+#define EXPECT_RANGE_EQ(left,right) \
+    (void)embtest::assert_range_eq(false, #left, #right, left, right, __LINE__, __FILE__, s_registrationToken)
+
+/*
+ * Performance assertions. EXPECT_FASTER_THAN() times the callables
+ * \c baseline and \c candidate, and expects the candidate to take
+ * at most \c ratio times as long as the baseline; e.g. a ratio of
+ * 0.5 expects it to be twice as fast. EXPECT_DURATION_LT() times
+ * \c statement, and expects it to take less than \c budget, a
+ * std::chrono duration.
+ *
+ * Each side is timed in batches of calls lasting a fraction of a
+ * millisecond, in RunOptions::perfSamples interleaved samples, so
+ * drifting machine load affects both alike. The check fails only
+ * when the samples show, at 99.9% confidence, that the expectation
+ * is broken: a one-sided Mann-Whitney U test of the candidate
+ * against the scaled baseline, or a distribution-free confidence
+ * bound on the median time of the statement. A failure reports
+ * both distributions. Use embtest::DoNotOptimize() to keep the
+ * measured work from being optimized away.
+ *
+ * PUBLIC
+ */
+#define ASSERT_FASTER_THAN(baseline,candidate,ratio) \
+    if (!embtest::assert_faster_than(true, #baseline, #candidate, #ratio, baseline, candidate, ratio, __LINE__, __FILE__, s_registrationToken)) return
+#define EXPECT_FASTER_THAN(baseline,candidate,ratio) \
+    (void)embtest::assert_faster_than(false, #baseline, #candidate, #ratio, baseline, candidate, ratio, __LINE__, __FILE__, s_registrationToken)
+
+#define ASSERT_DURATION_LT(statement,budget) \
+    if (!embtest::assert_duration_lt(true, #statement, #budget, [&]() { statement; }, budget, __LINE__, __FILE__, s_registrationToken)) return
+#define EXPECT_DURATION_LT(statement,budget) \
+    (void)embtest::assert_duration_lt(false, #statement, #budget, [&]() { statement; }, budget, __LINE__, __FILE__, s_registrationToken)
+
+/*
+ * Death tests. These run \c statement in a forked child process,
+ * and check that the child dies: EXPECT_EXIT() checks its wait
+ * status with \c predicate, e.g. embtest::ExitedWithCode(2) or
+ * embtest::KilledBySignal(SIGABRT), and EXPECT_DEATH() that it was
+ * killed or exited with a nonzero code. The child's stderr must
+ * match the ECMAScript regular expression \c regex; "" matches
+ * anything. A statement that returns or throws fails the check.
+ *
+ * The child is a fork of the test process at the statement, so it
+ * sees the test's state, and copies its memory only as it writes.
+ * A statement that leaves the test with a return, e.g. a failed
+ * ASSERT_*() in it, ends the child and fails the check.
+ *
+ * The child only has the thread that forked it. With --jobs greater
+ * than 1, other threads may hold locks, e.g. of the heap or of
+ * embtest's output, that the child then waits for forever. Run
+ * death tests sequentially, or with --workers, whose processes run
+ * one test at a time. Only POSIX platforms support death tests;
+ * elsewhere they fail.
+ *
+ * PUBLIC
+ */
+#define EMBTEST_DEATH_TEST(statement, predicate, regex, asserted, onFailure) \
+    do {                                                             \
+        embtest::DeathTest embtest_death(#statement, regex, __LINE__, __FILE__); \
+        if (embtest_death.isChild())                                 \
+        {                                                            \
+            embtest::DeathTestSentinel embtest_sentinel(embtest_death); \
+            try { statement; }                                       \
+            catch (...) { embtest_death.childFinished(embtest::DeathTest::Threw); } \
+            embtest_death.childFinished(embtest::DeathTest::Returned); \
+        }                                                            \
+        bool embtest_matched = embtest::statusMatches(predicate, embtest_death.wait()); \
+        if (!embtest_death.check(asserted, embtest_matched, #predicate, s_registrationToken)) \
+            onFailure;                                               \
+    } while (0)
+
+#define ASSERT_EXIT(statement,predicate,regex) \
+    EMBTEST_DEATH_TEST(statement, predicate, regex, true, return)
+#define EXPECT_EXIT(statement,predicate,regex) \
+    EMBTEST_DEATH_TEST(statement, predicate, regex, false, (void)0)
+
+#define ASSERT_DEATH(statement,regex) \
+    EMBTEST_DEATH_TEST(statement, embtest::DiedAbnormally(), regex, true, return)
+#define EXPECT_DEATH(statement,regex) \
+    EMBTEST_DEATH_TEST(statement, embtest::DiedAbnormally(), regex, false, (void)0)
+
+/**
+ * Allocation budgets: the block that follows may make at most \c n
+ * heap allocations on the test's thread, or none at all:
+ *
+ *     EXPECT_NO_ALLOCATIONS {
+ *         queue.push(item);
+ *     }
+ *
+ * Allocations are only counted with allocation tracking; see
+ * embtest::noteAllocation().
+ *
+ * PUBLIC
+ */
+#define EXPECT_MAX_ALLOCATIONS(n)                                    \
+    for (embtest::AllocationBudget embtest_budget((n), __LINE__, __FILE__, s_registrationToken); \
+         embtest_budget.once(); )
+
+#define EXPECT_NO_ALLOCATIONS EXPECT_MAX_ALLOCATIONS(0)
 
 /**
  * Force a test failure. If a condition cannot be cleanly
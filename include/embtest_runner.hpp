@@ -0,0 +1,549 @@
+/*
+ * Runner API of the embtest unit-test library: options, reporters,
+ * environments and results. Only the file with main(), and files
+ * that add reporters or environments, need this header; test files
+ * include embtest.hpp.
+ *
+ * Copyright (c) 2018,2024 Brent Burton
+ *
+ * SDPX-License-Identifier: ISC
+ */
+#pragma once
+
+#include <iosfwd>
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+#include "embtest.hpp"
+
+namespace embtest {
+
+/**
+ * The phases of a test instance's lifetime, each timed separately.
+ *
+ * PUBLIC
+ */
+enum TestPhase
+{
+    PhaseConstruct, PhaseSetUp, PhaseBody, PhaseTearDown, PhaseDestruct,
+    PhaseCount
+};
+
+/**
+ * Wall-clock and CPU time spent in one phase, in nanoseconds.
+ * CPU time is that of the thread running the test.
+ *
+ * PUBLIC
+ */
+struct PhaseTime
+{
+    PhaseTime() : wallNs(0), cpuNs(0) { }
+
+    double wallNs;
+    double cpuNs;
+};
+
+/**
+ * TestTiming holds the time spent in each phase of a test.
+ *
+ * PUBLIC
+ */
+struct TestTiming
+{
+    PhaseTime phases[PhaseCount];
+
+    double wallNs() const
+    {
+        double total = 0;
+        for (int p=0; p < PhaseCount; ++p)
+            total += phases[p].wallNs;
+        return total;
+    }
+
+    double cpuNs() const
+    {
+        double total = 0;
+        for (int p=0; p < PhaseCount; ++p)
+            total += phases[p].cpuNs;
+        return total;
+    }
+};
+
+/**
+ * Event counters of a test body, read with perf_event_open() on
+ * Linux when RunOptions::perfCounters is set. The hardware
+ * counters are often unavailable, e.g. in VMs and containers; the
+ * software counters usually remain. Task clock is in nanoseconds.
+ *
+ * PUBLIC
+ */
+enum PerfCounter
+{
+    CounterCycles, CounterInstructions, CounterBranchMisses, CounterCacheMisses,
+    CounterTaskClock, CounterPageFaults, CounterContextSwitches,
+    CounterCount
+};
+
+/**
+ * The name of a counter, e.g. "branch_misses".
+ *
+ * PUBLIC
+ */
+char const* perfCounterName(PerfCounter counter);
+
+/**
+ * PerfCounters holds the counter values of one test. Only the
+ * counters in \c measured, a bit mask of (1 << PerfCounter), were
+ * read.
+ *
+ * PUBLIC
+ */
+struct PerfCounters
+{
+    PerfCounters() : measured(0)
+    {
+        for (int c=0; c < CounterCount; ++c)
+            values[c] = 0;
+    }
+
+    bool has(PerfCounter counter) const { return (measured >> counter) & 1u; }
+
+    unsigned measured;
+    uint64_t values[CounterCount];
+};
+
+/**
+ * BenchmarkStats holds the measured time per iteration of a
+ * benchmark, over all of its timed repetitions. A test that
+ * was not run as a benchmark has zero repetitions.
+ *
+ * PUBLIC
+ */
+struct BenchmarkStats
+{
+    BenchmarkStats()
+        : iterations(0), repetitions(0)
+        , median(0), mad(0), min(0), max(0)
+    { }
+
+    uint64_t iterations;    ///< iterations per repetition
+    unsigned repetitions;
+    double   median;        ///< nanoseconds per iteration
+    double   mad;           ///< median absolute deviation
+    double   min;
+    double   max;
+};
+
+/**
+ * AllocationStats counts the heap allocations a test made on its
+ * thread, from the construction of its instance to its
+ * destruction, and the peak of the bytes they kept alive. The
+ * counts are only \c tracked if an allocator reports to embtest;
+ * see noteAllocation().
+ *
+ * PUBLIC
+ */
+struct AllocationStats
+{
+    AllocationStats()
+        : tracked(false), allocations(0), bytes(0), peakBytes(0)
+    { }
+
+    bool     tracked;
+    uint64_t allocations;
+    uint64_t bytes;
+    uint64_t peakBytes;     ///< most bytes live at once
+};
+
+/**
+ * TestInfo identifies a test in reporter events. The names
+ * live as long as the test registrations. A TestInfo streams
+ * as "suite.test".
+ *
+ * PUBLIC
+ */
+struct TestInfo
+{
+    char const *suiteName;
+    char const *testName;
+};
+
+std::ostream& operator<<(std::ostream &out, TestInfo const &test);
+
+/**
+ * How a test failed: a failed assertion or FAIL(), an exception
+ * escaping the test body, the death of the worker process running
+ * the test, the test overrunning its timeout, memory the test
+ * allocated still being live after its instance was destroyed, or
+ * the run timing out before the test could start.
+ *
+ * PUBLIC
+ */
+enum FailureKind
+{
+    FailureAssertion, FailureException, FailureCrash, FailureTimeout, FailureLeak,
+    FailureNotRun
+};
+
+/**
+ * One failure of a test. \c file is null, and \c line 0, unless
+ * the failure comes from an assertion. The message holds the
+ * complete report, one or more lines each ending in a newline.
+ *
+ * PUBLIC
+ */
+struct TestFailure
+{
+    FailureKind  kind;
+    char const  *file;
+    int          line;
+    std::string  message;
+};
+
+/**
+ * The outcome of one test.
+ *
+ * PUBLIC
+ */
+enum TestStatus { StatusPassed, StatusFailed, StatusDisabled };
+
+struct TestResult
+{
+    TestResult() : status(StatusPassed) { test.suiteName = test.testName = 0; }
+
+    TestInfo        test;
+    TestStatus      status;
+    TestTiming      timing;
+    BenchmarkStats  benchmark;
+    AllocationStats allocations;
+    PerfCounters    counters;
+};
+
+/**
+ * RunInfo describes a run as it starts: the number of selected
+ * tests, and how they are run.
+ *
+ * PUBLIC
+ */
+struct RunInfo
+{
+    size_t   testCount;
+    unsigned jobs;          ///< threads running tests
+    unsigned workers;       ///< worker processes, or 0
+    unsigned shardIndex;
+    unsigned shardCount;
+};
+
+/**
+ * RunSummary holds the final counts of a run.
+ *
+ * PUBLIC
+ */
+struct RunSummary
+{
+    size_t total;
+    size_t disabled;
+    size_t failed;
+    size_t passed;
+};
+
+/**
+ * A Reporter receives the events of a test run. The console
+ * report is one Reporter; more can be given in RunOptions to,
+ * e.g., write a machine-readable report. The default methods
+ * ignore their events.
+ *
+ * For each selected test a reporter sees testStarting(), any
+ * testOutput() and testFailure() events, then testFinished().
+ * Disabled tests only get testFinished(). Events of one test
+ * are never interleaved with another's, and tests are reported
+ * in registration order even when they run in parallel, so a
+ * reporter needs no locking of its own.
+ *
+ * PUBLIC
+ */
+class Reporter
+{
+  public:
+    virtual ~Reporter() {}
+
+    virtual void runStarting(RunInfo const &) {}
+    virtual void testStarting(TestInfo const &) {}
+    virtual void testOutput(TestInfo const &, std::string const &) {}
+    virtual void testFailure(TestInfo const &, TestFailure const &) {}
+    virtual void testFinished(TestResult const &) {}
+    virtual void runFinished(RunSummary const &) {}
+};
+
+/**
+ * An Environment holds global state for the whole run. Its SetUp()
+ * runs once before the first test, and its TearDown() once after
+ * the last. Environments are set up in the order they were added,
+ * and torn down in reverse order.
+ *
+ * With worker processes, environments are set up in the parent
+ * before the workers are forked, so the workers share the state
+ * copy-on-write instead of building it again. State changed by a
+ * test in a worker is not seen by the parent or other workers.
+ *
+ * If a SetUp() throws, no test runs, and each selected test is
+ * reported as failed.
+ *
+ * PUBLIC
+ */
+class Environment
+{
+  public:
+    Environment() : m_next(0) {}
+    virtual ~Environment() {}
+
+    virtual void SetUp() {}
+    virtual void TearDown() {}
+
+  private:
+    friend class EnvironmentList;
+
+    Environment *m_next;         ///< set by addEnvironment()
+};
+
+/**
+ * Add a global environment to every later run. The environment is
+ * not owned, and must outlive the runs. This may be called during
+ * static initialization, and never allocates:
+ *
+ *     static MyEnvironment s_env;
+ *     static embtest::Environment *s_added = embtest::addEnvironment(&s_env);
+ *
+ * @returns \c environment
+ *
+ * PUBLIC
+ */
+Environment* addEnvironment(Environment *environment);
+
+/**
+ * RunOptions controls how runAndReport() executes the
+ * registered tests. A default-constructed RunOptions runs
+ * every test sequentially on the calling thread.
+ *
+ * PUBLIC
+ */
+struct RunOptions
+{
+    /**
+     * Number of worker threads used to run tests. A value of 1
+     * runs tests sequentially on the calling thread, and 0 uses
+     * one thread per hardware core. Each test's output is
+     * buffered and reported in registration order.
+     */
+    unsigned jobs;
+
+    /**
+     * Number of worker processes used to run tests. When nonzero,
+     * tests run in forked child processes so that a crashing test
+     * fails on its own instead of ending the run. The crashed
+     * worker is replaced. Only available on POSIX platforms;
+     * elsewhere this is ignored. Takes precedence over jobs.
+     */
+    unsigned workers;
+
+    /**
+     * Sharding splits the tests across several runs of the same
+     * binary, e.g. on several CI machines. Tests are dealt to
+     * shardCount shards round-robin, or by their durations in the
+     * historyPath file if there is one, and this run executes shard
+     * shardIndex (0-based). A shardCount of 0 or 1 runs all tests.
+     */
+    unsigned shardCount;
+    unsigned shardIndex;
+
+    /**
+     * Run only the tests whose "suite.test" name matches this
+     * filter: patterns separated by ':', where '*' matches any
+     * characters and '?' one character. Patterns after one that
+     * starts with '-' exclude tests, e.g. "Suite.*:-Suite.slow*".
+     * An empty filter, or one with only exclusions, starts from
+     * all tests. Sharding applies to the tests that match.
+     */
+    std::string filter;
+
+    /**
+     * List the selected tests instead of running them.
+     */
+    bool listTests;
+
+    /**
+     * If not empty, the final state of each test in this run is
+     * written to this file. Result files from several shards can
+     * be combined with the embtest_merge tool.
+     */
+    std::string resultsPath;
+
+    /**
+     * Run the BENCHMARK() entries instead of the tests. Benchmarks
+     * always run sequentially on the calling thread. Each one is
+     * calibrated to run for at least benchmarkMinMs milliseconds,
+     * and then timed benchmarkRepetitions times.
+     */
+    bool     benchmarks;
+    unsigned benchmarkMinMs;
+    unsigned benchmarkRepetitions;
+
+    /**
+     * Number of tests listed in the final "slowest tests" table,
+     * with their time in each phase. 0 omits the table.
+     */
+    unsigned slowestCount;
+
+    /**
+     * If not empty, a file of per-test durations. It is read
+     * before the run, so that shards are balanced by duration and
+     * parallel runs start the longest tests first, and rewritten
+     * with this run's durations afterwards.
+     */
+    std::string historyPath;
+
+    /**
+     * If not empty, a JUnit XML report, or a JSON Lines report,
+     * is written to this file as the tests finish.
+     */
+    std::string junitPath;
+    std::string jsonPath;
+
+    /**
+     * Reporters that receive the run's events after the console
+     * report. They are not owned, and must outlive the run.
+     */
+    std::vector<Reporter*> reporters;
+
+    /**
+     * Deliver reporter events on a separate thread, so slow
+     * output doesn't hold up the tests. Ignored without threads.
+     */
+    bool asyncReporting;
+
+    /**
+     * Time limits in milliseconds for each test, and for the whole
+     * run; 0 means no limit. A test that overruns is reported with
+     * the backtrace of every thread where the platform provides
+     * them (Linux with glibc). With worker processes, the stuck
+     * worker is killed, its test fails, and the run goes on.
+     * Otherwise a stuck test can't be abandoned, so the run is
+     * aborted after reporting the hang on stderr; the in-process
+     * watchdog needs threads.
+     */
+    unsigned testTimeoutMs;
+    unsigned runTimeoutMs;
+
+    /**
+     * Fail a test whose allocations are not all freed once its
+     * instance is destroyed, i.e. after TearDown() and the
+     * destructor. Needs allocation tracking; see noteAllocation().
+     */
+    bool detectLeaks;
+
+    /**
+     * Number of timed samples of each side of a performance
+     * assertion, e.g. EXPECT_FASTER_THAN(). More samples detect
+     * smaller differences, and take longer.
+     */
+    unsigned perfSamples;
+
+    /**
+     * Count CPU events around each test body with perf_event_open():
+     * cycles, instructions, branch and cache misses, and the task
+     * clock, page faults and context switches. Counters the kernel
+     * refuses are left out. Only available on Linux.
+     */
+    bool perfCounters;
+
+    /**
+     * If not empty, each test's result is appended to this journal
+     * file as it is reported, and flushed, so the journal survives
+     * a killed run. A new run starts a new journal.
+     *
+     * With resume, a run continues the journal of the same build of
+     * the test binary, skipping the tests it records as finished,
+     * and fails if any recorded test failed. With rerunFailed, only
+     * the tests the journal records as failed are run. Either one
+     * needs a journal, and they can't be combined.
+     */
+    std::string journalPath;
+    bool        resume;
+    bool        rerunFailed;
+
+    RunOptions()
+        : jobs(1)
+        , workers(0)
+        , shardCount(1)
+        , shardIndex(0)
+        , listTests(false)
+        , benchmarks(false)
+        , benchmarkMinMs(50)
+        , benchmarkRepetitions(5)
+        , slowestCount(10)
+        , asyncReporting(false)
+        , testTimeoutMs(0)
+        , runTimeoutMs(0)
+        , detectLeaks(false)
+        , perfSamples(31)
+        , perfCounters(false)
+        , resume(false)
+        , rerunFailed(false)
+    { }
+};
+
+/**
+ * Fill in RunOptions from command line arguments. Recognized
+ * arguments are removed from argv and argc is adjusted, so the
+ * application may parse the remainder.
+ *
+ * Recognized arguments:
+ *   --jobs=N, -jN, -j N  run tests on N threads (0 = all cores)
+ *   --workers=N     run tests in N forked worker processes
+ *   --shard-count=N run only one of N shards of the tests
+ *   --shard-index=I the shard to run, 0 <= I < N
+ *   --filter=PATTERNS   run only the tests matching PATTERNS
+ *   --list          list the selected tests without running them
+ *   --results=FILE  write each test's final state to FILE
+ *   --benchmarks    run the benchmarks instead of the tests
+ *   --benchmark-min-ms=N        calibrate each repetition to N ms
+ *   --benchmark-repetitions=N   time each benchmark N times
+ *   --slowest=N     list the N slowest tests at the end (0 = none)
+ *   --history=FILE  schedule longest tests first, using durations in FILE
+ *   --junit=FILE    write a JUnit XML report to FILE
+ *   --json=FILE     write a JSON Lines report to FILE
+ *   --async-reporting   write reports on a separate thread
+ *   --timeout-ms=N      fail a test that runs longer than N ms
+ *   --run-timeout-ms=N  stop a run that takes longer than N ms
+ *   --detect-leaks  fail tests that leave memory allocated
+ *   --perf-samples=N    time performance assertions N times a side
+ *   --perf-counters count CPU events of each test (Linux only)
+ *   --journal=FILE  record each test's result in FILE as it finishes
+ *   --resume        skip the tests the journal records as finished
+ *   --rerun-failed  run only the tests the journal records as failed
+ *
+ * The environment variables EMBTEST_SHARD_COUNT and
+ * EMBTEST_SHARD_INDEX are read first, and arguments override them.
+ *
+ * @returns false if a recognized argument has an invalid value,
+ *          or the arguments conflict.
+ *
+ * PUBLIC
+ */
+bool parseArguments(int &argc, char **argv, RunOptions &options);
+
+/**
+ * Run all tests as controlled by \c options, and print the
+ * final summary to \c out.
+ *
+ * @param[in] out The output stream to write progress and summary information.
+ * @param[in] options Execution options, e.g. the number of jobs.
+ * @returns Integer suitable for an exit code (0=success, 1=error)
+ *
+ * PUBLIC
+ */
+int runAndReport(std::ostream &out, RunOptions const &options);
+
+} // embtest::
@@ -0,0 +1,117 @@
+/*
+ * Allocation tracking for the embtest library: replacements of the
+ * global operator new and delete that report each block to embtest.
+ * Link these objects into a test program to count its allocations
+ * per test; see embtest::noteAllocation().
+ *
+ * Copyright (c) 2018,2024 Brent Burton
+ *
+ * SDPX-License-Identifier: ISC
+ */
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+#include "embtest.hpp"
+
+namespace {
+
+/*
+ * Each block is preceded by a header with its size and allocation
+ * tag, padded to keep the block maximally aligned.
+ */
+union BlockHeader
+{
+    struct
+    {
+        std::size_t            size;
+        embtest::AllocationTag tag;
+    } block;
+    std::max_align_t align;
+};
+
+void* allocate(std::size_t size)
+{
+    BlockHeader *header = static_cast<BlockHeader*>(std::malloc(sizeof(BlockHeader) + size));
+    if (!header)
+        return 0;
+    header->block.size = size;
+    header->block.tag = embtest::noteAllocation(size);
+    return header + 1;
+}
+
+void release(void *p)
+{
+    if (!p)
+        return;
+    BlockHeader *header = static_cast<BlockHeader*>(p) - 1;
+    embtest::noteDeallocation(header->block.size, header->block.tag);
+    std::free(header);
+}
+
+} // namespace
+
+void* operator new(std::size_t size)
+{
+    for (;;)
+    {
+        if (void *p = allocate(size))
+            return p;
+        std::new_handler handler = std::get_new_handler();
+        if (!handler)
+            throw std::bad_alloc();
+        handler();
+    }
+}
+
+void* operator new[](std::size_t size)
+{
+    return ::operator new(size);
+}
+
+void* operator new(std::size_t size, std::nothrow_t const &) noexcept
+{
+    try {
+        return ::operator new(size);
+    }
+    catch (...) {
+        return 0;
+    }
+}
+
+void* operator new[](std::size_t size, std::nothrow_t const &) noexcept
+{
+    return ::operator new(size, std::nothrow);
+}
+
+void operator delete(void *p) noexcept
+{
+    release(p);
+}
+
+void operator delete[](void *p) noexcept
+{
+    release(p);
+}
+
+void operator delete(void *p, std::nothrow_t const &) noexcept
+{
+    release(p);
+}
+
+void operator delete[](void *p, std::nothrow_t const &) noexcept
+{
+    release(p);
+}
+
+#if defined(__cpp_sized_deallocation)
+void operator delete(void *p, std::size_t) noexcept
+{
+    release(p);
+}
+
+void operator delete[](void *p, std::size_t) noexcept
+{
+    release(p);
+}
+#endif
@@ -0,0 +1,1117 @@
+/*
+ * Buffer, range and floating point array comparisons for the
+ * embtest library: finding the differences between two buffers,
+ * and checking arrays of floating point values against a
+ * tolerance, with SIMD instructions, and reporting the failures.
+ *
+ * Copyright (c) 2018,2024 Brent Burton
+ *
+ * SDPX-License-Identifier: ISC
+ */
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iomanip>
+#include <limits>
+#include <ostream>
+
+/*
+ * SSE2 is part of every x86-64 processor, and AVX2 is used when
+ * the running processor has it. On 64-bit ARM, NEON is always
+ * there. Elsewhere, or with EMBTEST_NO_SIMD, buffers are compared
+ * a word at a time, and floating point arrays a value at a time.
+ */
+#if defined(__GNUC__) && defined(__SSE2__) && !defined(EMBTEST_NO_SIMD)
+#define EMBTEST_HAS_SSE2 1
+#include <immintrin.h>
+#else
+#define EMBTEST_HAS_SSE2 0
+#endif
+
+#if EMBTEST_HAS_SSE2 && defined(__x86_64__)
+#define EMBTEST_HAS_AVX2 1
+#else
+#define EMBTEST_HAS_AVX2 0
+#endif
+
+#if defined(__GNUC__) && defined(__ARM_NEON) && defined(__aarch64__) && !defined(EMBTEST_NO_SIMD)
+#define EMBTEST_HAS_NEON 1
+#include <arm_neon.h>
+#else
+#define EMBTEST_HAS_NEON 0
+#endif
+
+#include "embtest.hpp"
+
+namespace embtest {
+
+/*
+ * The scalar fallback compares 8 bytes at a time, and then the
+ * bytes of the first word that differs.
+ */
+static size_t firstDifferenceScalar(unsigned char const *left, unsigned char const *right,
+                                    size_t length)
+{
+    size_t i = 0;
+    for (; i + 8 <= length; i += 8)
+    {
+        uint64_t l, r;
+        std::memcpy(&l, left + i, 8);
+        std::memcpy(&r, right + i, 8);
+        if (l != r)
+            break;
+    }
+    for (; i < length; ++i)
+    {
+        if (left[i] != right[i])
+            return i;
+    }
+    return length;
+}
+
+static size_t countDifferencesScalar(unsigned char const *left, unsigned char const *right,
+                                     size_t length)
+{
+    size_t count = 0;
+    for (size_t i=0; i < length; ++i)
+        count += (left[i] != right[i]);
+    return count;
+}
+
+#if EMBTEST_HAS_SSE2
+/*
+ * A 16-byte block is compared into a mask with a bit set for each
+ * equal byte; the blocks are checked 64 bytes at a time.
+ */
+static inline unsigned sameMask16(unsigned char const *left, unsigned char const *right)
+{
+    __m128i l = _mm_loadu_si128(reinterpret_cast<__m128i const*>(left));
+    __m128i r = _mm_loadu_si128(reinterpret_cast<__m128i const*>(right));
+    return static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(l, r)));
+}
+
+static size_t firstDifferenceSse2(unsigned char const *left, unsigned char const *right,
+                                  size_t length)
+{
+    size_t i = 0;
+    for (; i + 64 <= length; i += 64)
+    {
+        __m128i same = _mm_and_si128(
+            _mm_and_si128(
+                _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<__m128i const*>(left + i)),
+                               _mm_loadu_si128(reinterpret_cast<__m128i const*>(right + i))),
+                _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<__m128i const*>(left + i + 16)),
+                               _mm_loadu_si128(reinterpret_cast<__m128i const*>(right + i + 16)))),
+            _mm_and_si128(
+                _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<__m128i const*>(left + i + 32)),
+                               _mm_loadu_si128(reinterpret_cast<__m128i const*>(right + i + 32))),
+                _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<__m128i const*>(left + i + 48)),
+                               _mm_loadu_si128(reinterpret_cast<__m128i const*>(right + i + 48)))));
+        if (_mm_movemask_epi8(same) != 0xffff)
+            break;
+    }
+    for (; i + 16 <= length; i += 16)
+    {
+        unsigned differ = sameMask16(left + i, right + i) ^ 0xffffu;
+        if (differ)
+            return i + __builtin_ctz(differ);
+    }
+    return i + firstDifferenceScalar(left + i, right + i, length - i);
+}
+
+static size_t countDifferencesSse2(unsigned char const *left, unsigned char const *right,
+                                   size_t length)
+{
+    size_t count = 0;
+    size_t i = 0;
+    for (; i + 16 <= length; i += 16)
+        count += 16 - __builtin_popcount(sameMask16(left + i, right + i));
+    return count + countDifferencesScalar(left + i, right + i, length - i);
+}
+#endif
+
+#if EMBTEST_HAS_AVX2
+/*
+ * The AVX2 versions are compiled for AVX2 alone, and only called
+ * once the processor is known to have it.
+ */
+__attribute__((target("avx2")))
+static size_t firstDifferenceAvx2(unsigned char const *left, unsigned char const *right,
+                                  size_t length)
+{
+    size_t i = 0;
+    for (; i + 64 <= length; i += 64)
+    {
+        __m256i same = _mm256_and_si256(
+            _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<__m256i const*>(left + i)),
+                              _mm256_loadu_si256(reinterpret_cast<__m256i const*>(right + i))),
+            _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<__m256i const*>(left + i + 32)),
+                              _mm256_loadu_si256(reinterpret_cast<__m256i const*>(right + i + 32))));
+        if (static_cast<unsigned>(_mm256_movemask_epi8(same)) != 0xffffffffu)
+            break;
+    }
+    for (; i + 32 <= length; i += 32)
+    {
+        __m256i l = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(left + i));
+        __m256i r = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(right + i));
+        unsigned differ = ~static_cast<unsigned>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(l, r)));
+        if (differ)
+            return i + __builtin_ctz(differ);
+    }
+    return i + firstDifferenceSse2(left + i, right + i, length - i);
+}
+
+__attribute__((target("avx2,popcnt")))
+static size_t countDifferencesAvx2(unsigned char const *left, unsigned char const *right,
+                                   size_t length)
+{
+    size_t count = 0;
+    size_t i = 0;
+    for (; i + 32 <= length; i += 32)
+    {
+        __m256i l = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(left + i));
+        __m256i r = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(right + i));
+        unsigned same = static_cast<unsigned>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(l, r)));
+        count += 32 - __builtin_popcount(same);
+    }
+    return count + countDifferencesSse2(left + i, right + i, length - i);
+}
+
+static bool hasAvx2()
+{
+    static bool const s_hasAvx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt");
+    return s_hasAvx2;
+}
+#endif
+
+#if EMBTEST_HAS_NEON
+static size_t firstDifferenceNeon(unsigned char const *left, unsigned char const *right,
+                                  size_t length)
+{
+    size_t i = 0;
+    for (; i + 64 <= length; i += 64)
+    {
+        uint8x16_t same = vandq_u8(
+            vandq_u8(vceqq_u8(vld1q_u8(left + i), vld1q_u8(right + i)),
+                     vceqq_u8(vld1q_u8(left + i + 16), vld1q_u8(right + i + 16))),
+            vandq_u8(vceqq_u8(vld1q_u8(left + i + 32), vld1q_u8(right + i + 32)),
+                     vceqq_u8(vld1q_u8(left + i + 48), vld1q_u8(right + i + 48))));
+        if (vminvq_u8(same) != 0xff)
+            break;
+    }
+    for (; i + 16 <= length; i += 16)
+    {
+        if (vminvq_u8(vceqq_u8(vld1q_u8(left + i), vld1q_u8(right + i))) != 0xff)
+            break;
+    }
+    return i + firstDifferenceScalar(left + i, right + i, length - i);
+}
+
+static size_t countDifferencesNeon(unsigned char const *left, unsigned char const *right,
+                                   size_t length)
+{
+    size_t count = 0;
+    size_t i = 0;
+    for (; i + 16 <= length; i += 16)
+    {
+        uint8x16_t same = vceqq_u8(vld1q_u8(left + i), vld1q_u8(right + i));
+        count += 16 - vaddvq_u8(vshrq_n_u8(same, 7));
+    }
+    return count + countDifferencesScalar(left + i, right + i, length - i);
+}
+#endif
+
+/*
+ * Return the offset of the first byte that differs between the
+ * buffers, or length if they are equal.
+ */
+static size_t firstDifference(unsigned char const *left, unsigned char const *right, size_t length)
+{
+#if EMBTEST_HAS_AVX2
+    if (hasAvx2())
+        return firstDifferenceAvx2(left, right, length);
+#endif
+#if EMBTEST_HAS_SSE2
+    return firstDifferenceSse2(left, right, length);
+#elif EMBTEST_HAS_NEON
+    return firstDifferenceNeon(left, right, length);
+#else
+    return firstDifferenceScalar(left, right, length);
+#endif
+}
+
+/*
+ * Count the elements of elementSize bytes that differ between the
+ * buffers, from the first difference at byte offset first.
+ */
+static size_t countDifferences(unsigned char const *left, unsigned char const *right,
+                               size_t length, size_t elementSize, size_t first)
+{
+    if (elementSize == 1)
+    {
+#if EMBTEST_HAS_AVX2
+        if (hasAvx2())
+            return countDifferencesAvx2(left + first, right + first, length - first);
+#endif
+#if EMBTEST_HAS_SSE2
+        return countDifferencesSse2(left + first, right + first, length - first);
+#elif EMBTEST_HAS_NEON
+        return countDifferencesNeon(left + first, right + first, length - first);
+#else
+        return countDifferencesScalar(left + first, right + first, length - first);
+#endif
+    }
+
+    size_t count = 0;
+    while (first < length)
+    {
+        count++;
+        size_t next = (first / elementSize + 1) * elementSize;
+        first = next + firstDifference(left + next, right + next, length - next);
+    }
+    return count;
+}
+
+/*
+ * Print rows of 16 bytes of both buffers around offset first, with
+ * a row of markers under the bytes that differ. A buffer's bytes
+ * past its end are left blank.
+ */
+static void printHexWindow(std::ostream &out,
+                           unsigned char const *left, size_t leftBytes,
+                           unsigned char const *right, size_t rightBytes,
+                           size_t first)
+{
+    size_t row = first / 16 * 16;
+    size_t begin = row >= 16 ? row - 16 : 0;
+    size_t end = std::min(row + 32, std::max(leftBytes, rightBytes));
+
+    std::ios::fmtflags flags = out.flags();
+    char fill = out.fill();
+    out << std::hex << std::setfill('0');
+    for (size_t offset = begin; offset < end; offset += 16)
+    {
+        size_t count = std::min<size_t>(16, end - offset);
+        std::string markers;
+        bool differ = false;
+        for (int side=0; side < 2; ++side)
+        {
+            unsigned char const *bytes = side == 0 ? left : right;
+            size_t size = side == 0 ? leftBytes : rightBytes;
+            out << (side == 0 ? "   left " : "  right ") << std::setw(8) << offset << ":";
+            for (size_t i=0; i < count; ++i)
+            {
+                if (offset + i < size)
+                    out << ' ' << std::setw(2) << static_cast<unsigned>(bytes[offset + i]);
+                else
+                    out << "   ";
+            }
+            out << "\n";
+        }
+        for (size_t i=0; i < count; ++i)
+        {
+            size_t at = offset + i;
+            bool same = at < leftBytes && at < rightBytes && left[at] == right[at];
+            markers += same ? "   " : " ^^";
+            differ = differ || !same;
+        }
+        if (differ)
+            out << "                 " << markers.substr(0, markers.find_last_of('^') + 1) << "\n";
+    }
+    out.flags(flags);
+    out.fill(fill);
+}
+
+bool checkBytesEqual(bool asserted,
+                     char const *lstr, char const *rstr, char const *nstr,
+                     void const *left, void const *right, size_t length,
+                     int line, char const *file, RegToken token)
+{
+    unsigned char const *l = static_cast<unsigned char const*>(left);
+    unsigned char const *r = static_cast<unsigned char const*>(right);
+    size_t first = firstDifference(l, r, length);
+    if (EMBTEST_LIKELY(first == length))
+        return true;
+
+    size_t differ = countDifferences(l, r, length, 1, first);
+    std::ostream &out = beginFailure(line, file, token);
+    out << "       : It is " << (asserted ? "asserted" : "expected")
+        << " that the bytes are equal:\n"
+        << "   left: " << lstr << "\n"
+        << "  right: " << rstr << "\n"
+        << " length: " << nstr << " = " << length << "\n"
+        << "         " << differ << (differ == 1 ? " byte differs" : " bytes differ")
+        << ", the first at offset " << first << " (0x" << std::hex << first << std::dec << ")\n";
+    printHexWindow(out, l, length, r, length, first);
+    recordTestFailure(token);
+    return false;
+}
+
+/*
+ * The first lines of a failed range comparison, up to the first
+ * element that differs.
+ */
+static std::ostream& beginRangeFailure(bool asserted,
+                                       char const *lstr, char const *rstr,
+                                       size_t leftSize, size_t rightSize,
+                                       size_t differ, size_t first,
+                                       int line, char const *file, RegToken token)
+{
+    std::ostream &out = beginFailure(line, file, token);
+    out << "       : It is " << (asserted ? "asserted" : "expected")
+        << " that the ranges are equal:\n"
+        << "   left: " << lstr << ", " << leftSize << " elements\n"
+        << "  right: " << rstr << ", " << rightSize << " elements\n";
+    size_t common = std::min(leftSize, rightSize);
+    if (differ == 0)
+        out << "         the sizes differ, and the first " << common << " elements are equal\n";
+    else
+        out << "         " << differ << " of the first " << common
+            << (differ == 1 ? " elements differs" : " elements differ")
+            << ", the first at index " << first << "\n";
+    return out;
+}
+
+bool checkRangeBytes(bool asserted,
+                     char const *lstr, char const *rstr,
+                     void const *left, size_t leftSize,
+                     void const *right, size_t rightSize,
+                     size_t elementSize, ValuePrinter print,
+                     int line, char const *file, RegToken token)
+{
+    unsigned char const *l = static_cast<unsigned char const*>(left);
+    unsigned char const *r = static_cast<unsigned char const*>(right);
+    size_t length = std::min(leftSize, rightSize) * elementSize;
+    size_t firstByte = firstDifference(l, r, length);
+    if (EMBTEST_LIKELY(firstByte == length && leftSize == rightSize))
+        return true;
+
+    size_t differ = firstByte < length ? countDifferences(l, r, length, elementSize, firstByte) : 0;
+    size_t first = firstByte / elementSize;
+    std::ostream &out = beginRangeFailure(asserted, lstr, rstr, leftSize, rightSize,
+                                          differ, first, line, file, token);
+    if (differ > 0)
+    {
+        out << "   left[" << first << "]: ";
+        print(out, l + first * elementSize);
+        out << "\n  right[" << first << "]: ";
+        print(out, r + first * elementSize);
+        out << "\n";
+    }
+    printHexWindow(out, l, leftSize * elementSize, r, rightSize * elementSize, firstByte);
+    recordTestFailure(token);
+    return false;
+}
+
+void rangeFailed(bool asserted,
+                 char const *lstr, char const *rstr,
+                 size_t leftSize, size_t rightSize, size_t differ, size_t first,
+                 void const *lval, ValuePrinter lprint,
+                 void const *rval, ValuePrinter rprint,
+                 int line, char const *file, RegToken token)
+{
+    std::ostream &out = beginRangeFailure(asserted, lstr, rstr, leftSize, rightSize,
+                                          differ, first, line, file, token);
+    if (differ > 0)
+    {
+        out << "   left[" << first << "]: ";
+        lprint(out, lval);
+        out << "\n  right[" << first << "]: ";
+        rprint(out, rval);
+        out << "\n";
+    }
+    recordTestFailure(token);
+}
+
+/*
+ * Floating point arrays. A pair of values is near when they are
+ * equal, or differ by at most abs + rel times the larger magnitude;
+ * the allowance is capped at the largest finite value, so that an
+ * infinity is only near itself, and a NaN tolerance allows any
+ * finite difference. The SIMD versions below compute exactly this,
+ * in the same order and precision.
+ */
+template <typename T>
+static inline bool isNear(T left, T right, T absTolerance, T relTolerance)
+{
+    T diff = std::fabs(left - right);
+    T l = std::fabs(left);
+    T r = std::fabs(right);
+    T allowed = absTolerance + relTolerance * (l > r ? l : r);
+    T largest = std::numeric_limits<T>::max();
+    allowed = allowed < largest ? allowed : largest;
+    return left == right || diff <= allowed;
+}
+
+template <typename T>
+struct FloatBits;
+
+template <>
+struct FloatBits<float>
+{
+    typedef uint32_t Unsigned;
+    typedef int32_t  Signed;
+};
+
+template <>
+struct FloatBits<double>
+{
+    typedef uint64_t Unsigned;
+    typedef int64_t  Signed;
+};
+
+/*
+ * The bits of a value as an integer that orders the values: the
+ * magnitude, negated for negative values. Both zeros are 0, and
+ * adjacent values are 1 apart.
+ */
+template <typename T>
+static inline typename FloatBits<T>::Signed orderedBits(T value)
+{
+    typedef typename FloatBits<T>::Unsigned Unsigned;
+    typedef typename FloatBits<T>::Signed Signed;
+    Unsigned bits;
+    std::memcpy(&bits, &value, sizeof bits);
+    Unsigned const sign = Unsigned(1) << (sizeof bits * 8 - 1);
+    Signed magnitude = static_cast<Signed>(bits & ~sign);
+    return (bits & sign) ? -magnitude : magnitude;
+}
+
+template <typename T>
+static inline uint64_t ulpDistance(T left, T right)
+{
+    typedef typename FloatBits<T>::Unsigned Unsigned;
+    typename FloatBits<T>::Signed l = orderedBits(left);
+    typename FloatBits<T>::Signed r = orderedBits(right);
+    return l > r ? Unsigned(l) - Unsigned(r) : Unsigned(r) - Unsigned(l);
+}
+
+template <typename T>
+static inline bool isWithinUlps(T left, T right, uint64_t maxUlps)
+{
+    return !std::isnan(left) && !std::isnan(right) && ulpDistance(left, right) <= maxUlps;
+}
+
+template <typename T>
+static bool allNearScalar(T const *left, T const *right, size_t length,
+                          T absTolerance, T relTolerance)
+{
+    bool near = true;
+    for (size_t i=0; i < length; ++i)
+        near = isNear(left[i], right[i], absTolerance, relTolerance) && near;
+    return near;
+}
+
+template <typename T>
+static bool allWithinUlpsScalar(T const *left, T const *right, size_t length, uint64_t maxUlps)
+{
+    bool within = true;
+    for (size_t i=0; i < length; ++i)
+        within = isWithinUlps(left[i], right[i], maxUlps) && within;
+    return within;
+}
+
+#if EMBTEST_HAS_SSE2
+static bool allNearSse2(float const *left, float const *right, size_t length,
+                        float absTolerance, float relTolerance)
+{
+    __m128 const sign = _mm_set1_ps(-0.0f);
+    __m128 const absT = _mm_set1_ps(absTolerance);
+    __m128 const relT = _mm_set1_ps(relTolerance);
+    __m128 const largest = _mm_set1_ps(std::numeric_limits<float>::max());
+    __m128 near = _mm_castsi128_ps(_mm_set1_epi32(-1));
+    size_t i = 0;
+    for (; i + 4 <= length; i += 4)
+    {
+        __m128 l = _mm_loadu_ps(left + i);
+        __m128 r = _mm_loadu_ps(right + i);
+        __m128 diff = _mm_andnot_ps(sign, _mm_sub_ps(l, r));
+        __m128 larger = _mm_max_ps(_mm_andnot_ps(sign, l), _mm_andnot_ps(sign, r));
+        __m128 allowed = _mm_min_ps(_mm_add_ps(absT, _mm_mul_ps(relT, larger)), largest);
+        near = _mm_and_ps(near, _mm_or_ps(_mm_cmpeq_ps(l, r), _mm_cmple_ps(diff, allowed)));
+    }
+    return _mm_movemask_ps(near) == 0xf
+        && allNearScalar(left + i, right + i, length - i, absTolerance, relTolerance);
+}
+
+static bool allNearSse2(double const *left, double const *right, size_t length,
+                        double absTolerance, double relTolerance)
+{
+    __m128d const sign = _mm_set1_pd(-0.0);
+    __m128d const absT = _mm_set1_pd(absTolerance);
+    __m128d const relT = _mm_set1_pd(relTolerance);
+    __m128d const largest = _mm_set1_pd(std::numeric_limits<double>::max());
+    __m128d near = _mm_castsi128_pd(_mm_set1_epi32(-1));
+    size_t i = 0;
+    for (; i + 2 <= length; i += 2)
+    {
+        __m128d l = _mm_loadu_pd(left + i);
+        __m128d r = _mm_loadu_pd(right + i);
+        __m128d diff = _mm_andnot_pd(sign, _mm_sub_pd(l, r));
+        __m128d larger = _mm_max_pd(_mm_andnot_pd(sign, l), _mm_andnot_pd(sign, r));
+        __m128d allowed = _mm_min_pd(_mm_add_pd(absT, _mm_mul_pd(relT, larger)), largest);
+        near = _mm_and_pd(near, _mm_or_pd(_mm_cmpeq_pd(l, r), _mm_cmple_pd(diff, allowed)));
+    }
+    return _mm_movemask_pd(near) == 0x3
+        && allNearScalar(left + i, right + i, length - i, absTolerance, relTolerance);
+}
+
+/*
+ * orderedBits() of four floats: the magnitude, with its two's
+ * complement taken where the sign bit is set. Distances are
+ * compared unsigned, by flipping the sign bits of both sides.
+ */
+static inline __m128i orderedBitsSse2(__m128 value)
+{
+    __m128i bits = _mm_castps_si128(value);
+    __m128i negative = _mm_srai_epi32(bits, 31);
+    __m128i magnitude = _mm_and_si128(bits, _mm_set1_epi32(0x7fffffff));
+    return _mm_sub_epi32(_mm_xor_si128(magnitude, negative), negative);
+}
+
+static bool allWithinUlpsSse2(float const *left, float const *right, size_t length,
+                              uint64_t maxUlps)
+{
+    uint32_t const limit = static_cast<uint32_t>(std::min<uint64_t>(maxUlps, 0xffffffffu));
+    __m128i const flip = _mm_set1_epi32(static_cast<int32_t>(0x80000000u));
+    __m128i const flippedLimit = _mm_set1_epi32(static_cast<int32_t>(limit ^ 0x80000000u));
+    __m128i over = _mm_setzero_si128();
+    __m128 unordered = _mm_setzero_ps();
+    size_t i = 0;
+    for (; i + 4 <= length; i += 4)
+    {
+        __m128 l = _mm_loadu_ps(left + i);
+        __m128 r = _mm_loadu_ps(right + i);
+        __m128i a = orderedBitsSse2(l);
+        __m128i b = orderedBitsSse2(r);
+        __m128i greater = _mm_cmpgt_epi32(a, b);
+        __m128i distance = _mm_or_si128(_mm_and_si128(greater, _mm_sub_epi32(a, b)),
+                                        _mm_andnot_si128(greater, _mm_sub_epi32(b, a)));
+        over = _mm_or_si128(over, _mm_cmpgt_epi32(_mm_xor_si128(distance, flip), flippedLimit));
+        unordered = _mm_or_ps(unordered, _mm_cmpunord_ps(l, r));
+    }
+    return _mm_movemask_epi8(over) == 0 && _mm_movemask_ps(unordered) == 0
+        && allWithinUlpsScalar(left + i, right + i, length - i, maxUlps);
+}
+#endif
+
+#if EMBTEST_HAS_AVX2
+__attribute__((target("avx2")))
+static bool allNearAvx2(float const *left, float const *right, size_t length,
+                        float absTolerance, float relTolerance)
+{
+    __m256 const sign = _mm256_set1_ps(-0.0f);
+    __m256 const absT = _mm256_set1_ps(absTolerance);
+    __m256 const relT = _mm256_set1_ps(relTolerance);
+    __m256 const largest = _mm256_set1_ps(std::numeric_limits<float>::max());
+    __m256 near = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+    size_t i = 0;
+    for (; i + 8 <= length; i += 8)
+    {
+        __m256 l = _mm256_loadu_ps(left + i);
+        __m256 r = _mm256_loadu_ps(right + i);
+        __m256 diff = _mm256_andnot_ps(sign, _mm256_sub_ps(l, r));
+        __m256 larger = _mm256_max_ps(_mm256_andnot_ps(sign, l), _mm256_andnot_ps(sign, r));
+        __m256 allowed = _mm256_min_ps(_mm256_add_ps(absT, _mm256_mul_ps(relT, larger)), largest);
+        near = _mm256_and_ps(near, _mm256_or_ps(_mm256_cmp_ps(l, r, _CMP_EQ_OQ),
+                                                _mm256_cmp_ps(diff, allowed, _CMP_LE_OQ)));
+    }
+    return _mm256_movemask_ps(near) == 0xff
+        && allNearSse2(left + i, right + i, length - i, absTolerance, relTolerance);
+}
+
+__attribute__((target("avx2")))
+static bool allNearAvx2(double const *left, double const *right, size_t length,
+                        double absTolerance, double relTolerance)
+{
+    __m256d const sign = _mm256_set1_pd(-0.0);
+    __m256d const absT = _mm256_set1_pd(absTolerance);
+    __m256d const relT = _mm256_set1_pd(relTolerance);
+    __m256d const largest = _mm256_set1_pd(std::numeric_limits<double>::max());
+    __m256d near = _mm256_castsi256_pd(_mm256_set1_epi32(-1));
+    size_t i = 0;
+    for (; i + 4 <= length; i += 4)
+    {
+        __m256d l = _mm256_loadu_pd(left + i);
+        __m256d r = _mm256_loadu_pd(right + i);
+        __m256d diff = _mm256_andnot_pd(sign, _mm256_sub_pd(l, r));
+        __m256d larger = _mm256_max_pd(_mm256_andnot_pd(sign, l), _mm256_andnot_pd(sign, r));
+        __m256d allowed = _mm256_min_pd(_mm256_add_pd(absT, _mm256_mul_pd(relT, larger)), largest);
+        near = _mm256_and_pd(near, _mm256_or_pd(_mm256_cmp_pd(l, r, _CMP_EQ_OQ),
+                                                _mm256_cmp_pd(diff, allowed, _CMP_LE_OQ)));
+    }
+    return _mm256_movemask_pd(near) == 0xf
+        && allNearSse2(left + i, right + i, length - i, absTolerance, relTolerance);
+}
+
+__attribute__((target("avx2")))
+static bool allWithinUlpsAvx2(float const *left, float const *right, size_t length,
+                              uint64_t maxUlps)
+{
+    uint32_t const limit = static_cast<uint32_t>(std::min<uint64_t>(maxUlps, 0xffffffffu));
+    __m256i const flip = _mm256_set1_epi32(static_cast<int32_t>(0x80000000u));
+    __m256i const flippedLimit = _mm256_set1_epi32(static_cast<int32_t>(limit ^ 0x80000000u));
+    __m256i const mask = _mm256_set1_epi32(0x7fffffff);
+    __m256i over = _mm256_setzero_si256();
+    __m256 unordered = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 8 <= length; i += 8)
+    {
+        __m256 l = _mm256_loadu_ps(left + i);
+        __m256 r = _mm256_loadu_ps(right + i);
+        __m256i lbits = _mm256_castps_si256(l);
+        __m256i rbits = _mm256_castps_si256(r);
+        __m256i lnegative = _mm256_srai_epi32(lbits, 31);
+        __m256i rnegative = _mm256_srai_epi32(rbits, 31);
+        __m256i a = _mm256_sub_epi32(_mm256_xor_si256(_mm256_and_si256(lbits, mask), lnegative), lnegative);
+        __m256i b = _mm256_sub_epi32(_mm256_xor_si256(_mm256_and_si256(rbits, mask), rnegative), rnegative);
+        __m256i greater = _mm256_cmpgt_epi32(a, b);
+        __m256i distance = _mm256_blendv_epi8(_mm256_sub_epi32(b, a), _mm256_sub_epi32(a, b), greater);
+        over = _mm256_or_si256(over, _mm256_cmpgt_epi32(_mm256_xor_si256(distance, flip), flippedLimit));
+        unordered = _mm256_or_ps(unordered, _mm256_cmp_ps(l, r, _CMP_UNORD_Q));
+    }
+    return _mm256_testz_si256(over, over) && _mm256_movemask_ps(unordered) == 0
+        && allWithinUlpsSse2(left + i, right + i, length - i, maxUlps);
+}
+
+/*
+ * AVX2 has no 64-bit arithmetic shift, so the sign of each double
+ * is found by comparing its bits with zero.
+ */
+__attribute__((target("avx2")))
+static bool allWithinUlpsAvx2(double const *left, double const *right, size_t length,
+                              uint64_t maxUlps)
+{
+    __m256i const zero = _mm256_setzero_si256();
+    __m256i const flip = _mm256_set1_epi64x(static_cast<long long>(0x8000000000000000ull));
+    __m256i const flippedLimit = _mm256_set1_epi64x(static_cast<long long>(maxUlps ^ 0x8000000000000000ull));
+    __m256i const mask = _mm256_set1_epi64x(0x7fffffffffffffffll);
+    __m256i over = _mm256_setzero_si256();
+    __m256d unordered = _mm256_setzero_pd();
+    size_t i = 0;
+    for (; i + 4 <= length; i += 4)
+    {
+        __m256d l = _mm256_loadu_pd(left + i);
+        __m256d r = _mm256_loadu_pd(right + i);
+        __m256i lbits = _mm256_castpd_si256(l);
+        __m256i rbits = _mm256_castpd_si256(r);
+        __m256i lnegative = _mm256_cmpgt_epi64(zero, lbits);
+        __m256i rnegative = _mm256_cmpgt_epi64(zero, rbits);
+        __m256i a = _mm256_sub_epi64(_mm256_xor_si256(_mm256_and_si256(lbits, mask), lnegative), lnegative);
+        __m256i b = _mm256_sub_epi64(_mm256_xor_si256(_mm256_and_si256(rbits, mask), rnegative), rnegative);
+        __m256i greater = _mm256_cmpgt_epi64(a, b);
+        __m256i distance = _mm256_blendv_epi8(_mm256_sub_epi64(b, a), _mm256_sub_epi64(a, b), greater);
+        over = _mm256_or_si256(over, _mm256_cmpgt_epi64(_mm256_xor_si256(distance, flip), flippedLimit));
+        unordered = _mm256_or_pd(unordered, _mm256_cmp_pd(l, r, _CMP_UNORD_Q));
+    }
+    return _mm256_testz_si256(over, over) && _mm256_movemask_pd(unordered) == 0
+        && allWithinUlpsScalar(left + i, right + i, length - i, maxUlps);
+}
+#endif
+
+#if EMBTEST_HAS_NEON
+/*
+ * vminnmq, unlike vminq, returns the number when the other operand
+ * is a NaN, as the scalar and SSE2 versions do.
+ */
+static bool allNearNeon(float const *left, float const *right, size_t length,
+                        float absTolerance, float relTolerance)
+{
+    float32x4_t const absT = vdupq_n_f32(absTolerance);
+    float32x4_t const relT = vdupq_n_f32(relTolerance);
+    float32x4_t const largest = vdupq_n_f32(std::numeric_limits<float>::max());
+    uint32x4_t near = vdupq_n_u32(0xffffffffu);
+    size_t i = 0;
+    for (; i + 4 <= length; i += 4)
+    {
+        float32x4_t l = vld1q_f32(left + i);
+        float32x4_t r = vld1q_f32(right + i);
+        float32x4_t diff = vabdq_f32(l, r);
+        float32x4_t larger = vmaxq_f32(vabsq_f32(l), vabsq_f32(r));
+        float32x4_t allowed = vminnmq_f32(vaddq_f32(absT, vmulq_f32(relT, larger)), largest);
+        near = vandq_u32(near, vorrq_u32(vceqq_f32(l, r), vcleq_f32(diff, allowed)));
+    }
+    return vminvq_u32(near) == 0xffffffffu
+        && allNearScalar(left + i, right + i, length - i, absTolerance, relTolerance);
+}
+
+static bool allNearNeon(double const *left, double const *right, size_t length,
+                        double absTolerance, double relTolerance)
+{
+    float64x2_t const absT = vdupq_n_f64(absTolerance);
+    float64x2_t const relT = vdupq_n_f64(relTolerance);
+    float64x2_t const largest = vdupq_n_f64(std::numeric_limits<double>::max());
+    uint64x2_t near = vdupq_n_u64(~0ull);
+    size_t i = 0;
+    for (; i + 2 <= length; i += 2)
+    {
+        float64x2_t l = vld1q_f64(left + i);
+        float64x2_t r = vld1q_f64(right + i);
+        float64x2_t diff = vabdq_f64(l, r);
+        float64x2_t larger = vmaxq_f64(vabsq_f64(l), vabsq_f64(r));
+        float64x2_t allowed = vminnmq_f64(vaddq_f64(absT, vmulq_f64(relT, larger)), largest);
+        near = vandq_u64(near, vorrq_u64(vceqq_f64(l, r), vcleq_f64(diff, allowed)));
+    }
+    return (vgetq_lane_u64(near, 0) & vgetq_lane_u64(near, 1)) == ~0ull
+        && allNearScalar(left + i, right + i, length - i, absTolerance, relTolerance);
+}
+
+static bool allWithinUlpsNeon(float const *left, float const *right, size_t length,
+                              uint64_t maxUlps)
+{
+    uint32x4_t const limit = vdupq_n_u32(static_cast<uint32_t>(std::min<uint64_t>(maxUlps, 0xffffffffu)));
+    int32x4_t const mask = vdupq_n_s32(0x7fffffff);
+    uint32x4_t over = vdupq_n_u32(0);
+    size_t i = 0;
+    for (; i + 4 <= length; i += 4)
+    {
+        float32x4_t l = vld1q_f32(left + i);
+        float32x4_t r = vld1q_f32(right + i);
+        int32x4_t lbits = vreinterpretq_s32_f32(l);
+        int32x4_t rbits = vreinterpretq_s32_f32(r);
+        int32x4_t lnegative = vshrq_n_s32(lbits, 31);
+        int32x4_t rnegative = vshrq_n_s32(rbits, 31);
+        int32x4_t a = vsubq_s32(veorq_s32(vandq_s32(lbits, mask), lnegative), lnegative);
+        int32x4_t b = vsubq_s32(veorq_s32(vandq_s32(rbits, mask), rnegative), rnegative);
+        uint32x4_t distance = vreinterpretq_u32_s32(vabdq_s32(a, b));
+        uint32x4_t ordered = vandq_u32(vceqq_f32(l, l), vceqq_f32(r, r));
+        over = vorrq_u32(over, vorrq_u32(vcgtq_u32(distance, limit), vmvnq_u32(ordered)));
+    }
+    return vmaxvq_u32(over) == 0
+        && allWithinUlpsScalar(left + i, right + i, length - i, maxUlps);
+}
+
+static bool allWithinUlpsNeon(double const *left, double const *right, size_t length,
+                              uint64_t maxUlps)
+{
+    uint64x2_t const limit = vdupq_n_u64(maxUlps);
+    int64x2_t const mask = vdupq_n_s64(0x7fffffffffffffffll);
+    uint64x2_t over = vdupq_n_u64(0);
+    size_t i = 0;
+    for (; i + 2 <= length; i += 2)
+    {
+        float64x2_t l = vld1q_f64(left + i);
+        float64x2_t r = vld1q_f64(right + i);
+        int64x2_t lbits = vreinterpretq_s64_f64(l);
+        int64x2_t rbits = vreinterpretq_s64_f64(r);
+        int64x2_t lnegative = vshrq_n_s64(lbits, 63);
+        int64x2_t rnegative = vshrq_n_s64(rbits, 63);
+        int64x2_t a = vsubq_s64(veorq_s64(vandq_s64(lbits, mask), lnegative), lnegative);
+        int64x2_t b = vsubq_s64(veorq_s64(vandq_s64(rbits, mask), rnegative), rnegative);
+        uint64x2_t distance = vbslq_u64(vcgtq_s64(a, b),
+                                        vreinterpretq_u64_s64(vsubq_s64(a, b)),
+                                        vreinterpretq_u64_s64(vsubq_s64(b, a)));
+        uint64x2_t ordered = vandq_u64(vceqq_f64(l, l), vceqq_f64(r, r));
+        over = vorrq_u64(over, vorrq_u64(vcgtq_u64(distance, limit),
+                                         veorq_u64(ordered, vdupq_n_u64(~0ull))));
+    }
+    return (vgetq_lane_u64(over, 0) | vgetq_lane_u64(over, 1)) == 0
+        && allWithinUlpsScalar(left + i, right + i, length - i, maxUlps);
+}
+#endif
+
+/*
+ * Check that every pair of values is near, or within maxUlps, with
+ * the widest SIMD instructions the processor has.
+ */
+template <typename T>
+static bool allNear(T const *left, T const *right, size_t length,
+                    T absTolerance, T relTolerance)
+{
+#if EMBTEST_HAS_AVX2
+    if (hasAvx2())
+        return allNearAvx2(left, right, length, absTolerance, relTolerance);
+#endif
+#if EMBTEST_HAS_SSE2
+    return allNearSse2(left, right, length, absTolerance, relTolerance);
+#elif EMBTEST_HAS_NEON
+    return allNearNeon(left, right, length, absTolerance, relTolerance);
+#else
+    return allNearScalar(left, right, length, absTolerance, relTolerance);
+#endif
+}
+
+static bool allWithinUlps(float const *left, float const *right, size_t length, uint64_t maxUlps)
+{
+#if EMBTEST_HAS_AVX2
+    if (hasAvx2())
+        return allWithinUlpsAvx2(left, right, length, maxUlps);
+#endif
+#if EMBTEST_HAS_SSE2
+    return allWithinUlpsSse2(left, right, length, maxUlps);
+#elif EMBTEST_HAS_NEON
+    return allWithinUlpsNeon(left, right, length, maxUlps);
+#else
+    return allWithinUlpsScalar(left, right, length, maxUlps);
+#endif
+}
+
+/*
+ * SSE2 has no 64-bit comparison, so without AVX2 doubles are
+ * checked one at a time.
+ */
+static bool allWithinUlps(double const *left, double const *right, size_t length, uint64_t maxUlps)
+{
+#if EMBTEST_HAS_AVX2
+    if (hasAvx2())
+        return allWithinUlpsAvx2(left, right, length, maxUlps);
+#endif
+#if EMBTEST_HAS_NEON
+    return allWithinUlpsNeon(left, right, length, maxUlps);
+#else
+    return allWithinUlpsScalar(left, right, length, maxUlps);
+#endif
+}
+
+/*
+ * A tolerance for measureErrors(): whether a pair of values is
+ * within it, and if not, how many times the tolerance they differ
+ * by.
+ */
+template <typename T>
+struct NearTolerance
+{
+    T absTolerance;
+    T relTolerance;
+
+    bool within(T left, T right) const
+    {
+        return isNear(left, right, absTolerance, relTolerance);
+    }
+
+    double excess(T left, T right) const
+    {
+        T l = std::fabs(left);
+        T r = std::fabs(right);
+        T allowed = absTolerance + relTolerance * (l > r ? l : r);
+        T diff = std::fabs(left - right);
+        return allowed > 0 ? static_cast<double>(diff) / allowed : HUGE_VAL;
+    }
+};
+
+template <typename T>
+struct UlpsTolerance
+{
+    uint64_t maxUlps;
+
+    bool within(T left, T right) const
+    {
+        return isWithinUlps(left, right, maxUlps);
+    }
+
+    double excess(T left, T right) const
+    {
+        return maxUlps > 0 ? static_cast<double>(ulpDistance(left, right)) / maxUlps : HUGE_VAL;
+    }
+};
+
+/*
+ * What a failed array comparison reports: the values out of
+ * tolerance and the first of them, the largest errors and where
+ * they are, and a histogram of how many times the tolerance the
+ * values differ by.
+ */
+struct ArrayErrors
+{
+    enum { WITHIN, TIMES_10, TIMES_100, TIMES_1000, BEYOND, NAN_VALUES, BUCKETS };
+
+    size_t   failed;
+    size_t   first;
+    double   maxAbs;
+    size_t   maxAbsAt;
+    double   maxRel;
+    size_t   maxRelAt;
+    uint64_t maxUlps;
+    size_t   maxUlpsAt;
+    size_t   histogram[BUCKETS];
+};
+
+template <typename T, typename Tolerance>
+static ArrayErrors measureErrors(T const *left, T const *right, size_t length,
+                                 Tolerance const &tolerance)
+{
+    ArrayErrors errors = ArrayErrors();
+    errors.first = length;
+    for (size_t i=0; i < length; ++i)
+    {
+        T l = left[i];
+        T r = right[i];
+        if (tolerance.within(l, r))
+            errors.histogram[ArrayErrors::WITHIN]++;
+        else
+        {
+            if (errors.failed++ == 0)
+                errors.first = i;
+            double excess = tolerance.excess(l, r);
+            if (std::isnan(l) || std::isnan(r))
+                errors.histogram[ArrayErrors::NAN_VALUES]++;
+            else if (excess <= 10)
+                errors.histogram[ArrayErrors::TIMES_10]++;
+            else if (excess <= 100)
+                errors.histogram[ArrayErrors::TIMES_100]++;
+            else if (excess <= 1000)
+                errors.histogram[ArrayErrors::TIMES_1000]++;
+            else
+                errors.histogram[ArrayErrors::BEYOND]++;
+        }
+        if (std::isnan(l) || std::isnan(r))
+            continue;
+
+        double abs = std::fabs(static_cast<double>(l) - static_cast<double>(r));
+        double larger = std::max(std::fabs(static_cast<double>(l)), std::fabs(static_cast<double>(r)));
+        double rel = larger > 0 ? abs / larger : 0;
+        uint64_t ulps = ulpDistance(l, r);
+        if (abs > errors.maxAbs)
+        {
+            errors.maxAbs = abs;
+            errors.maxAbsAt = i;
+        }
+        if (rel > errors.maxRel)
+        {
+            errors.maxRel = rel;
+            errors.maxRelAt = i;
+        }
+        if (ulps > errors.maxUlps)
+        {
+            errors.maxUlps = ulps;
+            errors.maxUlpsAt = i;
+        }
+    }
+    return errors;
+}
+
+/*
+ * Write the lines of a failed array comparison after the tolerance:
+ * the count, the largest errors with the values at their index,
+ * and the histogram.
+ */
+template <typename T>
+static void printArrayErrors(std::ostream &out, T const *left, T const *right, size_t length,
+                             ArrayErrors const &errors)
+{
+    out << "         " << errors.failed << " of " << length
+        << (errors.failed == 1 ? " values is" : " values are")
+        << " out of tolerance, the first at index " << errors.first << "\n";
+
+    struct Largest
+    {
+        char const *name;
+        size_t      at;
+    };
+    Largest const largest[3] = {
+        { "absolute", errors.maxAbsAt },
+        { "relative", errors.maxRelAt },
+        { "ULP", errors.maxUlpsAt },
+    };
+    for (size_t k=0; k < 3; ++k)
+    {
+        out << "         largest " << largest[k].name << " error ";
+        if (k == 0)
+            out << errors.maxAbs;
+        else if (k == 1)
+            out << errors.maxRel;
+        else
+            out << errors.maxUlps;
+        std::streamsize precision = out.precision(std::numeric_limits<T>::max_digits10);
+        out << " at index " << largest[k].at << ": "
+            << left[largest[k].at] << " and " << right[largest[k].at] << "\n";
+        out.precision(precision);
+    }
+
+    static char const *const s_buckets[ArrayErrors::BUCKETS] = {
+        "<= 1", "1 - 10", "10 - 100", "100 - 1000", "> 1000", "NaN"
+    };
+    out << "         error / tolerance    values\n";
+    for (size_t b=0; b < ArrayErrors::BUCKETS; ++b)
+        out << std::setw(26) << s_buckets[b] << std::setw(10) << errors.histogram[b] << "\n";
+}
+
+template <typename T>
+static bool checkArrayNearOf(bool asserted,
+                             char const *lstr, char const *rstr, char const *nstr,
+                             T const *left, T const *right, size_t length,
+                             double absTolerance, double relTolerance,
+                             int line, char const *file, RegToken token)
+{
+    NearTolerance<T> tolerance = { static_cast<T>(absTolerance), static_cast<T>(relTolerance) };
+    if (EMBTEST_LIKELY(allNear(left, right, length, tolerance.absTolerance, tolerance.relTolerance)))
+        return true;
+
+    ArrayErrors errors = measureErrors(left, right, length, tolerance);
+    std::ostream &out = beginFailure(line, file, token);
+    out << "       : It is " << (asserted ? "asserted" : "expected")
+        << " that the arrays are near:\n"
+        << "   left: " << lstr << "\n"
+        << "  right: " << rstr << "\n"
+        << " length: " << nstr << " = " << length << "\n"
+        << "         |left[i] - right[i]| <= " << absTolerance << " + " << relTolerance
+        << " * max(|left[i]|, |right[i]|)\n";
+    printArrayErrors(out, left, right, length, errors);
+    recordTestFailure(token);
+    return false;
+}
+
+template <typename T>
+static bool checkArrayUlpsOf(bool asserted,
+                             char const *lstr, char const *rstr, char const *nstr,
+                             T const *left, T const *right, size_t length,
+                             uint64_t maxUlps,
+                             int line, char const *file, RegToken token)
+{
+    if (EMBTEST_LIKELY(allWithinUlps(left, right, length, maxUlps)))
+        return true;
+
+    UlpsTolerance<T> tolerance = { maxUlps };
+    ArrayErrors errors = measureErrors(left, right, length, tolerance);
+    std::ostream &out = beginFailure(line, file, token);
+    out << "       : It is " << (asserted ? "asserted" : "expected")
+        << " that the arrays are within " << maxUlps << " ULPs:\n"
+        << "   left: " << lstr << "\n"
+        << "  right: " << rstr << "\n"
+        << " length: " << nstr << " = " << length << "\n";
+    printArrayErrors(out, left, right, length, errors);
+    recordTestFailure(token);
+    return false;
+}
+
+bool checkArrayNear(bool asserted,
+                    char const *lstr, char const *rstr, char const *nstr,
+                    float const *left, float const *right, size_t length,
+                    double absTolerance, double relTolerance,
+                    int line, char const *file, RegToken token)
+{
+    return checkArrayNearOf(asserted, lstr, rstr, nstr, left, right, length,
+                            absTolerance, relTolerance, line, file, token);
+}
+
+bool checkArrayNear(bool asserted,
+                    char const *lstr, char const *rstr, char const *nstr,
+                    double const *left, double const *right, size_t length,
+                    double absTolerance, double relTolerance,
+                    int line, char const *file, RegToken token)
+{
+    return checkArrayNearOf(asserted, lstr, rstr, nstr, left, right, length,
+                            absTolerance, relTolerance, line, file, token);
+}
+
+bool checkArrayUlps(bool asserted,
+                    char const *lstr, char const *rstr, char const *nstr,
+                    float const *left, float const *right, size_t length,
+                    uint64_t maxUlps,
+                    int line, char const *file, RegToken token)
+{
+    return checkArrayUlpsOf(asserted, lstr, rstr, nstr, left, right, length,
+                            maxUlps, line, file, token);
+}
+
+bool checkArrayUlps(bool asserted,
+                    char const *lstr, char const *rstr, char const *nstr,
+                    double const *left, double const *right, size_t length,
+                    uint64_t maxUlps,
+                    int line, char const *file, RegToken token)
+{
+    return checkArrayUlpsOf(asserted, lstr, rstr, nstr, left, right, length,
+                            maxUlps, line, file, token);
+}
+
+} // embtest::
@@ -7,339 +7,4184 @@
  */
 #include <string>
 #include <iostream>
+#include <sstream>
 #include <vector>
+#include <deque>
 #include <map>
+#include <set>
+#include <fstream>
+#include <atomic>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iomanip>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <regex>
+#include <stdexcept>
 
-#include "embtest.hpp"
+#if !defined(EMBTEST_NO_THREADS)
+#define EMBTEST_HAS_THREADS 1
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#define EMBTEST_THREAD_LOCAL thread_local
+#else
+#define EMBTEST_HAS_THREADS 0
+#define EMBTEST_THREAD_LOCAL
+#endif
+
+#if !defined(EMBTEST_NO_FORK) && (defined(__unix__) || defined(__APPLE__))
+#define EMBTEST_HAS_FORK 1
+#include <cerrno>
+#include <csignal>
+#include <poll.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#else
+#define EMBTEST_HAS_FORK 0
+#endif
+
+/*
+ * Backtraces of hung tests need glibc's backtrace() and Linux's
+ * per-thread signals. EMBTEST_DUMP_SIGNAL asks a process for them.
+ */
+#if EMBTEST_HAS_FORK && defined(__linux__) && defined(__GLIBC__)
+#define EMBTEST_HAS_BACKTRACE 1
+#include <dirent.h>
+#include <execinfo.h>
+#include <sys/syscall.h>
+#if !defined(EMBTEST_DUMP_SIGNAL)
+#define EMBTEST_DUMP_SIGNAL SIGUSR2
+#endif
+#else
+#define EMBTEST_HAS_BACKTRACE 0
+#endif
+
+#if defined(__linux__) && !defined(EMBTEST_NO_PERF_EVENTS)
+#define EMBTEST_HAS_PERF_EVENTS 1
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#else
+#define EMBTEST_HAS_PERF_EVENTS 0
+#endif
+
+#include "embtest_runner.hpp"
+#include "embtest_reporters.hpp"
 
 namespace embtest {
 
+/*
+ * CPU time consumed so far by the calling thread, in nanoseconds.
+ * Falls back to process CPU time where per-thread time is missing.
+ */
+static double threadCpuNs()
+{
+#if defined(CLOCK_THREAD_CPUTIME_ID)
+    struct timespec ts;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) == 0)
+        return ts.tv_sec * 1e9 + ts.tv_nsec;
+#endif
+    return static_cast<double>(std::clock()) * (1e9 / CLOCKS_PER_SEC);
+}
+
 /**
- * A RegisteredTest contains the internal setup data for a
- * test, including its name, the name of the suite it belongs to,
- * whether it is enabled or not, etc.
+ * A PhaseTimer measures consecutive phases: each lap() returns
+ * the time since the previous lap (or construction).
  */
-class RegisteredTest
+class PhaseTimer
 {
   public:
-    RegisteredTest(std::string suiteName, std::string testName, TestFactoryBase *factory)
-        : m_suiteName(suiteName)
-        , m_testName(testName)
-        , m_fullName(suiteName + "." + testName)
-        , m_factory(factory)
-        , m_token(-1)
-        , m_enabled(true)
-        , m_runstate(NOTRUN)
+    PhaseTimer()
+        : m_wall(std::chrono::steady_clock::now())
+        , m_cpu(threadCpuNs())
     { }
 
-    ~RegisteredTest()
+    PhaseTime lap()
     {
-        delete m_factory;
-    }
+        std::chrono::steady_clock::time_point wall = std::chrono::steady_clock::now();
+        double cpu = threadCpuNs();
 
-    /*
-     * Define various property accessors:
-     */
-    std::string const& suiteName() const { return m_suiteName; }
-    std::string const& testName() const  { return m_testName; }
-    std::string const& fullName() const  { return m_fullName; }
+        PhaseTime elapsed;
+        elapsed.wallNs = std::chrono::duration<double, std::nano>(wall - m_wall).count();
+        elapsed.cpuNs = cpu - m_cpu;
+        m_wall = wall;
+        m_cpu = cpu;
+        return elapsed;
+    }
 
-    void setToken(RegToken token)        { m_token = token; }
-    RegToken token() const               { return m_token; }
+  private:
+    std::chrono::steady_clock::time_point m_wall;
+    double                                m_cpu;
+};
 
-    void enable()                        { m_enabled = true; }
-    void disable()                       { m_enabled = false; }
-    bool enabled() const                 { return m_enabled; }
+/**
+ * A TestInfo streams as the test's "suite.test" name, so the
+ * full name is only formatted when it is printed.
+ */
+std::ostream& operator<<(std::ostream &out, TestInfo const &test)
+{
+    return out << test.suiteName << '.' << test.testName;
+}
 
-    enum RunState {NOTRUN, PASSED, FAILED};
-    void setRunstate(RunState rs)        { m_runstate = rs; }
-    RunState runstate() const            { return m_runstate; }
+char const* perfCounterName(PerfCounter counter)
+{
+    switch (counter) {
+        case CounterCycles:          return "cycles";
+        case CounterInstructions:    return "instructions";
+        case CounterBranchMisses:    return "branch_misses";
+        case CounterCacheMisses:     return "cache_misses";
+        case CounterTaskClock:       return "task_clock_ns";
+        case CounterPageFaults:      return "page_faults";
+        case CounterContextSwitches: return "context_switches";
+        case CounterCount:           break;
+    }
+    return "unknown";
+}
 
-    /**
-     * Instantiate a new Test object from the provided test factory.
-     */
-    Test* makeTest() const               { return m_factory->makeTest(); }
+#if EMBTEST_HAS_PERF_EVENTS
+struct CounterEvent
+{
+    uint32_t    type;
+    uint64_t    config;
+    PerfCounter counter;
+};
 
-  private:
-    std::string      m_suiteName;
-    std::string      m_testName;
-    std::string      m_fullName;
-    TestFactoryBase *m_factory;
-    RegToken         m_token;
-    bool             m_enabled;
+static const CounterEvent s_hardwareEvents[] = {
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES,       CounterCycles },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS,     CounterInstructions },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES,    CounterBranchMisses },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES,     CounterCacheMisses },
+};
 
-    RunState         m_runstate;
+static const CounterEvent s_softwareEvents[] = {
+    { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK,       CounterTaskClock },
+    { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS,      CounterPageFaults },
+    { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES, CounterContextSwitches },
 };
 
 /**
- * The TestRegistrar is the central registry of the testsuites
- * and tests, and provides access to the test factories, test
- * states, test control, etc.
- *
- * Tests are registered via the registerTest() framework
- * function, invoked by a BTEST() declaration and handled during
- * static initialization.
+ * A CounterGroup counts events of the calling thread in user
+ * space, as one perf_event_open() group, so they are enabled,
+ * disabled and read together. An event the kernel refuses is left
+ * out; if it refuses the first, the group stays empty.
  */
-class TestRegistrar
+class CounterGroup
 {
   public:
-    TestRegistrar() {}
-
-    ~TestRegistrar()
-    {
-        for (size_t i=0; i < m_alltests.size(); ++i)
-            delete m_alltests[i];
-    }
+    CounterGroup()
+        : m_count(0)
+    { }
 
-    /**
-     * Return the total number of defined tests.
-     */
-    size_t getTestCount() const
+    ~CounterGroup()
     {
-        return m_alltests.size();
+        for (size_t i=0; i < m_count; ++i)
+            ::close(m_fds[i]);
     }
 
-    /**
-     * Count and return the number of disabled tests.
-     */
-    size_t getDisabledTestCount() const
+    void open(CounterEvent const *events, size_t count)
     {
-        size_t count = 0ul;
-        for (size_t i=0; i < m_alltests.size(); ++i)
+        for (size_t i=0; i < count && m_count < MaxEvents; ++i)
         {
-            if (! m_alltests[i]->enabled())
-                count++;
+            struct perf_event_attr attr;
+            std::memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = events[i].type;
+            attr.config = events[i].config;
+            attr.disabled = m_count == 0;           // the leader starts the group
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_GROUP |
+                               PERF_FORMAT_TOTAL_TIME_ENABLED |
+                               PERF_FORMAT_TOTAL_TIME_RUNNING;
+            int leader = m_count > 0 ? m_fds[0] : -1;
+            int fd = static_cast<int>(::syscall(SYS_perf_event_open, &attr, 0, -1, leader, 0));
+            if (fd < 0)
+            {
+                if (m_count == 0)
+                    return;
+                continue;
+            }
+            m_fds[m_count] = fd;
+            m_counters[m_count] = events[i].counter;
+            m_count++;
         }
-        return count;
     }
 
-    /**
-     * Count and return the number of failed tests.
-     */
-    size_t getFailedTestCount() const
+    void start()
     {
-        size_t count = 0ul;
-        for (size_t i=0; i < m_alltests.size(); ++i)
-        {
-            if (m_alltests[i]->runstate() == RegisteredTest::FAILED)
-                count++;
-        }
-        return count;
+        if (m_count == 0)
+            return;
+        ::ioctl(m_fds[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ::ioctl(m_fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
     }
 
-    /**
-     * Report the test names that failed
+    /*
+     * Stop counting, and store the values in \c counters, scaled up
+     * if the kernel had to multiplex the counters.
      */
-    void reportFailedTests(std::ostream &out) const
+    void stop(PerfCounters &counters)
     {
-        out << "[--------]" << std::endl;
-        for (size_t i=0; i < m_alltests.size(); ++i)
+        if (m_count == 0)
+            return;
+        ::ioctl(m_fds[0], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+
+        // nr, time enabled, time running, then one value per event
+        uint64_t data[3 + MaxEvents];
+        ssize_t size = ::read(m_fds[0], data, sizeof(data));
+        if (size < static_cast<ssize_t>((3 + m_count) * sizeof(uint64_t)) || data[2] == 0)
+            return;
+        double scale = static_cast<double>(data[1]) / static_cast<double>(data[2]);
+        for (size_t i=0; i < m_count; ++i)
         {
-            if (m_alltests[i]->runstate() == RegisteredTest::FAILED)
-                out << "[ FAILED ] " << m_alltests[i]->fullName() << std::endl;
+            counters.values[m_counters[i]] = static_cast<uint64_t>(data[3 + i] * scale + 0.5);
+            counters.measured |= 1u << m_counters[i];
         }
-        out << "[--------]" << std::endl;
     }
 
-    /**
-     * Instantiate and run the test at index \c which.
-     */
-    void runTest(size_t which, std::ostream &out)
+  private:
+    CounterGroup(CounterGroup const &) = delete;
+    CounterGroup& operator=(CounterGroup const &) = delete;
+
+    static const size_t MaxEvents = 4;
+
+    size_t      m_count;
+    int         m_fds[MaxEvents];
+    PerfCounter m_counters[MaxEvents];
+};
+#endif // EMBTEST_HAS_PERF_EVENTS
+
+/**
+ * TestCounters counts the events of a test body into \c counters
+ * between start() and stop(), if \c enabled. The counters are
+ * opened on construction and closed on destruction, outside of
+ * the counted and timed span.
+ */
+class TestCounters
+{
+  public:
+    TestCounters(PerfCounters &counters, bool enabled)
+        : m_counters(counters)
     {
-        if (which >= m_alltests.size())
+        m_counters = PerfCounters();
+#if EMBTEST_HAS_PERF_EVENTS
+        if (!enabled)
             return;
+        m_hardware.open(s_hardwareEvents, sizeof(s_hardwareEvents) / sizeof(s_hardwareEvents[0]));
+        m_software.open(s_softwareEvents, sizeof(s_softwareEvents) / sizeof(s_softwareEvents[0]));
+#else
+        (void)enabled;
+#endif
+    }
 
-        RegisteredTest *rt = m_alltests[which];
+    void start()
+    {
+#if EMBTEST_HAS_PERF_EVENTS
+        m_hardware.start();
+        m_software.start();
+#endif
+    }
 
-        /*
-         * Only run if enabled. If disabled, just ignore it.
-         */
-        if (rt->enabled())
-        {
-            out << "[--------] " << rt->fullName() << std::endl;
-            out << "[running ]" << std::endl;
+    void stop()
+    {
+#if EMBTEST_HAS_PERF_EVENTS
+        m_software.stop(m_counters);
+        m_hardware.stop(m_counters);
+#endif
+    }
 
-            /*
-             * Test instance lifetime: ctor,SetUp,TestBody,TearDown,dtor
-             */
-            Test *testInstance = rt->makeTest();
-            rt->setRunstate(RegisteredTest::PASSED);
-            testInstance->SetUp();
-            try {
-                testInstance->TestBody();
-            }
-            catch (std::exception &e)
-            {
-                rt->setRunstate(RegisteredTest::FAILED);
-                out << "[EXCEPTED] Exception: " << e.what() << std::endl;
-            }
-            catch (...)
-            {
-                rt->setRunstate(RegisteredTest::FAILED);
-                out << "[EXCEPTED] Unknown Exception" << std::endl;
-            }
+  private:
+    TestCounters(TestCounters const &) = delete;
+    TestCounters& operator=(TestCounters const &) = delete;
 
-            testInstance->TearDown();
-            delete testInstance;
+    PerfCounters &m_counters;
+#if EMBTEST_HAS_PERF_EVENTS
+    CounterGroup  m_hardware;
+    CounterGroup  m_software;
+#endif
+};
 
-            /*
-             * Report final test state
-             */
-            switch (rt->runstate()) {
-                case RegisteredTest::PASSED:
-                    out << "[ PASSED ] " << rt->fullName() << std::endl;
-                    break;
-                case RegisteredTest::FAILED:
-                    out << "[ FAILED ] " << rt->fullName() << std::endl;
-                    break;
-                default:
-                    out << "[UNKNOWN ] " << rt->fullName() << std::endl;
-            }
-        }
-    }
+class TestCapture;
+
+/**
+ * A RegisteredTest contains the run state of a test, and refers
+ * to the test's static TestRegistration for its name, the name of
+ * the suite it belongs to, and how to create it.
+ */
+class RegisteredTest
+{
+  public:
+    RegisteredTest(TestRegistration const *registration, RegToken token)
+        : m_registration(registration)
+        , m_suiteName(registration->suiteName)
+        , m_testName(registration->testName)
+        , m_params(0)
+        , m_paramIndex(0)
+        , m_paramTest(0)
+        , m_token(token)
+        , m_enabled(true)
+        , m_selected(true)
+        , m_suite(0)
+        , m_runstate(NOTRUN)
+        , m_capture(0)
+    { }
 
     /*
-     * Given the suitename, testname, and test class factory,
-     * register a new test into the framework.
-     * Return the test's token on exit.
+     * Define various property accessors:
      */
-    RegToken registerTest(std::string suite, std::string name, TestFactoryBase *factory)
-    {
-        // Create the test, enable it, and assign its token
-        RegisteredTest *rt = new RegisteredTest(suite, name, factory);
-        rt->enable();
-        rt->setToken( static_cast<RegToken>(m_alltests.size()) );
+    char const* suiteName() const        { return m_suiteName; }
+    char const* testName() const         { return m_testName; }
 
-        // Disable the test if named DISABLED_restOfTestName
-        if (name.substr(0,9) == std::string("DISABLED_"))
-            rt->disable();
+    TestInfo info() const
+    {
+        TestInfo info = { suiteName(), testName() };
+        return info;
+    }
 
-        // Save it in our list and return the token
-        m_alltests.push_back(rt);
-        return rt->token();
+    std::string fullName() const
+    {
+        return std::string(suiteName()) + "." + testName();
     }
 
+    TestKind kind() const                { return m_registration->kind; }
+    bool isBenchmark() const             { return kind() == KindBenchmark; }
+
+    RegToken token() const               { return m_token; }
+
     /*
-     * Record that a test has failed at least one condition.
+     * Name the suite of a typed test, which differs per type.
      */
-    void recordTestFailure(RegToken token)
+    void setSuiteName(char const *name)  { m_suiteName = name; }
+
+    /*
+     * Make this test case \c index of the parameterized test with
+     * token \c paramTest, named \c name, with its parameter value
+     * from \c params.
+     */
+    void setParamCase(ParamInstantiation const *params, size_t index, char const *name,
+                      RegToken paramTest)
     {
-        size_t which = static_cast<size_t>(token);
+        m_params = params;
+        m_paramIndex = index;
+        m_testName = name;
+        m_paramTest = paramTest;
+    }
 
-        if (which >= m_alltests.size())
-            return;                         // TODO: report or throw here
+    /*
+     * The token of the TEST_P() this is a case of, or 0.
+     */
+    RegToken paramTest() const           { return m_paramTest; }
 
-        m_alltests[which]->setRunstate(RegisteredTest::FAILED);
+    /*
+     * The position of the test's suite in the registrar's suite
+     * index, and the suite's static setup and teardown.
+     */
+    void setSuite(size_t suite)          { m_suite = suite; }
+    size_t suite() const                 { return m_suite; }
+
+    typedef void (*SuiteFunction)();
+    SuiteFunction setUpSuite() const     { return m_registration->setUpSuite; }
+    SuiteFunction tearDownSuite() const  { return m_registration->tearDownSuite; }
+
+    void enable()                        { m_enabled = true; }
+    void disable()                       { m_enabled = false; }
+    bool enabled() const                 { return m_enabled; }
+
+    /*
+     * A test is selected when it belongs to this run, e.g. to
+     * this shard. Unselected tests are neither run nor counted.
+     */
+    void setSelected(bool selected)      { m_selected = selected; }
+    bool selected() const                { return m_selected; }
+
+    /*
+     * The run state may be updated from the worker thread running
+     * the test while other workers read their own tests' states,
+     * so it is kept atomic.
+     */
+    enum RunState {NOTRUN, PASSED, FAILED};
+    void setRunstate(RunState rs)        { m_runstate.store(rs, std::memory_order_relaxed); }
+    RunState runstate() const            { return m_runstate.load(std::memory_order_relaxed); }
+
+    /*
+     * The capture of the test's output while it runs, so that
+     * failures reported on other threads reach it.
+     */
+    void setCapture(TestCapture *capture) { m_capture.store(capture, std::memory_order_release); }
+    TestCapture* capture() const         { return m_capture.load(std::memory_order_acquire); }
+
+    /**
+     * Instantiate a new Test object from the registered factory.
+     * A parameterized case gets its parameter value here.
+     */
+    Test* makeTest() const
+    {
+        if (m_params)
+            return m_params->create(m_registration->create, m_paramIndex);
+        return m_registration->create();
     }
 
+    /*
+     * Measurements of a benchmark, valid after it has run.
+     */
+    BenchmarkStats& benchmarkStats()              { return m_benchmarkStats; }
+    BenchmarkStats const& benchmarkStats() const  { return m_benchmarkStats; }
+
+    /*
+     * Time spent in each phase of the test, valid after it has run.
+     */
+    TestTiming& timing()                 { return m_timing; }
+    TestTiming const& timing() const     { return m_timing; }
+
+    /*
+     * Event counts of the test body, valid after it has run.
+     */
+    PerfCounters& counters()             { return m_counters; }
+
   private:
-    std::vector<RegisteredTest*> m_alltests; // just a flat list to start
-};
+    TestRegistration const *m_registration;
+    char const      *m_suiteName;
+    char const      *m_testName;
+    ParamInstantiation const *m_params;     ///< of a parameterized case, or null
+    size_t           m_paramIndex;
+    RegToken         m_paramTest;
+    RegToken         m_token;
+    bool             m_enabled;
+    bool             m_selected;
+    size_t           m_suite;
 
-/*
- * The embtest::s_outstream allows all test output to be
- * redirected at runtime.
- */
-static std::ostream *s_outstream = &std::cout;
+    std::atomic<RunState> m_runstate;
+    std::atomic<TestCapture*> m_capture;
 
-std::ostream& getOutstream()
-{
-    return *s_outstream;
-}
+    BenchmarkStats   m_benchmarkStats;
+    TestTiming       m_timing;
+    PerfCounters     m_counters;
+};
 
 /*
- * The TestRegistrar instance must be constructed during
- * static initialization (before main is called). By
- * dynamically allocating it, we do not rely on static
- * initialization order, but create it on demand at first use.
+ * The options of the current run, set by runAndReport().
  */
-static TestRegistrar *s_testRegistrar = 0;
+static RunOptions s_runOptions;
 
 /*
- * ::registerTest() is a forwarding function to the actual
- * registrar object. Since we don't have total control over
- * static initialization order due to linkage ordering, this
- * function does two things: it ensures the registrar object is
- * created by explicitly creating one, then forwards the test
- * registration to it. This way, linkage order doesn't matter.
+ * Allocation accounting. A thread running a test claims one of the
+ * slots, and counts the allocations it makes while the test's
+ * instance exists. Each counted block is tagged with its slot and
+ * the slot's generation, so when it's freed, later or on another
+ * thread, it still comes off the live bytes of the test that
+ * allocated it. Blocks freed after their test ended are ignored.
  */
-RegToken registerTest(char const *suitename, char const *testname, TestFactoryBase *factory)
+struct AllocationSlot
 {
-    if (!suitename || !testname || !factory)
-    {
-        throw std::exception();
-    }
+    std::atomic<bool>     busy;
+    std::atomic<uint32_t> generation;   ///< 24 bits, bumped per test
+    std::atomic<int64_t>  liveBytes;
+    std::atomic<int64_t>  liveBlocks;
 
-    if (!s_testRegistrar)
-    {
-        s_testRegistrar = new TestRegistrar();
-    }
+    // Only used by the thread that claimed the slot:
+    bool                  counting;
+    uint64_t              allocations;
+    uint64_t              bytes;
+    int64_t               peakBytes;
+};
 
-    RegToken token = s_testRegistrar->registerTest(suitename, testname, factory);
-    return token;
-}
+static const unsigned AllocationSlotCount = 64;
+static const uint32_t AllocationGenerationMask = 0xffffff;
 
-/**
- * This function records that a test fails. When a test is started,
- * it is assumed to pass. At any point, a failure may be detected
- * which is marked by recordTestFailure(). This becomes a sticky state.
- *
- * This is a forwarding function to the registrar singleton.
- */
-void recordTestFailure(RegToken token)
+// Zero-initialized, so allocations during static initialization are safe.
+static AllocationSlot s_allocationSlots[AllocationSlotCount];
+static std::atomic<bool> s_allocationsTracked(false);
+static EMBTEST_THREAD_LOCAL AllocationSlot *t_allocationSlot = 0;
+
+AllocationTag noteAllocation(size_t size)
 {
+    if (!s_allocationsTracked.load(std::memory_order_relaxed))
+        s_allocationsTracked.store(true, std::memory_order_relaxed);
+
+    AllocationSlot *slot = t_allocationSlot;
+    if (!slot || !slot->counting)
+        return 0;
 
-    s_testRegistrar->recordTestFailure(token);
+    int64_t bytes = static_cast<int64_t>(size);
+    int64_t live = slot->liveBytes.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+    slot->liveBlocks.fetch_add(1, std::memory_order_relaxed);
+    slot->allocations++;
+    slot->bytes += size;
+    if (live > slot->peakBytes)
+        slot->peakBytes = live;
+
+    uint32_t index = static_cast<uint32_t>(slot - s_allocationSlots);
+    return (slot->generation.load(std::memory_order_relaxed) << 8) | (index + 1);
 }
 
-/**
- * forceFailure allows a test to force a failure outside of
- * a normal BTest assertion.
- */
-std::ostream& forceFailure(int line, char const* file, RegToken token)
+void noteDeallocation(size_t size, AllocationTag tag)
 {
-    getOutstream()
-        << "Failure: (line " << line << ") " << file << std::endl;
-    recordTestFailure(token);
-    return getOutstream();
+    if (tag == 0 || (tag & 0xff) > AllocationSlotCount)
+        return;
+
+    AllocationSlot &slot = s_allocationSlots[(tag & 0xff) - 1];
+    if (slot.generation.load(std::memory_order_relaxed) != (tag >> 8))
+        return;
+    slot.liveBytes.fetch_sub(static_cast<int64_t>(size), std::memory_order_relaxed);
+    slot.liveBlocks.fetch_sub(1, std::memory_order_relaxed);
 }
 
 /**
- * Provide a basic function to run everything
+ * An AllocationTracker claims a slot for the test run on this
+ * thread for its lifetime. Counting is turned on and off within
+ * that with countAllocations().
  */
-int runAndReport(std::ostream &out)
+class AllocationTracker
 {
-    s_outstream = &out;
+  public:
+    AllocationTracker()
+        : m_slot(0)
+    {
+        for (unsigned i=0; i < AllocationSlotCount && !m_slot; ++i)
+        {
+            bool idle = false;
+            if (s_allocationSlots[i].busy.compare_exchange_strong(idle, true))
+                m_slot = &s_allocationSlots[i];
+        }
+        if (!m_slot)
+            return;                 // more threads than slots; not counted
 
-    out
-        << "Tests starting. " << embtest::s_testRegistrar->getTestCount() << " tests to run"
-        << std::endl;
+        uint32_t generation = m_slot->generation.load(std::memory_order_relaxed);
+        m_slot->generation.store((generation + 1) & AllocationGenerationMask);
+        m_slot->liveBytes.store(0);
+        m_slot->liveBlocks.store(0);
+        m_slot->counting = false;
+        m_slot->allocations = 0;
+        m_slot->bytes = 0;
+        m_slot->peakBytes = 0;
+        t_allocationSlot = m_slot;
+    }
 
-    size_t testCount = embtest::s_testRegistrar->getTestCount();
-    for (size_t i=0ul; i<testCount; ++i)
+    ~AllocationTracker()
     {
-        embtest::s_testRegistrar->runTest(i, out);
+        if (!m_slot)
+            return;
+        t_allocationSlot = 0;
+        m_slot->counting = false;
+        uint32_t generation = m_slot->generation.load(std::memory_order_relaxed);
+        m_slot->generation.store((generation + 1) & AllocationGenerationMask);
+        m_slot->busy.store(false);
     }
 
-    size_t failedCount = embtest::s_testRegistrar->getFailedTestCount();
-    size_t disabledCount = embtest::s_testRegistrar->getDisabledTestCount();
-    size_t passedCount = testCount - disabledCount - failedCount;
+    AllocationStats stats() const
+    {
+        AllocationStats stats;
+        if (m_slot && s_allocationsTracked.load(std::memory_order_relaxed))
+        {
+            stats.tracked = true;
+            stats.allocations = m_slot->allocations;
+            stats.bytes = m_slot->bytes;
+            stats.peakBytes = static_cast<uint64_t>(m_slot->peakBytes);
+        }
+        return stats;
+    }
+
+    /*
+     * The blocks, and their bytes, counted and not yet freed.
+     */
+    int64_t liveBlocks() const { return m_slot ? m_slot->liveBlocks.load() : 0; }
+    int64_t liveBytes() const  { return m_slot ? m_slot->liveBytes.load() : 0; }
+
+  private:
+    AllocationTracker(AllocationTracker const &) = delete;
+    AllocationTracker& operator=(AllocationTracker const &) = delete;
 
-    out << "[  DONE  ]" << std::endl;
+    AllocationSlot *m_slot;
+};
 
-    if (failedCount > 0)
-        embtest::s_testRegistrar->reportFailedTests(out);
+/*
+ * Count this thread's allocations against its test, or stop.
+ */
+static void countAllocations(bool counting)
+{
+    if (t_allocationSlot)
+        t_allocationSlot->counting = counting;
+}
 
-    out << "-- Test results --" << std::endl
-        << " Total tests: " << testCount << std::endl
-        << " Disabled:    " << disabledCount << std::endl
-        << " Failed:      " << failedCount << std::endl
-        << " Passed:      " << passedCount << std::endl;
+/**
+ * PausedAllocations keeps the framework's own allocations, e.g.
+ * for delivering a failure, from counting against the test.
+ */
+class PausedAllocations
+{
+  public:
+    PausedAllocations()
+        : m_counting(t_allocationSlot && t_allocationSlot->counting)
+    {
+        countAllocations(false);
+    }
+
+    ~PausedAllocations()
+    {
+        countAllocations(m_counting);
+    }
+
+  private:
+    bool m_counting;
+};
+
+/**
+ * A ThreadCapture collects the failures reported by one thread
+ * other than the one running the test, e.g. a helper thread the
+ * test body starts. The thread writes its messages here without
+ * any lock, and the test's TestCapture delivers them when the test
+ * ends.
+ */
+struct ThreadCapture
+{
+    explicit ThreadCapture(ThreadCapture *next_)
+        : next(next_)
+        , pending(false)
+        , kind(FailureAssertion)
+        , file(0)
+        , line(0)
+    { }
+
+    /**
+     * Complete the pending failure's message, if any.
+     */
+    void finishFailure()
+    {
+        if (!pending)
+            return;
+        TestFailure failure;
+        failure.kind = kind;
+        failure.file = file;
+        failure.line = line;
+        failure.message = stream.str();
+        failures.push_back(failure);
+        stream.str(std::string());
+        pending = false;
+    }
+
+    ThreadCapture           *next;
+    std::vector<TestFailure> failures;
+    std::ostringstream       stream;
+    bool                     pending;
+    FailureKind              kind;
+    char const              *file;
+    int                      line;
+};
+
+/*
+ * The ThreadCapture this thread last wrote to, and the serial
+ * number of the TestCapture it belongs to. The capture is only
+ * used while that TestCapture is still collecting.
+ */
+static EMBTEST_THREAD_LOCAL ThreadCapture *t_threadCapture = 0;
+static EMBTEST_THREAD_LOCAL uint64_t t_threadCaptureSerial = 0;
+static std::atomic<uint64_t> s_captureSerial(0);
+
+/**
+ * A TestCapture collects the output of the running test, i.e.
+ * assertion failures and FAIL() messages, and passes it on to the
+ * reporters as events. A failure message is complete, and is
+ * delivered, when the next failure begins or the test ends.
+ * Failures reported on other threads are collected per thread,
+ * and delivered when the test ends.
+ */
+class TestCapture
+{
+  public:
+    TestCapture(Reporter &events, TestInfo const &test, RegToken token)
+        : m_events(events)
+        , m_test(test)
+        , m_token(token)
+        , m_pending(false)
+        , m_kind(FailureAssertion)
+        , m_file(0)
+        , m_line(0)
+        , m_serial(s_captureSerial.fetch_add(1, std::memory_order_relaxed) + 1)
+        , m_threads(0)
+    { }
+
+    ~TestCapture()
+    {
+        deleteThreadCaptures(m_threads.exchange(0));
+    }
+
+    std::ostream& stream() { return m_stream; }
+    RegToken token() const { return m_token; }
+
+    /**
+     * Deliver what was collected so far, and start collecting the
+     * message of a new failure.
+     */
+    std::ostream& beginFailure(FailureKind kind, char const *file, int line)
+    {
+        flush();
+        m_pending = true;
+        m_kind = kind;
+        m_file = file;
+        m_line = line;
+        return m_stream;
+    }
+
+    /**
+     * Deliver what was collected so far: the pending failure's
+     * message, or plain output written outside of a failure.
+     */
+    void flush()
+    {
+        PausedAllocations paused;
+        std::string text = m_stream.str();
+        m_stream.str(std::string());
+        if (m_pending)
+        {
+            TestFailure failure;
+            failure.kind = m_kind;
+            failure.file = m_file;
+            failure.line = m_line;
+            failure.message = text;
+            m_pending = false;
+            m_events.testFailure(m_test, failure);
+        }
+        else if (!text.empty())
+        {
+            m_events.testOutput(m_test, text);
+        }
+    }
+
+    /**
+     * Start collecting the message of a failure reported on a
+     * thread other than the test's. The thread's ThreadCapture is
+     * pushed on a lock-free list the first time it reports.
+     */
+    std::ostream& beginThreadFailure(FailureKind kind, char const *file, int line)
+    {
+        ThreadCapture *capture = t_threadCapture;
+        if (t_threadCaptureSerial != m_serial)
+        {
+            PausedAllocations paused;
+            capture = new ThreadCapture(m_threads.load(std::memory_order_relaxed));
+            while (!m_threads.compare_exchange_weak(capture->next, capture,
+                                                    std::memory_order_release,
+                                                    std::memory_order_relaxed))
+            { }
+            t_threadCapture = capture;
+            t_threadCaptureSerial = m_serial;
+        }
+        capture->finishFailure();
+        capture->pending = true;
+        capture->kind = kind;
+        capture->file = file;
+        capture->line = line;
+        return capture->stream;
+    }
+
+    /**
+     * Deliver what was collected so far, then the failures of the
+     * other threads, a thread at a time in the order they first
+     * reported. The test must have joined those threads.
+     */
+    void finish()
+    {
+        flush();
+        PausedAllocations paused;
+        ThreadCapture *reversed = 0;
+        ThreadCapture *capture = m_threads.exchange(0, std::memory_order_acquire);
+        while (capture)
+        {
+            ThreadCapture *next = capture->next;
+            capture->next = reversed;
+            reversed = capture;
+            capture = next;
+        }
+        for (capture = reversed; capture; capture = capture->next)
+        {
+            capture->finishFailure();
+            for (size_t i=0; i < capture->failures.size(); ++i)
+                m_events.testFailure(m_test, capture->failures[i]);
+        }
+        deleteThreadCaptures(reversed);
+    }
+
+  private:
+    static void deleteThreadCaptures(ThreadCapture *capture)
+    {
+        while (capture)
+        {
+            ThreadCapture *next = capture->next;
+            delete capture;
+            capture = next;
+        }
+    }
+
+    Reporter          &m_events;
+    TestInfo           m_test;
+    RegToken           m_token;
+    std::ostringstream m_stream;
+    bool               m_pending;
+    FailureKind        m_kind;
+    char const        *m_file;
+    int                m_line;
+    uint64_t           m_serial;    ///< unique per TestCapture, never 0
+
+    std::atomic<ThreadCapture*> m_threads;
+};
+
+/*
+ * The embtest::s_outstream allows all test output to be
+ * redirected at runtime.
+ */
+static std::ostream *s_outstream = &std::cout;
+
+/*
+ * The capture of the test running on this thread, if any. When no
+ * test is running, output goes to s_outstream.
+ */
+static EMBTEST_THREAD_LOCAL TestCapture *t_capture = 0;
+
+/**
+ * ScopedCapture directs this thread's test output to a
+ * TestCapture for the lifetime of the object.
+ */
+class ScopedCapture
+{
+  public:
+    explicit ScopedCapture(TestCapture &capture)
+        : m_previous(t_capture)
+    {
+        t_capture = &capture;
+    }
+
+    ~ScopedCapture()
+    {
+        t_capture = m_previous;
+    }
+
+  private:
+    TestCapture *m_previous;
+};
+
+/**
+ * A TestRecord is a Reporter that keeps the events of one test, so
+ * they can be replayed to the real reporters later, in registration
+ * order. A record can also be serialized, to pass a test's events
+ * from a worker process back to the parent.
+ */
+class TestRecord : public Reporter
+{
+  public:
+    TestRecord()
+        : m_started(false)
+    { }
+
+    virtual void testStarting(TestInfo const &)
+    {
+        m_started = true;
+    }
+
+    virtual void testOutput(TestInfo const &, std::string const &text)
+    {
+        Entry entry;
+        entry.isFailure = false;
+        entry.text = text;
+        m_entries.push_back(entry);
+    }
+
+    virtual void testFailure(TestInfo const &, TestFailure const &failure)
+    {
+        Entry entry;
+        entry.isFailure = true;
+        entry.kind = failure.kind;
+        entry.file = failure.file;
+        entry.line = failure.line;
+        entry.text = failure.message;
+        m_entries.push_back(entry);
+    }
+
+    virtual void testFinished(TestResult const &result)
+    {
+        m_result = result;
+    }
+
+    TestResult const& result() const { return m_result; }
+
+    void swap(TestRecord &other)
+    {
+        std::swap(m_started, other.m_started);
+        m_entries.swap(other.m_entries);
+        std::swap(m_result, other.m_result);
+    }
+
+    /**
+     * Deliver the recorded events to \c events.
+     */
+    void replay(Reporter &events) const
+    {
+        TestInfo const &test = m_result.test;
+        if (m_started)
+            events.testStarting(test);
+        for (size_t i=0; i < m_entries.size(); ++i)
+        {
+            Entry const &entry = m_entries[i];
+            if (!entry.isFailure)
+            {
+                events.testOutput(test, entry.text);
+                continue;
+            }
+            TestFailure failure;
+            failure.kind = entry.kind;
+            failure.file = entry.file;
+            failure.line = entry.line;
+            failure.message = entry.text;
+            events.testFailure(test, failure);
+        }
+        events.testFinished(m_result);
+    }
+
+    /**
+     * Append the record to \c out in a compact binary form. The
+     * test's identity is not included; the reader knows it.
+     */
+    void serialize(std::string &out) const
+    {
+        putValue(out, m_started);
+        putValue(out, static_cast<uint32_t>(m_entries.size()));
+        for (size_t i=0; i < m_entries.size(); ++i)
+        {
+            Entry const &entry = m_entries[i];
+            putValue(out, entry.isFailure);
+            putValue(out, entry.kind);
+            putValue(out, entry.file);
+            putValue(out, entry.line);
+            putString(out, entry.text);
+        }
+        putValue(out, m_result.status);
+        putValue(out, m_result.timing);
+        putValue(out, m_result.benchmark);
+        putValue(out, m_result.allocations);
+        putValue(out, m_result.counters);
+    }
+
+    /**
+     * Read a record written by serialize() for test \c test.
+     * Returns false if \c in is truncated.
+     */
+    bool deserialize(std::string const &in, TestInfo const &test)
+    {
+        size_t pos = 0;
+        uint32_t count = 0;
+        if (!getValue(in, pos, m_started) || !getValue(in, pos, count))
+            return false;
+        m_entries.resize(count);
+        for (size_t i=0; i < m_entries.size(); ++i)
+        {
+            Entry &entry = m_entries[i];
+            if (!getValue(in, pos, entry.isFailure) ||
+                !getValue(in, pos, entry.kind) ||
+                !getValue(in, pos, entry.file) ||
+                !getValue(in, pos, entry.line) ||
+                !getString(in, pos, entry.text))
+                return false;
+        }
+        m_result.test = test;
+        return getValue(in, pos, m_result.status) &&
+               getValue(in, pos, m_result.timing) &&
+               getValue(in, pos, m_result.benchmark) &&
+               getValue(in, pos, m_result.allocations) &&
+               getValue(in, pos, m_result.counters);
+    }
+
+  private:
+    struct Entry
+    {
+        Entry() : isFailure(false), kind(FailureAssertion), file(0), line(0) { }
+
+        bool        isFailure;      ///< a failure, or else plain output
+        FailureKind kind;
+        char const *file;           ///< a __FILE__ literal, or null
+        int         line;
+        std::string text;
+    };
+
+    /*
+     * Fields are copied as raw bytes: the reader is the same
+     * binary, forked from the same process. That includes the
+     * file name pointers, which point to string literals.
+     */
+    template <typename T>
+    static void putValue(std::string &out, T const &value)
+    {
+        out.append(reinterpret_cast<char const*>(&value), sizeof(value));
+    }
+
+    static void putString(std::string &out, std::string const &text)
+    {
+        putValue(out, static_cast<uint32_t>(text.size()));
+        out.append(text);
+    }
+
+    template <typename T>
+    static bool getValue(std::string const &in, size_t &pos, T &value)
+    {
+        if (in.size() - pos < sizeof(value))
+            return false;
+        std::memcpy(&value, in.data() + pos, sizeof(value));
+        pos += sizeof(value);
+        return true;
+    }
+
+    static bool getString(std::string const &in, size_t &pos, std::string &text)
+    {
+        uint32_t length;
+        if (!getValue(in, pos, length) || in.size() - pos < length)
+            return false;
+        text.assign(in, pos, length);
+        pos += length;
+        return true;
+    }
+
+    bool               m_started;
+    std::vector<Entry> m_entries;
+    TestResult         m_result;
+};
+
+/*
+ * Time \c iterations iterations of a benchmark, in nanoseconds.
+ */
+static double timeIterations(Benchmark &bench, uint64_t iterations)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    bench.RunIterations(iterations);
+    std::chrono::steady_clock::time_point stop = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(stop - start).count();
+}
+
+/*
+ * Return the median of \c values, reordering them.
+ */
+static double median(std::vector<double> &values)
+{
+    size_t mid = values.size() / 2;
+    std::nth_element(values.begin(), values.begin() + mid, values.end());
+    double upper = values[mid];
+    if (values.size() % 2 != 0)
+        return upper;
+    double lower = *std::max_element(values.begin(), values.begin() + mid);
+    return (lower + upper) / 2;
+}
+
+/**
+ * Calibrate and time one benchmark. The iteration count grows
+ * until one batch takes at least the target time, then that
+ * batch is timed for each repetition. Results are stored in the
+ * test's BenchmarkStats.
+ */
+static void runBenchmark(Benchmark &bench, RegisteredTest &rt)
+{
+    double targetNs = s_runOptions.benchmarkMinMs * 1e6;
+    unsigned repetitions = std::max(1u, s_runOptions.benchmarkRepetitions);
+
+    uint64_t iterations = 1;
+    for (;;)
+    {
+        double ns = timeIterations(bench, iterations);
+        if (rt.runstate() == RegisteredTest::FAILED)
+            return;
+        if (ns >= targetNs || iterations >= (uint64_t(1) << 40))
+            break;
+
+        // Aim a little past the target; grow at most 10x per step.
+        double scale = ns > 0 ? 1.2 * targetNs / ns : 10.0;
+        scale = std::min(10.0, std::max(2.0, scale));
+        iterations = static_cast<uint64_t>(iterations * scale);
+    }
+
+    std::vector<double> samples;
+    for (unsigned r=0; r < repetitions; ++r)
+    {
+        samples.push_back(timeIterations(bench, iterations) / iterations);
+        if (rt.runstate() == RegisteredTest::FAILED)
+            return;
+    }
+
+    BenchmarkStats &stats = rt.benchmarkStats();
+    stats.iterations = iterations;
+    stats.repetitions = repetitions;
+    stats.min = *std::min_element(samples.begin(), samples.end());
+    stats.max = *std::max_element(samples.begin(), samples.end());
+    stats.median = median(samples);
+    for (size_t i=0; i < samples.size(); ++i)
+        samples[i] = std::fabs(samples[i] - stats.median);
+    stats.mad = median(samples);
+}
+
+/**
+ * A GlobPattern is one compiled pattern of a test filter, where
+ * '*' matches any run of characters and '?' any one character.
+ *
+ * A test's full name is "suite.test" and neither part contains a
+ * dot, so a pattern with a dot is split there, and its halves are
+ * matched against the suite and test names on their own. This
+ * lets a filter skip whole suites, and find a literal suite name
+ * in the suite index. A pattern without a dot is matched against
+ * the full name, which is never built as a string.
+ */
+class GlobPattern
+{
+  public:
+    explicit GlobPattern(std::string const &pattern)
+        : m_pattern(pattern)
+        , m_dot(pattern.find('.'))
+        , m_literalSuite(false)
+        , m_anyTest(false)
+    {
+        if (m_dot != std::string::npos)
+        {
+            m_literalSuite = pattern.find_first_of("*?") >= m_dot;
+            m_anyTest = pattern.compare(m_dot + 1, std::string::npos, "*") == 0;
+        }
+    }
+
+    /** The pattern has separate suite and test halves. */
+    bool isSplit() const { return m_dot != std::string::npos; }
+
+    /** The suite half has no wildcards. */
+    bool hasLiteralSuite() const { return m_literalSuite; }
+
+    /** The test half is "*", matching every test of a suite. */
+    bool matchesAnyTest() const { return m_anyTest; }
+
+    std::string suiteName() const { return m_pattern.substr(0, m_dot); }
+
+    bool matchesSuite(char const *suite) const
+    {
+        Text text = { suite, std::strlen(suite), 0, 0 };
+        return match(m_pattern.data(), m_dot, text);
+    }
+
+    /** Match the test half; the suite is assumed to match. */
+    bool matchesTest(char const *test) const
+    {
+        Text text = { test, std::strlen(test), 0, 0 };
+        return match(m_pattern.data() + m_dot + 1, m_pattern.size() - m_dot - 1, text);
+    }
+
+    bool matches(char const *suite, char const *test) const
+    {
+        if (isSplit())
+            return matchesSuite(suite) && (m_anyTest || matchesTest(test));
+
+        Text text = { suite, std::strlen(suite), test, std::strlen(test) };
+        return match(m_pattern.data(), m_pattern.size(), text);
+    }
+
+  private:
+    /*
+     * The text being matched: one name, or a suite and test name
+     * read as if joined by a dot.
+     */
+    struct Text
+    {
+        char const *first;
+        size_t      firstLength;
+        char const *second;         ///< null for one name
+        size_t      secondLength;
+
+        size_t size() const
+        {
+            return second ? firstLength + 1 + secondLength : firstLength;
+        }
+
+        char operator[](size_t i) const
+        {
+            if (i < firstLength)
+                return first[i];
+            return i == firstLength ? '.' : second[i - firstLength - 1];
+        }
+    };
+
+    /*
+     * Iterative glob match, backtracking only to the last '*'.
+     */
+    static bool match(char const *pattern, size_t length, Text const &text)
+    {
+        size_t p = 0, t = 0;
+        size_t starP = std::string::npos, starT = 0;
+        size_t size = text.size();
+        while (t < size)
+        {
+            if (p < length && (pattern[p] == '?' || pattern[p] == text[t]))
+            {
+                ++p;
+                ++t;
+            }
+            else if (p < length && pattern[p] == '*')
+            {
+                starP = p++;
+                starT = t;
+            }
+            else if (starP != std::string::npos)
+            {
+                p = starP + 1;
+                t = ++starT;
+            }
+            else
+                return false;
+        }
+        while (p < length && pattern[p] == '*')
+            ++p;
+        return p == length;
+    }
+
+    std::string m_pattern;
+    size_t      m_dot;              ///< position of the dot, or npos
+    bool        m_literalSuite;
+    bool        m_anyTest;
+};
+
+/**
+ * A TestFilter selects tests by name. The filter is a list of
+ * patterns separated by ':'. A test is selected if it matches a
+ * positive pattern, or if there are none, and matches no negative
+ * pattern. A pattern starting with '-' starts the negative
+ * patterns, e.g. "Suite.*:-Suite.slow*".
+ */
+class TestFilter
+{
+  public:
+    explicit TestFilter(std::string const &filter)
+    {
+        bool negative = false;
+        size_t begin = 0;
+        while (begin <= filter.size())
+        {
+            size_t end = filter.find(':', begin);
+            if (end == std::string::npos)
+                end = filter.size();
+            std::string pattern = filter.substr(begin, end - begin);
+            if (!pattern.empty() && pattern[0] == '-')
+            {
+                negative = true;
+                pattern.erase(0, 1);
+            }
+            if (!pattern.empty())
+                (negative ? m_negative : m_positive).push_back(GlobPattern(pattern));
+            begin = end + 1;
+        }
+    }
+
+    std::vector<GlobPattern> const& positive() const { return m_positive; }
+    std::vector<GlobPattern> const& negative() const { return m_negative; }
+
+  private:
+    std::vector<GlobPattern> m_positive;
+    std::vector<GlobPattern> m_negative;
+};
+
+#if EMBTEST_HAS_THREADS
+/**
+ * A WorkQueue holds the test indices assigned to one worker
+ * thread. The owning worker takes from the front, preserving
+ * registration order, while idle workers steal from the back.
+ */
+class WorkQueue
+{
+  public:
+    void push(size_t which)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_items.push_back(which);
+    }
+
+    bool pop(size_t &which)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_items.empty())
+            return false;
+        which = m_items.front();
+        m_items.pop_front();
+        return true;
+    }
+
+    bool steal(size_t &which)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_items.empty())
+            return false;
+        which = m_items.back();
+        m_items.pop_back();
+        return true;
+    }
+
+  private:
+    std::mutex         m_mutex;
+    std::deque<size_t> m_items;
+};
+#endif // EMBTEST_HAS_THREADS
+
+/**
+ * An OrderedReplay collects the records of tests that complete in
+ * any order, and replays them to the reporters in registration
+ * order as soon as each leading test is complete. Reporters see
+ * one test's events at a time.
+ */
+class OrderedReplay
+{
+  public:
+    OrderedReplay(size_t count, Reporter &events)
+        : m_events(events)
+        , m_records(count)
+        , m_complete(count, false)
+        , m_next(0)
+    { }
+
+    void complete(size_t position, TestRecord &record)
+    {
+#if EMBTEST_HAS_THREADS
+        std::lock_guard<std::mutex> lock(m_mutex);
+#endif
+        m_records[position].swap(record);
+        m_complete[position] = true;
+        while (m_next < m_records.size() && m_complete[m_next])
+        {
+            m_records[m_next].replay(m_events);
+            TestRecord().swap(m_records[m_next]);
+            m_next++;
+        }
+    }
+
+  private:
+    Reporter                &m_events;
+#if EMBTEST_HAS_THREADS
+    std::mutex               m_mutex;
+#endif
+    std::vector<TestRecord>  m_records;
+    std::vector<bool>        m_complete;
+    size_t                   m_next;
+};
+
+#if EMBTEST_HAS_FORK
+/*
+ * Read or write exactly \c size bytes on a pipe, retrying on
+ * interruption and short transfers. Return false on EOF or error.
+ */
+static bool readFully(int fd, void *data, size_t size)
+{
+    char *p = static_cast<char*>(data);
+    while (size > 0)
+    {
+        ssize_t n = ::read(fd, p, size);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p += n;
+        size -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+static bool writeFully(int fd, void const *data, size_t size)
+{
+    char const *p = static_cast<char const*>(data);
+    while (size > 0)
+    {
+        ssize_t n = ::write(fd, p, size);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p += n;
+        size -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+/**
+ * A WorkerProcess is the parent's view of one forked worker.
+ * The parent sends a test index over the task pipe when the
+ * worker is idle, and the worker answers with the length of
+ * the test's serialized TestRecord, followed by the record.
+ * When a test hangs, the worker writes the backtraces of its
+ * threads to the dump pipe.
+ */
+struct WorkerProcess
+{
+    pid_t  pid;
+    int    taskFd;       ///< parent writes test indices here
+    int    resultFd;     ///< parent reads result records here
+    int    dumpFd;       ///< parent reads backtraces here
+    size_t position;     ///< position of the test in flight
+    bool   busy;         ///< a test is in flight
+    std::chrono::steady_clock::time_point started;  ///< of the test in flight
+};
+#endif // EMBTEST_HAS_FORK
+
+#if EMBTEST_HAS_BACKTRACE
+/*
+ * Hang diagnostics: the backtrace of every thread of the process,
+ * written to s_dumpFd. A dump is requested by sending the process
+ * EMBTEST_DUMP_SIGNAL. The thread that takes the signal sends it
+ * again to each other thread alone, in turn, and waits for that
+ * thread to write its own backtrace. Little of this is strictly
+ * async-signal-safe, which is accepted in a process that is stuck
+ * and about to be killed.
+ */
+static int s_dumpFd = 2;
+static std::atomic<long> s_dumpingThread(0);    ///< thread asked to dump itself
+static char const s_dumpEnd[] = "-- end of backtraces --\n";
+
+static long currentThreadId()
+{
+    return static_cast<long>(::syscall(SYS_gettid));
+}
+
+static void writeText(int fd, char const *text)
+{
+    (void)writeFully(fd, text, std::strlen(text));
+}
+
+static void dumpThisThread(int fd)
+{
+    char header[64];
+    std::snprintf(header, sizeof(header), "Thread %ld:\n", currentThreadId());
+    writeText(fd, header);
+
+    void *frames[64];
+    int depth = ::backtrace(frames, 64);
+    ::backtrace_symbols_fd(frames, depth, fd);
+}
+
+/*
+ * Write the backtraces of the other threads, and of this one if
+ * \c includeSelf, followed by s_dumpEnd.
+ */
+static void dumpAllThreads(int fd, bool includeSelf)
+{
+    long self = currentThreadId();
+    if (DIR *tasks = ::opendir("/proc/self/task"))
+    {
+        while (struct dirent *entry = ::readdir(tasks))
+        {
+            long tid = std::strtol(entry->d_name, 0, 10);
+            if (tid <= 0 || tid == self)
+                continue;
+
+            s_dumpingThread.store(tid);
+            if (::syscall(SYS_tgkill, ::getpid(), tid, EMBTEST_DUMP_SIGNAL) == 0)
+            {
+                // A thread blocking the signal gets a second to answer.
+                for (int i=0; i < 1000 && s_dumpingThread.load() == tid; ++i)
+                    ::usleep(1000);
+            }
+            s_dumpingThread.store(0);
+        }
+        ::closedir(tasks);
+    }
+    if (includeSelf)
+        dumpThisThread(fd);
+    writeText(fd, s_dumpEnd);
+}
+
+static void onDumpSignal(int, siginfo_t *info, void *)
+{
+    int savedErrno = errno;
+    if (info->si_code == SI_TKILL)
+    {
+        // Sent to this thread by dumpAllThreads(); ignore it if late.
+        if (s_dumpingThread.load() == currentThreadId())
+        {
+            dumpThisThread(s_dumpFd);
+            s_dumpingThread.store(0);
+        }
+    }
+    else
+    {
+        dumpAllThreads(s_dumpFd, true);
+    }
+    errno = savedErrno;
+}
+
+/*
+ * Answer EMBTEST_DUMP_SIGNAL with a dump of all threads to \c fd.
+ */
+static void installDumpHandler(int fd)
+{
+    s_dumpFd = fd;
+
+    // The first backtrace() loads the unwinder; do it now, not in the handler.
+    void *frame;
+    (void)::backtrace(&frame, 1);
+
+    struct sigaction action;
+    std::memset(&action, 0, sizeof(action));
+    action.sa_sigaction = onDumpSignal;
+    action.sa_flags = SA_SIGINFO | SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    ::sigaction(EMBTEST_DUMP_SIGNAL, &action, 0);
+}
+#endif // EMBTEST_HAS_BACKTRACE
+
+#if EMBTEST_HAS_THREADS || EMBTEST_HAS_FORK
+static long long toMs(std::chrono::steady_clock::duration duration)
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(duration).count();
+}
+#endif
+
+#if EMBTEST_HAS_THREADS
+/**
+ * The Watchdog enforces the timeouts of a run in this process.
+ * Running tests are registered with their start time, and a thread
+ * checks them periodically. When a test overruns the test timeout,
+ * or the run its own, the stuck tests are reported on stderr with
+ * the backtrace of every thread and marked failed. A test that
+ * doesn't return can't be abandoned, so \c abort then reports the
+ * state of the run, and the process exits.
+ */
+class Watchdog
+{
+  public:
+    Watchdog(unsigned testTimeoutMs, unsigned runTimeoutMs, std::function<void()> abort)
+        : m_testTimeout(std::chrono::milliseconds(testTimeoutMs))
+        , m_runTimeout(std::chrono::milliseconds(runTimeoutMs))
+        , m_runStarted(Clock::now())
+        , m_abort(abort)
+        , m_stopping(false)
+    {
+#if EMBTEST_HAS_BACKTRACE
+        installDumpHandler(2);
+#endif
+        m_thread = std::thread([this]() { watch(); });
+    }
+
+    ~Watchdog()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stopping = true;
+        }
+        m_wake.notify_one();
+        m_thread.join();
+    }
+
+    void testStarted(RegisteredTest &rt)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        Running running = { &rt, Clock::now() };
+        m_running.push_back(running);
+    }
+
+    void testFinished(RegisteredTest &rt)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (size_t i=0; i < m_running.size(); ++i)
+        {
+            if (m_running[i].test == &rt)
+            {
+                m_running[i] = m_running.back();
+                m_running.pop_back();
+                break;
+            }
+        }
+    }
+
+  private:
+    typedef std::chrono::steady_clock Clock;
+
+    struct Running
+    {
+        RegisteredTest   *test;
+        Clock::time_point started;
+    };
+
+    void watch()
+    {
+        // Check often enough to catch a hang within a tenth of its timeout.
+        Clock::duration shortest = m_testTimeout;
+        if (shortest.count() == 0 || (m_runTimeout.count() > 0 && m_runTimeout < shortest))
+            shortest = m_runTimeout;
+        Clock::duration period = std::min<Clock::duration>(
+            std::max<Clock::duration>(shortest / 10, std::chrono::milliseconds(1)),
+            std::chrono::milliseconds(100));
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while (!m_stopping)
+        {
+            m_wake.wait_for(lock, period);
+            if (m_stopping)
+                break;
+
+            Clock::time_point now = Clock::now();
+            bool runExpired = m_runTimeout.count() > 0 && now - m_runStarted >= m_runTimeout;
+            std::vector<Running> stuck;
+            for (size_t i=0; i < m_running.size(); ++i)
+            {
+                if (runExpired ||
+                    (m_testTimeout.count() > 0 && now - m_running[i].started >= m_testTimeout))
+                    stuck.push_back(m_running[i]);
+            }
+            if (runExpired || !stuck.empty())
+                expire(stuck, runExpired, now);
+        }
+    }
+
+    /*
+     * Report the hang and end the process. The lock is kept, so
+     * no test is seen to finish meanwhile.
+     */
+    void expire(std::vector<Running> const &stuck, bool runExpired, Clock::time_point now)
+    {
+        if (runExpired)
+            std::cerr << "[TIMEOUT ] The run did not finish within "
+                      << toMs(m_runTimeout) << " ms\n";
+        for (size_t i=0; i < stuck.size(); ++i)
+        {
+            stuck[i].test->setRunstate(RegisteredTest::FAILED);
+            std::cerr << "[TIMEOUT ] " << stuck[i].test->info() << " still running after "
+                      << toMs(now - stuck[i].started) << " ms\n";
+        }
+
+        std::cerr << "-- Backtraces --\n";
+        std::cerr.flush();
+#if EMBTEST_HAS_BACKTRACE
+        dumpAllThreads(2, false);
+#else
+        std::cerr << "Backtraces are not available on this platform.\n";
+#endif
+        m_abort();
+        std::cerr.flush();
+        std::_Exit(1);
+    }
+
+    Clock::duration         m_testTimeout;     ///< 0 for none
+    Clock::duration         m_runTimeout;      ///< 0 for none
+    Clock::time_point       m_runStarted;
+    std::function<void()>   m_abort;
+
+    std::mutex              m_mutex;
+    std::condition_variable m_wake;
+    bool                    m_stopping;
+    std::vector<Running>    m_running;
+    std::thread             m_thread;
+};
+
+/*
+ * The watchdog of the current run, if it runs in this process
+ * and has a timeout.
+ */
+static Watchdog *s_watchdog = 0;
+#endif // EMBTEST_HAS_THREADS
+
+/**
+ * A WatchedTest registers a running test with the watchdog, if
+ * there is one, for its lifetime.
+ */
+class WatchedTest
+{
+  public:
+    explicit WatchedTest(RegisteredTest &rt)
+        : m_test(rt)
+    {
+#if EMBTEST_HAS_THREADS
+        if (s_watchdog)
+            s_watchdog->testStarted(m_test);
+#endif
+    }
+
+    ~WatchedTest()
+    {
+#if EMBTEST_HAS_THREADS
+        if (s_watchdog)
+            s_watchdog->testFinished(m_test);
+#endif
+    }
+
+  private:
+    RegisteredTest &m_test;
+};
+
+/**
+ * The TestRegistrar is the central registry of the testsuites
+ * and tests, and provides access to the test factories, test
+ * states, test control, etc.
+ *
+ * Tests are registered via the registerTest() framework
+ * function, invoked by a BTEST() declaration and handled during
+ * static initialization.
+ */
+class TestRegistrar
+{
+  public:
+    /**
+     * Create the run state of every test in the registration list
+     * starting at \c first, followed by the cases of the
+     * parameterized tests. Tokens are positions in this list.
+     * Tests named DISABLED_restOfTestName are disabled. Typed tests
+     * are in suite "fixture/N" for type N of the fixture's types.
+     */
+    TestRegistrar(TestRegistration const *first,
+                  ParamTestRegistration const *firstParamTest,
+                  ParamInstantiation const *firstInstantiation)
+    {
+        for (TestRegistration const *reg = first; reg; reg = reg->next)
+        {
+            RegisteredTest *rt = new RegisteredTest(reg, static_cast<RegToken>(m_alltests.size()));
+            if (std::strncmp(reg->testName, "DISABLED_", 9) == 0)
+                rt->disable();
+            if (reg->typeIndex > 0)
+            {
+                std::string name = std::string(reg->suiteName) + "/" +
+                    std::to_string(reg->typeIndex - 1);
+                rt->setSuiteName(m_typedSuiteNames.insert(name).first->c_str());
+            }
+            m_alltests.push_back(rt);
+        }
+        addParamCases(firstParamTest, firstInstantiation);
+        buildSuiteIndex();
+    }
+
+    ~TestRegistrar()
+    {
+        for (size_t i=0; i < m_alltests.size(); ++i)
+            delete m_alltests[i];
+    }
+
+    /**
+     * Return the total number of defined tests.
+     */
+    size_t getTestCount() const
+    {
+        return m_alltests.size();
+    }
+
+    /**
+     * Count and return the number of disabled tests selected
+     * for this run.
+     */
+    size_t getDisabledTestCount() const
+    {
+        size_t count = 0ul;
+        for (size_t i=0; i < m_alltests.size(); ++i)
+        {
+            if (m_alltests[i]->selected() && ! m_alltests[i]->enabled())
+                count++;
+        }
+        return count;
+    }
+
+    /**
+     * Count and return the number of failed tests.
+     */
+    size_t getFailedTestCount() const
+    {
+        size_t count = 0ul;
+        for (size_t i=0; i < m_alltests.size(); ++i)
+        {
+            if (m_alltests[i]->runstate() == RegisteredTest::FAILED)
+                count++;
+        }
+        return count;
+    }
+
+    /**
+     * Select the tests that belong to this run, and return their
+     * indices in \c order. Either the tests or the benchmarks are
+     * selected. With sharding, every shard of the same binary gets
+     * a disjoint subset. The tests are dealt to the shards by their
+     * durations in \c history, if any, so the shards take about as
+     * long; see dealByDuration(). Without a history, they are dealt
+     * round-robin in registration order, so the shards get evenly
+     * sized subsets.
+     *
+     * The selected tests of a suite are then run together, with
+     * the suites in the order they first appear, so each suite's
+     * shared state is set up once and released early.
+     */
+    void selectTests(RunOptions const &options, std::map<std::string, double> const &history,
+                     std::vector<size_t> &order)
+    {
+        TestFilter filter(options.filter);
+        std::vector<char> matched(m_alltests.size(), filter.positive().empty());
+        for (size_t f=0; f < filter.positive().size(); ++f)
+            markMatches(filter.positive()[f], matched, 1);
+        for (size_t f=0; f < filter.negative().size(); ++f)
+            markMatches(filter.negative()[f], matched, 0);
+
+        std::vector<size_t> candidates;
+        for (size_t i=0; i < m_alltests.size(); ++i)
+        {
+            m_alltests[i]->setSelected(false);
+            if (matched[i] && m_alltests[i]->isBenchmark() == options.benchmarks)
+                candidates.push_back(i);
+        }
+
+        std::vector<unsigned> shards(candidates.size(), 0);
+        if (options.shardCount > 1 && !history.empty())
+            dealByDuration(candidates, history, options.shardCount, shards);
+        else if (options.shardCount > 1)
+        {
+            for (size_t c=0; c < candidates.size(); ++c)
+                shards[c] = static_cast<unsigned>(c % options.shardCount);
+        }
+
+        order.clear();
+        for (size_t c=0; c < candidates.size(); ++c)
+        {
+            if (options.shardCount > 1 && shards[c] != options.shardIndex)
+                continue;
+            m_alltests[candidates[c]]->setSelected(true);
+            order.push_back(candidates[c]);
+        }
+
+        std::vector<size_t> rank(m_suites.size(), order.size());
+        size_t ranked = 0;
+        for (size_t i=0; i < order.size(); ++i)
+        {
+            size_t suite = m_alltests[order[i]]->suite();
+            if (rank[suite] == order.size())
+                rank[suite] = ranked++;
+        }
+        std::stable_sort(order.begin(), order.end(), [this, &rank](size_t a, size_t b) {
+            return rank[m_alltests[a]->suite()] < rank[m_alltests[b]->suite()];
+        });
+        countRemaining(order);
+    }
+
+    /**
+     * Drop the tests for which \c drop returns true from the
+     * selection in \c order, keeping the order of the rest.
+     */
+    template <typename Predicate>
+    void deselectTests(std::vector<size_t> &order, Predicate drop)
+    {
+        size_t kept = 0;
+        for (size_t i=0; i < order.size(); ++i)
+        {
+            RegisteredTest *rt = m_alltests[order[i]];
+            if (drop(*rt))
+                rt->setSelected(false);
+            else
+                order[kept++] = order[i];
+        }
+        order.resize(kept);
+        countRemaining(order);
+    }
+
+    /**
+     * Reset each suite to be set up by the first of its enabled
+     * tests in \c order, and torn down after the last.
+     */
+    void countRemaining(std::vector<size_t> const &order)
+    {
+        for (size_t s=0; s < m_suites.size(); ++s)
+        {
+            m_suites[s].remaining = 0;
+            m_suites[s].state = SuiteIdle;
+        }
+        for (size_t i=0; i < order.size(); ++i)
+        {
+            if (m_alltests[order[i]]->enabled())
+                m_suites[m_alltests[order[i]]->suite()].remaining++;
+        }
+    }
+
+    /**
+     * Print the tests at indices \c order, grouped by suite,
+     * without creating any test instance.
+     */
+    void listTests(std::vector<size_t> const &order, std::ostream &out) const
+    {
+        char const *suite = 0;
+        for (size_t i=0; i < order.size(); ++i)
+        {
+            RegisteredTest const *rt = m_alltests[order[i]];
+            if (!suite || std::strcmp(suite, rt->suiteName()) != 0)
+            {
+                suite = rt->suiteName();
+                out << suite << ".\n";
+            }
+            out << "  " << rt->testName() << "\n";
+        }
+        out.flush();
+    }
+
+    /**
+     * Write one line per selected test with its final state,
+     * for merging with the results of other shards.
+     */
+    void writeResults(std::ostream &out) const
+    {
+        out << "# embtest results" << std::endl;
+        for (size_t i=0; i < m_alltests.size(); ++i)
+        {
+            RegisteredTest const *rt = m_alltests[i];
+            if (!rt->selected())
+                continue;
+            if (!rt->enabled())
+                out << "DISABLED ";
+            else if (rt->runstate() == RegisteredTest::PASSED)
+                out << "PASSED ";
+            else if (rt->runstate() == RegisteredTest::FAILED)
+                out << "FAILED ";
+            else
+                out << "NOTRUN ";
+            out << rt->info() << "\n";
+        }
+        out.flush();
+    }
+
+    /**
+     * Append a journal entry for each selected test that has
+     * finished, for a run cut short by a timeout. Tests already in
+     * the journal are written again, which is harmless, since the
+     * last entry of a test counts.
+     */
+    void writeJournal(std::ostream &out) const
+    {
+        for (size_t i=0; i < m_alltests.size(); ++i)
+        {
+            RegisteredTest const *rt = m_alltests[i];
+            if (!rt->selected() || rt->runstate() == RegisteredTest::NOTRUN)
+                continue;
+            JournalReporter::writeEntry(out, rt->runstate() == RegisteredTest::PASSED
+                                        ? StatusPassed : StatusFailed, rt->info());
+        }
+        out.flush();
+    }
+
+    /**
+     * Report the state of a run cut short by a timeout: the
+     * tests failed so far, and how many tests of each state.
+     */
+    void reportAbort(std::ostream &out) const
+    {
+        size_t passed = 0;
+        size_t failed = 0;
+        size_t notRun = 0;
+        for (size_t i=0; i < m_alltests.size(); ++i)
+        {
+            RegisteredTest const *rt = m_alltests[i];
+            if (!rt->selected() || !rt->enabled())
+                continue;
+            switch (rt->runstate()) {
+                case RegisteredTest::PASSED:
+                    passed++;
+                    break;
+                case RegisteredTest::FAILED:
+                    out << "[ FAILED ] " << rt->info() << "\n";
+                    failed++;
+                    break;
+                case RegisteredTest::NOTRUN:
+                    notRun++;
+                    break;
+            }
+        }
+        out << "-- Test results at the timeout --\n"
+            << " Failed:      " << failed << "\n"
+            << " Passed:      " << passed << "\n"
+            << " Not run:     " << notRun << "\n";
+        out.flush();
+    }
+
+    /**
+     * Fill \c estimates with the expected duration of each test in
+     * \c tests, from \c history. Tests missing from it are
+     * estimated at the median recorded duration.
+     */
+    void estimateDurations(std::vector<size_t> const &tests,
+                           std::map<std::string, double> const &history,
+                           std::vector<double> &estimates) const
+    {
+        estimates.assign(tests.size(), -1.0);
+        std::vector<double> known;
+        for (size_t i=0; i < tests.size(); ++i)
+        {
+            std::map<std::string, double>::const_iterator it =
+                history.find(m_alltests[tests[i]]->fullName());
+            if (it != history.end())
+            {
+                estimates[i] = it->second;
+                known.push_back(it->second);
+            }
+        }
+        double fallback = known.empty() ? 0.0 : median(known);
+        for (size_t i=0; i < estimates.size(); ++i)
+        {
+            if (estimates[i] < 0)
+                estimates[i] = fallback;
+        }
+    }
+
+    /**
+     * Deal the tests in \c candidates to \c shardCount shards so the
+     * shards' expected durations are about equal: longest first, each
+     * to the shard with the least expected time so far, ties going to
+     * the shard with fewer tests, then to the lower shard. \c shards receives each candidate's shard. The
+     * deal only depends on the candidates and the history, so shards
+     * given the same history file get disjoint subsets. With equal
+     * estimates, this is the round-robin deal.
+     */
+    void dealByDuration(std::vector<size_t> const &candidates,
+                        std::map<std::string, double> const &history,
+                        unsigned shardCount, std::vector<unsigned> &shards) const
+    {
+        std::vector<double> estimates;
+        estimateDurations(candidates, history, estimates);
+
+        std::vector<size_t> longest(candidates.size());
+        for (size_t c=0; c < longest.size(); ++c)
+            longest[c] = c;
+        std::stable_sort(longest.begin(), longest.end(),
+                         [&estimates](size_t a, size_t b) {
+                             return estimates[a] > estimates[b];
+                         });
+
+        std::vector<double> load(shardCount, 0.0);
+        std::vector<size_t> count(shardCount, 0);
+        shards.assign(candidates.size(), 0);
+        for (size_t i=0; i < longest.size(); ++i)
+        {
+            unsigned lightest = 0;
+            for (unsigned s=1; s < shardCount; ++s)
+            {
+                if (load[s] < load[lightest] ||
+                    (load[s] == load[lightest] && count[s] < count[lightest]))
+                    lightest = s;
+            }
+            shards[longest[i]] = lightest;
+            load[lightest] += estimates[longest[i]];
+            count[lightest]++;
+        }
+    }
+
+    /**
+     * Fill \c schedule with the positions in \c order, longest
+     * expected duration first, for longest-processing-time-first
+     * scheduling. Durations come from \c history, and tests missing
+     * from it are estimated at the median recorded duration.
+     */
+    void scheduleLongestFirst(std::vector<size_t> const &order,
+                              std::map<std::string, double> const &history,
+                              std::vector<size_t> &schedule) const
+    {
+        std::vector<double> estimates;
+        estimateDurations(order, history, estimates);
+
+        schedule.resize(order.size());
+        for (size_t i=0; i < schedule.size(); ++i)
+            schedule[i] = i;
+        std::stable_sort(schedule.begin(), schedule.end(),
+                         [&estimates](size_t a, size_t b) {
+                             return estimates[a] > estimates[b];
+                         });
+    }
+
+    /**
+     * Update \c history with the wall-clock duration of every
+     * test that ran. Entries of tests that did not run, or have no
+     * measured duration, e.g. because the run timed out before they
+     * started, are kept.
+     */
+    void updateHistory(std::map<std::string, double> &history) const
+    {
+        for (size_t i=0; i < m_alltests.size(); ++i)
+        {
+            RegisteredTest const *rt = m_alltests[i];
+            if (rt->selected() && rt->runstate() != RegisteredTest::NOTRUN &&
+                rt->timing().wallNs() > 0)
+                history[rt->fullName()] = rt->timing().wallNs();
+        }
+    }
+
+    /**
+     * Instantiate and run the test at index \c which, and send
+     * its events to \c events.
+     */
+    void runTest(size_t which, Reporter &events)
+    {
+        if (which >= m_alltests.size())
+            return;
+
+        RegisteredTest *rt = m_alltests[which];
+        TestResult result;
+        result.test = rt->info();
+
+        /*
+         * Only run if enabled. If disabled, just report it.
+         */
+        if (!rt->enabled())
+        {
+            result.status = StatusDisabled;
+            events.testFinished(result);
+            return;
+        }
+
+        events.testStarting(result.test);
+        AllocationTracker allocations;
+        {
+            TestCapture capture(events, result.test, rt->token());
+            ScopedCapture redirect(capture);
+            WatchedTest watched(*rt);
+            rt->setCapture(&capture);
+
+            if (enterSuite(*rt, capture))
+                runInstance(*rt, capture);
+            else
+                rt->setRunstate(RegisteredTest::FAILED);
+            leaveSuite(*rt, capture);
+
+            rt->setCapture(0);
+            capture.finish();
+        }
+
+        /*
+         * Checked once the capture is gone, as the test's output
+         * may have grown its buffer.
+         */
+        result.allocations = allocations.stats();
+        if (s_runOptions.detectLeaks && allocations.liveBlocks() > 0)
+        {
+            rt->setRunstate(RegisteredTest::FAILED);
+            std::ostringstream message;
+            message << "Leaked " << allocations.liveBytes() << " bytes in "
+                    << allocations.liveBlocks() << " blocks allocated by the test\n";
+            TestFailure failure;
+            failure.kind = FailureLeak;
+            failure.file = 0;
+            failure.line = 0;
+            failure.message = message.str();
+            events.testFailure(result.test, failure);
+        }
+
+        result.status = rt->runstate() == RegisteredTest::FAILED ? StatusFailed : StatusPassed;
+        result.timing = rt->timing();
+        result.benchmark = rt->benchmarkStats();
+        result.counters = rt->counters();
+        events.testFinished(result);
+    }
+
+    /**
+     * Run the tests at indices \c order on \c jobs worker threads.
+     * \c schedule lists positions in \c order in the sequence they
+     * should start. Tests are dealt round-robin to the workers'
+     * queues, and a worker whose queue runs dry steals from the
+     * others. The events of each test are recorded and sent to
+     * \c events in the order given.
+     */
+    void runParallel(std::vector<size_t> const &order, std::vector<size_t> const &schedule,
+                     unsigned jobs, Reporter &events)
+    {
+#if EMBTEST_HAS_THREADS
+        std::vector<WorkQueue> queues(jobs);
+        for (size_t i=0; i < schedule.size(); ++i)
+            queues[i % jobs].push(schedule[i]);
+
+        OrderedReplay replay(order.size(), events);
+
+        std::vector<std::thread> workers;
+        for (unsigned w=0; w < jobs; ++w)
+        {
+            workers.push_back(std::thread([this, w, jobs, &queues, &order, &replay]() {
+                size_t position;
+                for (;;)
+                {
+                    bool found = queues[w].pop(position);
+                    for (unsigned v=1; !found && v < jobs; ++v)
+                        found = queues[(w + v) % jobs].steal(position);
+                    if (!found)
+                        break;
+
+                    TestRecord record;
+                    runTest(order[position], record);
+                    replay.complete(position, record);
+                }
+            }));
+        }
+        for (size_t w=0; w < workers.size(); ++w)
+            workers[w].join();
+#else
+        (void)schedule;
+        (void)jobs;
+        for (size_t i=0; i < order.size(); ++i)
+            runTest(order[i], events);
+#endif
+    }
+
+    /**
+     * Run the tests at indices \c order on \c count forked worker
+     * processes. The parent keeps the queue of remaining tests,
+     * in \c schedule sequence, and hands the next one to whichever
+     * worker reports a result. A worker that dies mid-test, e.g.
+     * from a crash, fails that test and is replaced by a new worker.
+     * So is a worker whose test overruns the test timeout. When the
+     * run overruns its timeout, the tests in flight and those not
+     * yet started fail.
+     */
+    void runInWorkers(std::vector<size_t> const &order, std::vector<size_t> const &schedule,
+                      unsigned count, Reporter &events)
+    {
+#if EMBTEST_HAS_FORK
+        typedef std::chrono::steady_clock Clock;
+        Clock::duration testTimeout = std::chrono::milliseconds(s_runOptions.testTimeoutMs);
+        Clock::duration runTimeout = std::chrono::milliseconds(s_runOptions.runTimeoutMs);
+        Clock::time_point runStarted = Clock::now();
+
+        OrderedReplay replay(order.size(), events);
+        std::vector<WorkerProcess> workers;
+        size_t next = 0;
+        size_t remaining = order.size();
+
+        // A worker may die with a task in its pipe; don't die with it.
+        void (*previousSigpipe)(int) = std::signal(SIGPIPE, SIG_IGN);
+
+        for (unsigned w=0; w < count; ++w)
+        {
+            WorkerProcess worker;
+            if (!spawnWorker(workers, worker))
+                break;
+            workers.push_back(worker);
+        }
+
+        while (remaining > 0 && !workers.empty())
+        {
+            // Hand out work to idle workers, and retire them once
+            // the queue is empty.
+            for (size_t w=0; w < workers.size(); )
+            {
+                WorkerProcess &worker = workers[w];
+                if (!worker.busy && next < schedule.size())
+                {
+                    worker.position = schedule[next++];
+                    uint32_t which = static_cast<uint32_t>(order[worker.position]);
+                    worker.busy = true;
+                    worker.started = Clock::now();
+                    if (!writeFully(worker.taskFd, &which, sizeof(which)))
+                    {
+                        ++w;                // reported when its pipe closes
+                        continue;
+                    }
+                }
+                if (!worker.busy)
+                {
+                    (void)reapWorker(worker);
+                    workers.erase(workers.begin() + w);
+                    continue;
+                }
+                ++w;
+            }
+
+            // Wake up for the first deadline, if there is one.
+            int waitMs = -1;
+            Clock::time_point now = Clock::now();
+            if (runTimeout.count() > 0)
+                waitMs = static_cast<int>(std::max(0ll, toMs(runStarted + runTimeout - now)));
+            for (size_t w=0; testTimeout.count() > 0 && w < workers.size(); ++w)
+            {
+                long long left = std::max(0ll, toMs(workers[w].started + testTimeout - now));
+                if (workers[w].busy && (waitMs < 0 || left < waitMs))
+                    waitMs = static_cast<int>(left);
+            }
+
+            std::vector<struct pollfd> fds(workers.size());
+            for (size_t w=0; w < workers.size(); ++w)
+            {
+                fds[w].fd = workers[w].resultFd;
+                fds[w].events = POLLIN;
+                fds[w].revents = 0;
+            }
+            if (::poll(&fds[0], fds.size(), waitMs) < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                break;
+            }
+
+            for (size_t w=workers.size(); w-- > 0; )
+            {
+                if (fds[w].revents == 0)
+                    continue;
+
+                WorkerProcess &worker = workers[w];
+                RegisteredTest *rt = m_alltests[order[worker.position]];
+                TestRecord record;
+                uint32_t length = 0;
+                std::string payload;
+                bool received = readFully(worker.resultFd, &length, sizeof(length));
+                if (received)
+                {
+                    payload.resize(length);
+                    received = (length == 0 ||
+                                readFully(worker.resultFd, &payload[0], length)) &&
+                               record.deserialize(payload, rt->info());
+                }
+
+                if (received)
+                {
+                    TestResult const &result = record.result();
+                    if (result.status != StatusDisabled)
+                        rt->setRunstate(result.status == StatusFailed ?
+                                        RegisteredTest::FAILED : RegisteredTest::PASSED);
+                    rt->timing() = result.timing;
+                    worker.busy = false;
+                    replay.complete(worker.position, record);
+                    remaining--;
+                    continue;
+                }
+
+                // The worker died. Fail its test and replace it.
+                size_t position = worker.position;
+                Clock::duration elapsed = Clock::now() - worker.started;
+                int status = reapWorker(worker);
+                workers.erase(workers.begin() + w);
+
+                std::ostringstream message;
+                if (WIFSIGNALED(status))
+                    message << "Worker killed by signal " << WTERMSIG(status)
+                            << " (" << strsignal(WTERMSIG(status)) << ")\n";
+                else
+                    message << "Worker exited with status " << WEXITSTATUS(status) << "\n";
+                failUnfinished(order, position, FailureCrash, message.str(), elapsed, replay);
+                remaining--;
+
+                WorkerProcess replacement;
+                if (next < schedule.size() && spawnWorker(workers, replacement))
+                    workers.push_back(replacement);
+            }
+
+            // Kill the workers whose tests overran, and replace them.
+            now = Clock::now();
+            bool runExpired = runTimeout.count() > 0 && now - runStarted >= runTimeout;
+            for (size_t w=workers.size(); w-- > 0; )
+            {
+                WorkerProcess &worker = workers[w];
+                if (!worker.busy ||
+                    (!runExpired && (testTimeout.count() == 0 || now - worker.started < testTimeout)))
+                    continue;
+
+                std::ostringstream message;
+                if (runExpired)
+                    message << "The run timed out after " << toMs(runTimeout)
+                            << " ms, with this test running for "
+                            << toMs(now - worker.started) << " ms\n";
+                else
+                    message << "Timed out after " << toMs(now - worker.started) << " ms\n";
+                std::string backtraces = killStuckWorker(worker);
+                if (!backtraces.empty())
+                    message << "-- Backtraces --\n" << backtraces;
+
+                size_t position = worker.position;
+                Clock::duration elapsed = now - worker.started;
+                (void)reapWorker(worker);
+                workers.erase(workers.begin() + w);
+                failUnfinished(order, position, FailureTimeout, message.str(), elapsed, replay);
+                remaining--;
+
+                WorkerProcess replacement;
+                if (!runExpired && next < schedule.size() && spawnWorker(workers, replacement))
+                    workers.push_back(replacement);
+            }
+
+            if (runExpired)
+            {
+                std::ostringstream message;
+                message << "The run timed out after " << toMs(runTimeout)
+                        << " ms, before this test started\n";
+                for (; next < schedule.size(); ++next)
+                {
+                    failUnfinished(order, schedule[next], FailureNotRun, message.str(),
+                                   Clock::duration::zero(), replay);
+                    remaining--;
+                }
+            }
+        }
+
+        for (size_t w=0; w < workers.size(); ++w)
+            (void)reapWorker(workers[w]);
+
+        // If no worker could be started, finish the run in-process.
+        for (; next < schedule.size(); ++next)
+        {
+            TestRecord record;
+            runTest(order[schedule[next]], record);
+            replay.complete(schedule[next], record);
+        }
+
+        std::signal(SIGPIPE, previousSigpipe);
+#else
+        (void)schedule;
+        (void)count;
+        for (size_t i=0; i < order.size(); ++i)
+            runTest(order[i], events);
+#endif
+    }
+
+    /**
+     * Report each of the tests at indices \c order as failed with
+     * \c message, without running it.
+     */
+    void failTests(std::vector<size_t> const &order, std::string const &message, Reporter &events)
+    {
+        for (size_t i=0; i < order.size(); ++i)
+        {
+            RegisteredTest *rt = m_alltests[order[i]];
+            TestResult result;
+            result.test = rt->info();
+            if (!rt->enabled())
+            {
+                result.status = StatusDisabled;
+                events.testFinished(result);
+                continue;
+            }
+
+            rt->setRunstate(RegisteredTest::FAILED);
+            TestFailure failure;
+            failure.kind = FailureException;
+            failure.file = 0;
+            failure.line = 0;
+            failure.message = message;
+            result.status = StatusFailed;
+            events.testStarting(result.test);
+            events.testFailure(result.test, failure);
+            events.testFinished(result);
+        }
+    }
+
+    /**
+     * Tear down the suites still set up, e.g. in a worker process
+     * that ran only some of a suite's tests.
+     */
+    void tearDownSuites()
+    {
+        for (size_t s=0; s < m_suites.size(); ++s)
+        {
+            SuiteIndex &suite = m_suites[s];
+#if EMBTEST_HAS_THREADS
+            std::lock_guard<std::mutex> lock(suite.mutex);
+#endif
+            if (!tearDownSuite(suite))
+                *s_outstream << "Exception in TearDownTestSuite() of " << suite.name << "\n";
+        }
+    }
+
+    /*
+     * The test a token stands for: a test's own token, or for
+     * RunningTestToken the test running on this thread. The token
+     * of a TEST_P() stands for its case running on this thread, or
+     * on another thread, its running case; cases of one TEST_P()
+     * running at once on several threads can't be told apart there.
+     * Otherwise the token is returned as is, and matches no test.
+     */
+    RegToken resolveToken(RegToken token) const
+    {
+        if (token >= 0)
+            return token;
+        if (t_capture)
+            return t_capture->token();
+        if (token == RunningTestToken)
+            return token;
+        for (size_t i=0; i < m_alltests.size(); ++i)
+        {
+            if (m_alltests[i]->paramTest() == token && m_alltests[i]->capture())
+                return static_cast<RegToken>(i);
+        }
+        return token;
+    }
+
+    /*
+     * Record that a test has failed at least one condition. This
+     * may be called from any thread.
+     */
+    void recordTestFailure(RegToken token)
+    {
+        size_t which = static_cast<size_t>(resolveToken(token));
+
+        if (which >= m_alltests.size())
+            return;                         // TODO: report or throw here
+
+        m_alltests[which]->setRunstate(RegisteredTest::FAILED);
+    }
+
+    /*
+     * The capture of the test with this token while it runs, or
+     * null.
+     */
+    TestCapture* runningCapture(RegToken token) const
+    {
+        size_t which = static_cast<size_t>(resolveToken(token));
+        return which < m_alltests.size() ? m_alltests[which]->capture() : 0;
+    }
+
+  private:
+    /*
+     * A SuiteIndex lists the tests of one suite, in registration
+     * order, and holds the state of the suite's shared fixture
+     * during a run: the number of its selected tests still to run,
+     * and whether SetUpTestSuite() has run. The index is sorted by
+     * suite name.
+     */
+    enum SuiteState { SuiteIdle, SuiteReady, SuiteFailed };
+
+    struct SuiteIndex
+    {
+        SuiteIndex() : name(0), setUp(0), tearDown(0), remaining(0), state(SuiteIdle) { }
+
+        char const                    *name;
+        std::vector<size_t>            tests;
+        RegisteredTest::SuiteFunction  setUp;
+        RegisteredTest::SuiteFunction  tearDown;
+        size_t                         remaining;
+        SuiteState                     state;
+        std::string                    error;      ///< why SetUpTestSuite() failed
+#if EMBTEST_HAS_THREADS
+        std::mutex                     mutex;
+#endif
+    };
+
+    /*
+     * Add a test for every case of each TEST_P() of every
+     * instantiated fixture. Only names are made here: a suite name
+     * per instantiation, and one buffer holding the case names of
+     * each test. Parameter values are made when a case runs.
+     */
+    void addParamCases(ParamTestRegistration const *firstTest,
+                       ParamInstantiation const *firstInstantiation)
+    {
+        for (ParamInstantiation const *inst = firstInstantiation; inst; inst = inst->next)
+        {
+            m_names.push_back(std::string(inst->prefix()) + "/" + inst->fixtureName());
+            char const *suiteName = m_names.back().c_str();
+            size_t count = inst->size();
+
+            RegToken paramTest = RunningTestToken;
+            for (ParamTestRegistration const *test = firstTest; test; test = test->next)
+            {
+                --paramTest;                // as numbered by registerParamTest()
+                if (std::strcmp(test->fixtureName, inst->fixtureName()) != 0)
+                    continue;
+
+                TestRegistration reg = { suiteName, test->testName, test->create, KindTest, 0,
+                                         test->setUpSuite, test->tearDownSuite, 0 };
+                m_paramRegistrations.push_back(reg);
+
+                std::string names;
+                for (size_t i=0; i < count; ++i)
+                {
+                    names += test->testName;
+                    names += '/';
+                    names += std::to_string(i);
+                    names += '\0';
+                }
+                m_names.push_back(std::string());
+                m_names.back().swap(names);
+
+                bool disabled = std::strncmp(test->testName, "DISABLED_", 9) == 0;
+                char const *name = m_names.back().data();
+                for (size_t i=0; i < count; ++i)
+                {
+                    RegisteredTest *rt = new RegisteredTest(&m_paramRegistrations.back(),
+                                                            static_cast<RegToken>(m_alltests.size()));
+                    rt->setParamCase(inst, i, name, paramTest);
+                    if (disabled)
+                        rt->disable();
+                    m_alltests.push_back(rt);
+                    name += std::strlen(name) + 1;
+                }
+            }
+        }
+    }
+
+    void buildSuiteIndex()
+    {
+        std::vector<size_t> byName(m_alltests.size());
+        for (size_t i=0; i < byName.size(); ++i)
+            byName[i] = i;
+        std::stable_sort(byName.begin(), byName.end(), [this](size_t a, size_t b) {
+            return std::strcmp(m_alltests[a]->suiteName(), m_alltests[b]->suiteName()) < 0;
+        });
+
+        for (size_t i=0; i < byName.size(); ++i)
+        {
+            RegisteredTest *rt = m_alltests[byName[i]];
+            if (m_suites.empty() || std::strcmp(m_suites.back().name, rt->suiteName()) != 0)
+            {
+                m_suites.emplace_back();
+                m_suites.back().name = rt->suiteName();
+                m_suites.back().setUp = rt->setUpSuite();
+                m_suites.back().tearDown = rt->tearDownSuite();
+            }
+            m_suites.back().tests.push_back(byName[i]);
+            rt->setSuite(m_suites.size() - 1);
+        }
+    }
+
+    /*
+     * Set up the suite of \c rt if this is its first test to run.
+     * Returns false, and reports why, if the suite's setup failed.
+     */
+    bool enterSuite(RegisteredTest &rt, TestCapture &capture)
+    {
+        SuiteIndex &suite = m_suites[rt.suite()];
+#if EMBTEST_HAS_THREADS
+        std::lock_guard<std::mutex> lock(suite.mutex);
+#endif
+        if (suite.state == SuiteIdle)
+        {
+            suite.state = SuiteFailed;
+            try {
+                suite.setUp();
+                suite.state = SuiteReady;
+            }
+            catch (std::exception &e)
+            {
+                suite.error = std::string("Exception in SetUpTestSuite(): ") + e.what();
+            }
+            catch (...)
+            {
+                suite.error = "Unknown Exception in SetUpTestSuite()";
+            }
+        }
+        if (suite.state == SuiteFailed)
+            capture.beginFailure(FailureException, 0, 0) << suite.error << "\n";
+        return suite.state == SuiteReady;
+    }
+
+    /*
+     * Count a test of the suite of \c rt as done, and tear the
+     * suite down after its last test.
+     */
+    void leaveSuite(RegisteredTest &rt, TestCapture &capture)
+    {
+        SuiteIndex &suite = m_suites[rt.suite()];
+#if EMBTEST_HAS_THREADS
+        std::lock_guard<std::mutex> lock(suite.mutex);
+#endif
+        if (suite.remaining > 0 && --suite.remaining == 0 && !tearDownSuite(suite))
+        {
+            rt.setRunstate(RegisteredTest::FAILED);
+            capture.beginFailure(FailureException, 0, 0)
+                << "Exception in TearDownTestSuite()\n";
+        }
+    }
+
+    /*
+     * Run a ready suite's TearDownTestSuite(). The caller holds the
+     * suite's lock. Returns false if the teardown threw.
+     */
+    static bool tearDownSuite(SuiteIndex &suite)
+    {
+        if (suite.state != SuiteReady)
+            return true;
+        suite.state = SuiteIdle;
+        try {
+            suite.tearDown();
+        }
+        catch (...)
+        {
+            return false;
+        }
+        return true;
+    }
+
+    /*
+     * Set \c matched[i] to \c value for every test i that \c pattern
+     * matches. A literal suite name is looked up in the index, and
+     * other split patterns skip the suites they don't match.
+     */
+    void markMatches(GlobPattern const &pattern, std::vector<char> &matched, char value) const
+    {
+        if (!pattern.isSplit())
+        {
+            for (size_t i=0; i < m_alltests.size(); ++i)
+            {
+                if (pattern.matches(m_alltests[i]->suiteName(), m_alltests[i]->testName()))
+                    matched[i] = value;
+            }
+            return;
+        }
+
+        std::deque<SuiteIndex>::const_iterator first = m_suites.begin();
+        std::deque<SuiteIndex>::const_iterator last = m_suites.end();
+        if (pattern.hasLiteralSuite())
+        {
+            std::string name = pattern.suiteName();
+            first = std::lower_bound(first, last, name,
+                                     [](SuiteIndex const &suite, std::string const &name) {
+                                         return std::strcmp(suite.name, name.c_str()) < 0;
+                                     });
+            last = first;
+            if (last != m_suites.end() && name == last->name)
+                ++last;
+        }
+
+        for (; first != last; ++first)
+        {
+            if (!pattern.hasLiteralSuite() && !pattern.matchesSuite(first->name))
+                continue;
+            for (size_t t=0; t < first->tests.size(); ++t)
+            {
+                size_t i = first->tests[t];
+                if (pattern.matchesAnyTest() || pattern.matchesTest(m_alltests[i]->testName()))
+                    matched[i] = value;
+            }
+        }
+    }
+
+    /*
+     * Test instance lifetime: ctor,SetUp,TestBody,TearDown,dtor
+     * Each phase is timed on its own.
+     */
+    void runInstance(RegisteredTest &rt, TestCapture &capture)
+    {
+        TestTiming &timing = rt.timing();
+        TestCounters counters(rt.counters(), s_runOptions.perfCounters);
+        PhaseTimer timer;
+        countAllocations(true);
+        Test *testInstance = rt.makeTest();
+        timing.phases[PhaseConstruct] = timer.lap();
+        rt.setRunstate(RegisteredTest::PASSED);
+        testInstance->SetUp();
+        timing.phases[PhaseSetUp] = timer.lap();
+        try {
+            counters.start();
+            if (rt.isBenchmark() && s_runOptions.benchmarks)
+                runBenchmark(*static_cast<Benchmark*>(testInstance), rt);
+            else
+                testInstance->TestBody();
+        }
+        catch (std::exception &e)
+        {
+            rt.setRunstate(RegisteredTest::FAILED);
+            capture.beginFailure(FailureException, 0, 0)
+                << "Exception: " << e.what() << "\n";
+        }
+        catch (...)
+        {
+            rt.setRunstate(RegisteredTest::FAILED);
+            capture.beginFailure(FailureException, 0, 0)
+                << "Unknown Exception\n";
+        }
+        counters.stop();
+        timing.phases[PhaseBody] = timer.lap();
+
+        testInstance->TearDown();
+        timing.phases[PhaseTearDown] = timer.lap();
+        delete testInstance;
+        countAllocations(false);
+        timing.phases[PhaseDestruct] = timer.lap();
+    }
+
+#if EMBTEST_HAS_FORK
+    /*
+     * Fork a new worker process. The child runs tests sent over its
+     * task pipe until the pipe closes, and never returns.
+     */
+    bool spawnWorker(std::vector<WorkerProcess> const &others, WorkerProcess &worker)
+    {
+        int taskPipe[2];
+        int resultPipe[2];
+        int dumpPipe[2];
+        if (::pipe(taskPipe) != 0)
+            return false;
+        if (::pipe(resultPipe) != 0)
+        {
+            ::close(taskPipe[0]);
+            ::close(taskPipe[1]);
+            return false;
+        }
+        if (::pipe(dumpPipe) != 0)
+        {
+            ::close(taskPipe[0]);
+            ::close(taskPipe[1]);
+            ::close(resultPipe[0]);
+            ::close(resultPipe[1]);
+            return false;
+        }
+
+        // Don't let buffered output be written twice.
+        s_outstream->flush();
+        std::cout.flush();
+        std::cerr.flush();
+
+        pid_t pid = ::fork();
+        if (pid < 0)
+        {
+            ::close(taskPipe[0]);
+            ::close(taskPipe[1]);
+            ::close(resultPipe[0]);
+            ::close(resultPipe[1]);
+            ::close(dumpPipe[0]);
+            ::close(dumpPipe[1]);
+            return false;
+        }
+
+        if (pid == 0)
+        {
+            // Child: drop the parent's ends of every pipe.
+            for (size_t w=0; w < others.size(); ++w)
+            {
+                ::close(others[w].taskFd);
+                ::close(others[w].resultFd);
+                ::close(others[w].dumpFd);
+            }
+            ::close(taskPipe[1]);
+            ::close(resultPipe[0]);
+            ::close(dumpPipe[0]);
+            std::signal(SIGPIPE, SIG_DFL);
+#if EMBTEST_HAS_BACKTRACE
+            installDumpHandler(dumpPipe[1]);
+#endif
+
+            uint32_t which;
+            while (readFully(taskPipe[0], &which, sizeof(which)))
+            {
+                TestRecord record;
+                runTest(which, record);
+                std::string payload;
+                record.serialize(payload);
+
+                uint32_t length = static_cast<uint32_t>(payload.size());
+                if (!writeFully(resultPipe[1], &length, sizeof(length)) ||
+                    !writeFully(resultPipe[1], payload.data(), payload.size()))
+                    break;
+            }
+            tearDownSuites();
+            s_outstream->flush();
+            std::cout.flush();
+            std::cerr.flush();
+            ::_exit(0);
+        }
+
+        ::close(taskPipe[0]);
+        ::close(resultPipe[1]);
+        ::close(dumpPipe[1]);
+        worker.pid = pid;
+        worker.taskFd = taskPipe[1];
+        worker.resultFd = resultPipe[0];
+        worker.dumpFd = dumpPipe[0];
+        worker.position = 0;
+        worker.busy = false;
+        return true;
+    }
+
+    /*
+     * Close a worker's pipes and wait for it to exit. An idle
+     * worker exits when it sees its task pipe close.
+     * Returns the wait status.
+     */
+    int reapWorker(WorkerProcess &worker)
+    {
+        ::close(worker.taskFd);
+        ::close(worker.resultFd);
+        ::close(worker.dumpFd);
+        int status = 0;
+        while (::waitpid(worker.pid, &status, 0) < 0 && errno == EINTR)
+            ;
+        return status;
+    }
+
+    /*
+     * Ask a worker stuck in a test for the backtraces of its
+     * threads, then kill it. Returns the backtraces, or an empty
+     * string if the worker gave none within a few seconds.
+     */
+    std::string killStuckWorker(WorkerProcess &worker)
+    {
+        std::string dump;
+#if EMBTEST_HAS_BACKTRACE
+        typedef std::chrono::steady_clock Clock;
+        Clock::time_point deadline = Clock::now() + std::chrono::seconds(5);
+        if (::kill(worker.pid, EMBTEST_DUMP_SIGNAL) == 0)
+        {
+            while (dump.find(s_dumpEnd) == std::string::npos)
+            {
+                long long waitMs = toMs(deadline - Clock::now());
+                if (waitMs <= 0)
+                    break;
+                struct pollfd fd = { worker.dumpFd, POLLIN, 0 };
+                int ready = ::poll(&fd, 1, static_cast<int>(waitMs));
+                if (ready < 0 && errno == EINTR)
+                    continue;
+                if (ready <= 0)
+                    break;
+
+                char buffer[4096];
+                ssize_t n = ::read(worker.dumpFd, buffer, sizeof(buffer));
+                if (n < 0 && errno == EINTR)
+                    continue;
+                if (n <= 0)
+                    break;
+                dump.append(buffer, static_cast<size_t>(n));
+            }
+            size_t end = dump.find(s_dumpEnd);
+            if (end != std::string::npos)
+                dump.erase(end);
+        }
+#endif
+        ::kill(worker.pid, SIGKILL);
+        return dump;
+    }
+
+    /*
+     * Report the test at \c position in \c order, which didn't
+     * finish in a worker, as failed with \c message, after running
+     * for \c elapsed. The whole of that time counts as the body's.
+     */
+    void failUnfinished(std::vector<size_t> const &order, size_t position,
+                        FailureKind kind, std::string const &message,
+                        std::chrono::steady_clock::duration elapsed, OrderedReplay &replay)
+    {
+        RegisteredTest *rt = m_alltests[order[position]];
+        TestRecord record;
+        TestResult result;
+        result.test = rt->info();
+        if (!rt->enabled())
+        {
+            result.status = StatusDisabled;
+            record.testFinished(result);
+            replay.complete(position, record);
+            return;
+        }
+
+        rt->setRunstate(RegisteredTest::FAILED);
+        double elapsedNs = std::chrono::duration<double, std::nano>(elapsed).count();
+        rt->timing() = TestTiming();
+        rt->timing().phases[PhaseBody].wallNs = elapsedNs;
+        result.timing = rt->timing();
+
+        TestFailure failure;
+        failure.kind = kind;
+        failure.file = 0;
+        failure.line = 0;
+        failure.message = message;
+        result.status = StatusFailed;
+        record.testStarting(result.test);
+        record.testFailure(result.test, failure);
+        record.testFinished(result);
+        replay.complete(position, record);
+    }
+#endif
+
+    std::vector<RegisteredTest*> m_alltests; // just a flat list to start
+    std::deque<SuiteIndex>       m_suites;
+
+    // Storage for the parameterized cases; deques keep addresses stable.
+    std::deque<TestRegistration> m_paramRegistrations;
+    std::deque<std::string>      m_names;
+    std::set<std::string>        m_typedSuiteNames;  ///< one per fixture and type
+};
+
+static TestRegistrar& registrar();
+
+std::ostream& getOutstream()
+{
+    return t_capture ? t_capture->stream() : *s_outstream;
+}
+
+/**
+ * Start a failure message of the running test. On another thread
+ * of the test, the message is collected for that thread, and
+ * outside of a test it goes straight to s_outstream.
+ */
+std::ostream& beginFailure(int line, char const* file, RegToken token)
+{
+    if (t_capture)
+        return t_capture->beginFailure(FailureAssertion, file, line);
+    if (TestCapture *running = registrar().runningCapture(token))
+        return running->beginThreadFailure(FailureAssertion, file, line);
+    return *s_outstream << "Failure: (line " << line << ") " << file << "\n";
+}
+
+/*
+ * Tests register during static initialization by linking their
+ * static TestRegistration into this list. These pointers are
+ * zero-initialized before any static constructor runs, so we
+ * don't rely on static initialization order.
+ */
+static TestRegistration *s_firstRegistration = 0;
+static TestRegistration *s_lastRegistration = 0;
+static RegToken s_registrationCount = 0;
+
+/*
+ * Parameterized tests and their instantiations are kept in lists
+ * the same way, and combined into test cases by the TestRegistrar.
+ */
+static ParamTestRegistration *s_firstParamTest = 0;
+static ParamTestRegistration *s_lastParamTest = 0;
+static RegToken s_paramTestCount = 0;
+static ParamInstantiation *s_firstInstantiation = 0;
+static ParamInstantiation *s_lastInstantiation = 0;
+
+/*
+ * The TestRegistrar holds the run state of every test. It is
+ * built from the registration list on first use, after main()
+ * has started, so registration itself never allocates.
+ */
+static TestRegistrar *s_testRegistrar = 0;
+
+static TestRegistrar& registrar()
+{
+    if (!s_testRegistrar)
+        s_testRegistrar = new TestRegistrar(s_firstRegistration, s_firstParamTest,
+                                            s_firstInstantiation);
+    return *s_testRegistrar;
+}
+
+/*
+ * ::registerTest() appends a registration to the list, and
+ * returns its position as the test's token.
+ */
+RegToken registerTest(TestRegistration *registration)
+{
+    if (!registration || !registration->suiteName ||
+        !registration->testName || !registration->create)
+    {
+        throw std::exception();
+    }
+
+    registration->next = 0;
+    if (s_lastRegistration)
+        s_lastRegistration->next = registration;
+    else
+        s_firstRegistration = registration;
+    s_lastRegistration = registration;
+
+    return s_registrationCount++;
+}
+
+RegToken registerParamTest(ParamTestRegistration *registration)
+{
+    if (!registration || !registration->fixtureName ||
+        !registration->testName || !registration->create)
+    {
+        throw std::exception();
+    }
+
+    registration->next = 0;
+    if (s_lastParamTest)
+        s_lastParamTest->next = registration;
+    else
+        s_firstParamTest = registration;
+    s_lastParamTest = registration;
+    return RunningTestToken - ++s_paramTestCount;
+}
+
+/*
+ * An instantiation links itself into the list as it is
+ * constructed during static initialization.
+ */
+ParamInstantiation::ParamInstantiation(char const *prefix, char const *fixtureName)
+    : next(0)
+    , m_prefix(prefix)
+    , m_fixtureName(fixtureName)
+{
+    if (s_lastInstantiation)
+        s_lastInstantiation->next = this;
+    else
+        s_firstInstantiation = this;
+    s_lastInstantiation = this;
+}
+
+void rangeStepInvalid()
+{
+    throw std::invalid_argument("embtest::Range() needs a positive step");
+}
+
+/**
+ * This function records that a test fails. When a test is started,
+ * it is assumed to pass. At any point, a failure may be detected
+ * which is marked by recordTestFailure(). This becomes a sticky state.
+ *
+ * This is a forwarding function to the registrar singleton.
+ */
+void recordTestFailure(RegToken token)
+{
+    registrar().recordTestFailure(token);
+}
+
+/**
+ * The EnvironmentList holds the environments added with
+ * addEnvironment(), linked in the order they were added. Like the
+ * test registrations, the list head is zero-initialized, so
+ * environments may be added during static initialization.
+ */
+class EnvironmentList
+{
+  public:
+    static void add(Environment *environment)
+    {
+        environment->m_next = 0;
+        if (s_last)
+            s_last->m_next = environment;
+        else
+            s_first = environment;
+        s_last = environment;
+    }
+
+    /**
+     * Set up the environments in order, and return how many were
+     * set up. On an exception, stop and describe it in \c error.
+     */
+    static size_t setUp(std::string &error)
+    {
+        size_t count = 0;
+        for (Environment *env = s_first; env; env = env->m_next, ++count)
+        {
+            try {
+                env->SetUp();
+            }
+            catch (std::exception &e)
+            {
+                error = std::string("Exception in Environment SetUp(): ") + e.what() + "\n";
+                break;
+            }
+            catch (...)
+            {
+                error = "Unknown Exception in Environment SetUp()\n";
+                break;
+            }
+        }
+        return count;
+    }
+
+    /**
+     * Tear down the first \c count environments, in reverse order.
+     */
+    static void tearDown(size_t count)
+    {
+        std::vector<Environment*> environments;
+        for (Environment *env = s_first; env && environments.size() < count; env = env->m_next)
+            environments.push_back(env);
+        while (!environments.empty())
+        {
+            try {
+                environments.back()->TearDown();
+            }
+            catch (...)
+            {
+                *s_outstream << "Exception in Environment TearDown()\n";
+            }
+            environments.pop_back();
+        }
+    }
+
+  private:
+    static Environment *s_first;
+    static Environment *s_last;
+};
+
+Environment *EnvironmentList::s_first = 0;
+Environment *EnvironmentList::s_last = 0;
+
+Environment* addEnvironment(Environment *environment)
+{
+    if (environment)
+        EnvironmentList::add(environment);
+    return environment;
+}
+
+#if !defined(__GNUC__)
+/**
+ * The out-of-line sink behind DoNotOptimize() for compilers
+ * without GCC-style inline assembly.
+ */
+void useCharPointer(char const volatile *p)
+{
+    static char const volatile *volatile s_sink;
+    s_sink = p;
+}
+#endif
+
+/**
+ * forceFailure allows a test to force a failure outside of
+ * a normal BTest assertion.
+ */
+std::ostream& forceFailure(int line, char const* file, RegToken token)
+{
+    std::ostream &out = beginFailure(line, file, token);
+    recordTestFailure(token);
+    return out;
+}
+
+/*
+ * The out-of-line ValuePrinters of the common types.
+ */
+#define EMBTEST_VALUE_FORMAT(type)                                   \
+void ValueFormat<type>::print(std::ostream &out, void const *value)  \
+{                                                                    \
+    out << *static_cast<type const*>(value);                         \
+}
+
+EMBTEST_VALUE_FORMAT(bool)
+EMBTEST_VALUE_FORMAT(char)
+EMBTEST_VALUE_FORMAT(signed char)
+EMBTEST_VALUE_FORMAT(unsigned char)
+EMBTEST_VALUE_FORMAT(short)
+EMBTEST_VALUE_FORMAT(unsigned short)
+EMBTEST_VALUE_FORMAT(int)
+EMBTEST_VALUE_FORMAT(unsigned int)
+EMBTEST_VALUE_FORMAT(long)
+EMBTEST_VALUE_FORMAT(unsigned long)
+EMBTEST_VALUE_FORMAT(long long)
+EMBTEST_VALUE_FORMAT(unsigned long long)
+EMBTEST_VALUE_FORMAT(float)
+EMBTEST_VALUE_FORMAT(double)
+EMBTEST_VALUE_FORMAT(long double)
+EMBTEST_VALUE_FORMAT(char const*)
+EMBTEST_VALUE_FORMAT(char*)
+EMBTEST_VALUE_FORMAT(void const*)
+
+#undef EMBTEST_VALUE_FORMAT
+
+void printString(std::ostream &out, char const *text, size_t length)
+{
+    out.write(text, static_cast<std::streamsize>(length));
+}
+
+void ValueFormat<std::nullptr_t>::print(std::ostream &out, void const *)
+{
+    out << "nullptr";
+}
+
+/**
+ * The cold paths of the comparison assertions: all of the
+ * formatting of a failure happens here, out of line.
+ */
+void conditionFailed(bool asserted,
+                     char const* lstr, char const* rstr,
+                     void const* lval, ValuePrinter lprint,
+                     void const* rval, ValuePrinter rprint,
+                     int line, char const* file, char const* oper, RegToken token)
+{
+    std::ostream &out = beginFailure(line, file, token);
+    out << "       : It is " << (asserted ? "asserted":"expected")
+        << " that left " << oper << " right:\n"
+        << "   left: " << lstr << " = ";
+    lprint(out, lval);
+    out << "\n  right: " << rstr << " = ";
+    rprint(out, rval);
+    out << "\n";
+    recordTestFailure(token);
+}
+
+void truthFailed(bool asserted, char const* lstr, char const* expected,
+                 int line, char const* file, RegToken token)
+{
+    beginFailure(line, file, token)
+        << "       : It is " << (asserted ? "asserted":"expected")
+        << " that this is " << expected << ":\n"
+        << "   expr: " << lstr << "\n";
+    recordTestFailure(token);
+}
+
+/*
+ * Death tests
+ */
+bool ExitedWithCode::operator()(int status) const
+{
+#if EMBTEST_HAS_FORK
+    return WIFEXITED(status) && WEXITSTATUS(status) == m_code;
+#else
+    (void)status;
+    return false;
+#endif
+}
+
+bool KilledBySignal::operator()(int status) const
+{
+#if EMBTEST_HAS_FORK
+    return WIFSIGNALED(status) && WTERMSIG(status) == m_signal;
+#else
+    (void)status;
+    return false;
+#endif
+}
+
+bool DiedAbnormally::operator()(int status) const
+{
+#if EMBTEST_HAS_FORK
+    return WIFSIGNALED(status) || (WIFEXITED(status) && WEXITSTATUS(status) != 0);
+#else
+    (void)status;
+    return false;
+#endif
+}
+
+/*
+ * The child's stderr, kept out of the public header.
+ */
+struct DeathTest::Output
+{
+    std::string text;
+};
+
+/*
+ * Fork the child. Its stderr, and a pipe on which it reports a
+ * statement that returned, are read by the parent in wait().
+ */
+DeathTest::DeathTest(char const *statement, char const *regex, int line, char const *file)
+    : m_statement(statement)
+    , m_regex(regex)
+    , m_line(line)
+    , m_file(file)
+    , m_child(false)
+    , m_pid(-1)
+    , m_errFd(-1)
+    , m_outcomeFd(-1)
+    , m_status(0)
+    , m_outcome(0)
+    , m_error(0)
+    , m_stderr(new Output)
+{
+#if EMBTEST_HAS_FORK
+    int errPipe[2];
+    int outcomePipe[2];
+    if (::pipe(errPipe) != 0)
+    {
+        m_error = "cannot create a pipe";
+        return;
+    }
+    if (::pipe(outcomePipe) != 0)
+    {
+        ::close(errPipe[0]);
+        ::close(errPipe[1]);
+        m_error = "cannot create a pipe";
+        return;
+    }
+
+    // Don't let buffered output be written twice.
+    getOutstream().flush();
+    s_outstream->flush();
+    std::cout.flush();
+    std::cerr.flush();
+    std::fflush(0);
+
+    pid_t pid = ::fork();
+    if (pid < 0)
+    {
+        ::close(errPipe[0]);
+        ::close(errPipe[1]);
+        ::close(outcomePipe[0]);
+        ::close(outcomePipe[1]);
+        m_error = "cannot fork";
+        return;
+    }
+
+    if (pid == 0)
+    {
+        m_child = true;
+        ::close(errPipe[0]);
+        ::close(outcomePipe[0]);
+        ::dup2(errPipe[1], 2);
+        ::close(errPipe[1]);
+        m_outcomeFd = outcomePipe[1];
+        return;
+    }
+
+    ::close(errPipe[1]);
+    ::close(outcomePipe[1]);
+    m_pid = pid;
+    m_errFd = errPipe[0];
+    m_outcomeFd = outcomePipe[0];
+#else
+    m_error = "death tests need fork()";
+#endif
+}
+
+DeathTest::~DeathTest()
+{
+#if EMBTEST_HAS_FORK
+    if (m_errFd >= 0)
+        ::close(m_errFd);
+    if (m_outcomeFd >= 0)
+        ::close(m_outcomeFd);
+#endif
+    delete m_stderr;
+}
+
+/*
+ * The statement returned, threw, or left the test, so the child
+ * didn't die. Say so to the parent, and end the child without
+ * running anything else.
+ */
+void DeathTest::childFinished(Outcome outcome)
+{
+#if EMBTEST_HAS_FORK
+    char code = static_cast<char>(outcome);
+    (void)writeFully(m_outcomeFd, &code, 1);
+    std::cerr.flush();
+    ::_exit(1);
+#else
+    (void)outcome;
+#endif
+}
+
+int DeathTest::wait()
+{
+#if EMBTEST_HAS_FORK
+    if (m_pid < 0)
+        return 0;
+
+    char buffer[4096];
+    for (;;)
+    {
+        ssize_t n = ::read(m_errFd, buffer, sizeof(buffer));
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        m_stderr->text.append(buffer, static_cast<size_t>(n));
+    }
+    if (!readFully(m_outcomeFd, &m_outcome, 1))
+        m_outcome = 0;
+    while (::waitpid(m_pid, &m_status, 0) < 0 && errno == EINTR)
+        ;
+#endif
+    return m_status;
+}
+
+bool DeathTest::check(bool asserted, bool statusMatched, char const *predicate, RegToken token)
+{
+    std::string problem = m_error ? m_error : "";
+    if (problem.empty())
+    {
+        if (m_outcome == Returned)
+            problem = "the statement returned without dying";
+        else if (m_outcome == Threw)
+            problem = "the statement threw an exception";
+        else if (m_outcome == LeftTest)
+            problem = "the statement left the test without dying, e.g. by a failed ASSERT_*()";
+        else if (!statusMatched)
+            problem = "the child's exit status doesn't satisfy the predicate";
+        else
+        {
+            try {
+                if (!std::regex_search(m_stderr->text, std::regex(m_regex)))
+                    problem = "the child's stderr doesn't match the regex";
+            }
+            catch (std::regex_error &)
+            {
+                problem = "the regex is invalid";
+            }
+        }
+    }
+    if (problem.empty())
+        return true;
+
+    std::ostream &out = beginFailure(m_line, m_file, token);
+    out << "       : It is " << (asserted ? "asserted":"expected")
+        << " that this dies, but " << problem << ":\n"
+        << "   stmt: " << m_statement << "\n"
+        << "  death: " << predicate << "\n";
+#if EMBTEST_HAS_FORK
+    if (!m_error && !m_outcome)
+    {
+        if (WIFSIGNALED(m_status))
+            out << " status: killed by signal " << WTERMSIG(m_status)
+                << " (" << strsignal(WTERMSIG(m_status)) << ")\n";
+        else
+            out << " status: exited with code " << WEXITSTATUS(m_status) << "\n";
+    }
+#endif
+    out << "  regex: \"" << m_regex << "\"\n"
+        << " stderr: " << m_stderr->text;
+    std::string const &text = m_stderr->text;
+    if (text.empty() || text[text.size() - 1] != '\n')
+        out << "\n";
+    recordTestFailure(token);
+    return false;
+}
+
+AllocationBudget::AllocationBudget(uint64_t maxAllocations, int line, char const *file,
+                                   RegToken token)
+    : m_maxAllocations(maxAllocations)
+    , m_line(line)
+    , m_file(file)
+    , m_token(token)
+    , m_first(true)
+    , m_startAllocations(t_allocationSlot ? t_allocationSlot->allocations : 0)
+    , m_startBytes(t_allocationSlot ? t_allocationSlot->bytes : 0)
+{ }
+
+AllocationBudget::~AllocationBudget()
+{
+    AllocationSlot *slot = t_allocationSlot;
+    if (!slot || slot->allocations - m_startAllocations <= m_maxAllocations)
+        return;
+
+    uint64_t allocations = slot->allocations - m_startAllocations;
+    uint64_t bytes = slot->bytes - m_startBytes;
+    beginFailure(m_line, m_file, m_token)
+        << "       : It is expected that the block allocates at most "
+        << m_maxAllocations << " times:\n"
+        << "  allocations: " << allocations << " (" << bytes << " bytes)\n";
+    recordTestFailure(m_token);
+}
+
+/*
+ * Performance assertions. Each side is timed in batches of calls
+ * long enough to dwarf the clock's resolution, and the sides'
+ * samples are interleaved, alternating which one goes first.
+ */
+static const double PerfBatchNs = 200e3;
+static const double PerfSignificance = 0.001;
+
+struct PerfSide
+{
+    PerfSide(PerfBody body, void *callable)
+        : body(body), callable(callable), iterations(1)
+    { }
+
+    /*
+     * Time one batch, and return the nanoseconds it took.
+     */
+    double timeBatch() const
+    {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        body(callable, iterations);
+        std::chrono::steady_clock::time_point stop = std::chrono::steady_clock::now();
+        return std::chrono::duration<double, std::nano>(stop - start).count();
+    }
+
+    /*
+     * Grow the batch until it takes at least PerfBatchNs.
+     */
+    void calibrate()
+    {
+        for (;;)
+        {
+            double ns = timeBatch();
+            if (ns >= PerfBatchNs || iterations >= (uint64_t(1) << 40))
+                break;
+            double scale = ns > 0 ? 1.2 * PerfBatchNs / ns : 10.0;
+            scale = std::min(10.0, std::max(2.0, scale));
+            iterations = static_cast<uint64_t>(iterations * scale);
+        }
+    }
+
+    PerfBody            body;
+    void               *callable;
+    uint64_t            iterations;   ///< calls per batch
+    std::vector<double> samples;      ///< nanoseconds per call
+};
+
+static void sampleInterleaved(PerfSide *sides, size_t count)
+{
+    unsigned samples = std::max(5u, s_runOptions.perfSamples);
+    for (size_t s=0; s < count; ++s)
+    {
+        sides[s].calibrate();
+        sides[s].samples.reserve(samples);
+    }
+    for (unsigned i=0; i < samples; ++i)
+    {
+        for (size_t s=0; s < count; ++s)
+        {
+            PerfSide &side = sides[(s + i) % count];
+            side.samples.push_back(side.timeBatch() / side.iterations);
+        }
+    }
+}
+
+/*
+ * The \c q quantile of \c sorted, interpolating between samples.
+ */
+static double quantile(std::vector<double> const &sorted, double q)
+{
+    double position = q * (sorted.size() - 1);
+    size_t below = static_cast<size_t>(position);
+    if (below + 1 >= sorted.size())
+        return sorted.back();
+    return sorted[below] + (position - below) * (sorted[below + 1] - sorted[below]);
+}
+
+/*
+ * Describe the distribution of a side's times, sorting them.
+ */
+static std::string describeSamples(PerfSide &side)
+{
+    std::vector<double> &sorted = side.samples;
+    std::sort(sorted.begin(), sorted.end());
+
+    std::ostringstream text;
+    text << std::fixed << std::setprecision(1)
+         << "median " << quantile(sorted, 0.5) << " ns/call (min " << sorted.front()
+         << ", q1 " << quantile(sorted, 0.25) << ", q3 " << quantile(sorted, 0.75)
+         << ", max " << sorted.back() << "; " << sorted.size() << " samples of "
+         << side.iterations << " calls)";
+    return text.str();
+}
+
+/*
+ * One-sided Mann-Whitney U test: the probability of samples \c a
+ * ranking at least this high above samples \c b if both came from
+ * the same distribution. Uses the normal approximation, with tie
+ * and continuity corrections, which holds from about 8 samples.
+ */
+static double mannWhitneyGreater(std::vector<double> const &a, std::vector<double> const &b)
+{
+    std::vector<std::pair<double, bool> > pooled;   // value, and whether from a
+    for (size_t i=0; i < a.size(); ++i)
+        pooled.push_back(std::make_pair(a[i], true));
+    for (size_t i=0; i < b.size(); ++i)
+        pooled.push_back(std::make_pair(b[i], false));
+    std::sort(pooled.begin(), pooled.end());
+
+    double n = static_cast<double>(a.size());
+    double m = static_cast<double>(b.size());
+    double total = n + m;
+    double rankSum = 0;
+    double ties = 0;
+    for (size_t i=0; i < pooled.size(); )
+    {
+        size_t j = i;
+        while (j < pooled.size() && pooled[j].first == pooled[i].first)
+            ++j;
+        double rank = (i + j + 1) / 2.0;            // the average of ranks i+1 .. j
+        for (size_t k=i; k < j; ++k)
+            if (pooled[k].second)
+                rankSum += rank;
+        double tied = static_cast<double>(j - i);
+        ties += tied * tied * tied - tied;
+        i = j;
+    }
+
+    double u = rankSum - n * (n + 1) / 2;
+    double variance = n * m / 12 * ((total + 1) - ties / (total * (total - 1)));
+    if (variance <= 0)
+        return 0.5;                                 // all equal
+    double z = (u - n * m / 2 - 0.5) / std::sqrt(variance);
+    return 0.5 * std::erfc(z / std::sqrt(2.0));
+}
+
+bool checkFasterThan(bool asserted,
+                     char const *bstr, PerfBody baseline, void *baselineCallable,
+                     char const *cstr, PerfBody candidate, void *candidateCallable,
+                     char const *rstr, double ratio,
+                     int line, char const *file, RegToken token)
+{
+    PerfSide sides[2] = { PerfSide(baseline, baselineCallable),
+                          PerfSide(candidate, candidateCallable) };
+    sampleInterleaved(sides, 2);
+
+    std::vector<double> scaled(sides[0].samples);
+    for (size_t i=0; i < scaled.size(); ++i)
+        scaled[i] *= ratio;
+    double p = mannWhitneyGreater(sides[1].samples, scaled);
+    if (p >= PerfSignificance)
+        return true;
+
+    std::string baselineTimes = describeSamples(sides[0]);
+    std::string candidateTimes = describeSamples(sides[1]);
+    double measured = quantile(sides[1].samples, 0.5) / quantile(sides[0].samples, 0.5);
+    beginFailure(line, file, token)
+        << "       : It is " << (asserted ? "asserted" : "expected")
+        << " that candidate takes at most ratio times baseline:\n"
+        << "   baseline: " << bstr << "\n"
+        << "             " << baselineTimes << "\n"
+        << "  candidate: " << cstr << "\n"
+        << "             " << candidateTimes << "\n"
+        << "      ratio: " << rstr << " = " << ratio << ", measured " << measured << "\n"
+        << "    p-value: " << p << " (one-sided Mann-Whitney U)\n";
+    recordTestFailure(token);
+    return false;
+}
+
+bool checkDurationLess(bool asserted,
+                       char const *stmt, PerfBody body, void *callable,
+                       char const *bstr, double budgetNs,
+                       int line, char const *file, RegToken token)
+{
+    PerfSide side(body, callable);
+    sampleInterleaved(&side, 1);
+    std::vector<double> sorted(side.samples);
+    std::sort(sorted.begin(), sorted.end());
+
+    /*
+     * The median is at least the k-th smallest sample with the
+     * confidence 1 - P(Binomial(n, 1/2) < k). Find the largest k
+     * for the significance level.
+     */
+    size_t n = sorted.size();
+    size_t k = 0;
+    double tail = 0;
+    double term = std::pow(0.5, static_cast<double>(n));   // P(Binomial = k)
+    while (k < n && tail + term <= PerfSignificance)
+    {
+        tail += term;
+        term *= static_cast<double>(n - k) / (k + 1);
+        ++k;
+    }
+    if (k == 0 || sorted[k - 1] < budgetNs)
+        return true;
+
+    std::string times = describeSamples(side);
+    beginFailure(line, file, token)
+        << "       : It is " << (asserted ? "asserted" : "expected")
+        << " that this takes less than the budget:\n"
+        << "   stmt: " << stmt << "\n"
+        << " budget: " << bstr << " = " << budgetNs << " ns\n"
+        << "  times: " << times << "\n"
+        << "         the median is at least " << sorted[k - 1]
+        << " ns with " << 100 * (1 - PerfSignificance) << "% confidence\n";
+    recordTestFailure(token);
+    return false;
+}
+
+/*
+ * A timing history file has one line per test, holding its
+ * wall-clock duration in nanoseconds and its full name.
+ */
+static void readHistory(std::string const &path, std::map<std::string, double> &history)
+{
+    std::ifstream in(path.c_str());
+    std::string line;
+    while (std::getline(in, line))
+    {
+        if (line.empty() || line[0] == '#')
+            continue;
+        std::istringstream fields(line);
+        double ns;
+        std::string name;
+        if (fields >> ns >> name)
+            history[name] = ns;
+    }
+}
+
+static bool writeHistory(std::string const &path, std::map<std::string, double> const &history)
+{
+    std::ofstream out(path.c_str());
+    out << "# embtest timing history" << std::endl;
+    for (std::map<std::string, double>::const_iterator it = history.begin();
+         it != history.end(); ++it)
+    {
+        out << static_cast<uint64_t>(it->second) << " " << it->first << "\n";
+    }
+    out.flush();
+    return static_cast<bool>(out);
+}
+
+/*
+ * Identify the build of the running binary by a hash of its
+ * contents, so a journal isn't resumed by a rebuilt binary. Where
+ * the binary can't be read, every build is the same "unknown" one.
+ */
+static std::string buildIdentity()
+{
+    std::ifstream in("/proc/self/exe", std::ios::binary);
+    if (!in)
+        return "unknown";
+
+    uint64_t hash = 14695981039346656037ull;    // FNV-1a
+    char buffer[65536];
+    while (in.read(buffer, sizeof(buffer)) || in.gcount() > 0)
+    {
+        for (std::streamsize i=0; i < in.gcount(); ++i)
+        {
+            hash ^= static_cast<unsigned char>(buffer[i]);
+            hash *= 1099511628211ull;
+        }
+    }
+
+    std::ostringstream id;
+    id << std::hex << std::setw(16) << std::setfill('0') << hash;
+    return id.str();
+}
+
+/*
+ * A run journal starts with a header naming the build that wrote
+ * it, followed by one line per finished test: a status letter and
+ * the test's full name. The last line of a test counts.
+ */
+static char const s_journalHeader[] = "# embtest journal ";
+
+static bool readJournal(std::string const &path, std::string &build,
+                        std::map<std::string, char> &entries)
+{
+    std::ifstream in(path.c_str());
+    std::string line;
+    size_t headerLength = sizeof(s_journalHeader) - 1;
+    if (!std::getline(in, line) || line.compare(0, headerLength, s_journalHeader) != 0)
+        return false;
+    build = line.substr(headerLength);
+    while (std::getline(in, line))
+    {
+        if (line.size() > 2 && line[1] == ' ')
+            entries[line.substr(2)] = line[0];
+    }
+    return true;
+}
+
+/*
+ * Parse an unsigned decimal value, rejecting empty strings
+ * and trailing garbage.
+ */
+static bool parseUnsigned(char const *text, unsigned &value)
+{
+    if (!text || !*text)
+        return false;
+    char *end = 0;
+    unsigned long parsed = std::strtoul(text, &end, 10);
+    if (*end != '\0')
+        return false;
+    value = static_cast<unsigned>(parsed);
+    return true;
+}
+
+/**
+ * Fill in RunOptions from recognized command line arguments,
+ * and remove them from argv.
+ */
+bool parseArguments(int &argc, char **argv, RunOptions &options)
+{
+    bool valid = true;
+
+    // Environment first, so arguments take precedence.
+    if (char const *env = std::getenv("EMBTEST_SHARD_COUNT"))
+        valid = parseUnsigned(env, options.shardCount) && valid;
+    if (char const *env = std::getenv("EMBTEST_SHARD_INDEX"))
+        valid = parseUnsigned(env, options.shardIndex) && valid;
+
+    int kept = 1;
+    for (int i=1; i < argc; ++i)
+    {
+        char const *arg = argv[i];
+        if (std::strncmp(arg, "--jobs=", 7) == 0)
+            valid = parseUnsigned(arg + 7, options.jobs) && valid;
+        else if (std::strncmp(arg, "-j", 2) == 0 && arg[2] >= '0' && arg[2] <= '9')
+            valid = parseUnsigned(arg + 2, options.jobs) && valid;
+        else if (std::strcmp(arg, "-j") == 0 && i + 1 < argc
+                 && argv[i + 1][0] >= '0' && argv[i + 1][0] <= '9')
+            valid = parseUnsigned(argv[++i], options.jobs) && valid;
+        else if (std::strncmp(arg, "--workers=", 10) == 0)
+            valid = parseUnsigned(arg + 10, options.workers) && valid;
+        else if (std::strncmp(arg, "--shard-count=", 14) == 0)
+            valid = parseUnsigned(arg + 14, options.shardCount) && valid;
+        else if (std::strncmp(arg, "--shard-index=", 14) == 0)
+            valid = parseUnsigned(arg + 14, options.shardIndex) && valid;
+        else if (std::strncmp(arg, "--results=", 10) == 0)
+            options.resultsPath = arg + 10;
+        else if (std::strncmp(arg, "--history=", 10) == 0)
+            options.historyPath = arg + 10;
+        else if (std::strncmp(arg, "--slowest=", 10) == 0)
+            valid = parseUnsigned(arg + 10, options.slowestCount) && valid;
+        else if (std::strncmp(arg, "--junit=", 8) == 0)
+            options.junitPath = arg + 8;
+        else if (std::strncmp(arg, "--json=", 7) == 0)
+            options.jsonPath = arg + 7;
+        else if (std::strncmp(arg, "--filter=", 9) == 0)
+            options.filter = arg + 9;
+        else if (std::strcmp(arg, "--list") == 0)
+            options.listTests = true;
+        else if (std::strcmp(arg, "--async-reporting") == 0)
+            options.asyncReporting = true;
+        else if (std::strncmp(arg, "--timeout-ms=", 13) == 0)
+            valid = parseUnsigned(arg + 13, options.testTimeoutMs) && valid;
+        else if (std::strncmp(arg, "--run-timeout-ms=", 17) == 0)
+            valid = parseUnsigned(arg + 17, options.runTimeoutMs) && valid;
+        else if (std::strcmp(arg, "--detect-leaks") == 0)
+            options.detectLeaks = true;
+        else if (std::strncmp(arg, "--perf-samples=", 15) == 0)
+            valid = parseUnsigned(arg + 15, options.perfSamples) && valid;
+        else if (std::strcmp(arg, "--perf-counters") == 0)
+            options.perfCounters = true;
+        else if (std::strcmp(arg, "--benchmarks") == 0)
+            options.benchmarks = true;
+        else if (std::strncmp(arg, "--benchmark-min-ms=", 19) == 0)
+            valid = parseUnsigned(arg + 19, options.benchmarkMinMs) && valid;
+        else if (std::strncmp(arg, "--benchmark-repetitions=", 24) == 0)
+            valid = parseUnsigned(arg + 24, options.benchmarkRepetitions) && valid;
+        else if (std::strncmp(arg, "--journal=", 10) == 0)
+            options.journalPath = arg + 10;
+        else if (std::strcmp(arg, "--resume") == 0)
+            options.resume = true;
+        else if (std::strcmp(arg, "--rerun-failed") == 0)
+            options.rerunFailed = true;
+        else
+            argv[kept++] = argv[i];
+    }
+    argc = kept;
+    argv[argc] = 0;
+
+    if (options.shardCount > 1 && options.shardIndex >= options.shardCount)
+        valid = false;
+    if ((options.resume || options.rerunFailed) && options.journalPath.empty())
+        valid = false;
+    if (options.resume && options.rerunFailed)
+        valid = false;
+    return valid;
+}
+
+/**
+ * Provide a basic function to run everything
+ */
+int runAndReport(std::ostream &out)
+{
+    return runAndReport(out, RunOptions());
+}
+
+int runAndReport(std::ostream &out, RunOptions const &options)
+{
+    s_outstream = &out;
+    s_runOptions = options;
+    TestRegistrar &tests = registrar();
+
+    /*
+     * A timing history balances the shards, and lets parallel runs
+     * start the longest tests first, so a long test starting last
+     * doesn't stretch the run.
+     */
+    std::map<std::string, double> history;
+    if (!options.historyPath.empty())
+        readHistory(options.historyPath, history);
+
+    std::vector<size_t> order;
+    tests.selectTests(options, history, order);
+
+    /*
+     * A journal from an earlier run narrows the selection: resuming
+     * skips the tests it records as finished, provided the same
+     * build wrote it, and rerunning the failed tests keeps only those.
+     */
+    std::string build;
+    bool continueJournal = false;
+    size_t journalFailed = 0;
+    if (!options.journalPath.empty() && !options.benchmarks)
+    {
+        build = buildIdentity();
+        std::string journalBuild;
+        std::map<std::string, char> journal;
+        bool found = readJournal(options.journalPath, journalBuild, journal);
+
+        if (options.resume && found && journalBuild == build)
+        {
+            size_t finished = 0;
+            tests.deselectTests(order, [&journal, &finished, &journalFailed](RegisteredTest const &rt) {
+                std::map<std::string, char>::const_iterator it = journal.find(rt.fullName());
+                if (it == journal.end())
+                    return false;
+                finished++;
+                journalFailed += (it->second == 'F');
+                return true;
+            });
+            continueJournal = true;
+            out << "Resuming " << options.journalPath << ": " << finished
+                << " tests already finished, " << journalFailed << " of them failed" << std::endl;
+        }
+        else if (options.resume && found)
+        {
+            out << "Not resuming " << options.journalPath
+                << ", which is from another build" << std::endl;
+        }
+        else if (options.rerunFailed)
+        {
+            tests.deselectTests(order, [&journal](RegisteredTest const &rt) {
+                std::map<std::string, char>::const_iterator it = journal.find(rt.fullName());
+                return it == journal.end() || it->second != 'F';
+            });
+            out << "Rerunning the " << order.size() << " failed tests in "
+                << options.journalPath << std::endl;
+        }
+    }
+    size_t testCount = order.size();
+
+    if (options.listTests)
+    {
+        tests.listTests(order, out);
+        s_outstream = &std::cout;
+        return 0;
+    }
+
+    // Benchmarks run alone, so they don't disturb each other's timing.
+    unsigned jobs = options.benchmarks ? 1 : options.jobs;
+#if EMBTEST_HAS_THREADS
+    if (jobs == 0)
+        jobs = std::thread::hardware_concurrency();
+#endif
+    if (jobs == 0 || !EMBTEST_HAS_THREADS)
+        jobs = 1;
+    if (jobs > testCount)
+        jobs = testCount > 0 ? static_cast<unsigned>(testCount) : 1;
+
+    unsigned workers = (EMBTEST_HAS_FORK && !options.benchmarks) ? options.workers : 0;
+    if (workers > testCount)
+        workers = static_cast<unsigned>(testCount);
+
+    /*
+     * The console report comes first; any reporters given in the
+     * options see the same events after it.
+     */
+    ConsoleReporter console(out, options.slowestCount);
+    ReporterList reporters;
+    reporters.add(console);
+    for (size_t i=0; i < options.reporters.size(); ++i)
+        reporters.add(*options.reporters[i]);
+
+    std::ofstream junitFile;
+    JUnitReporter junit(junitFile);
+    if (!options.junitPath.empty())
+    {
+        junitFile.open(options.junitPath.c_str());
+        if (junitFile)
+            reporters.add(junit);
+        else
+            out << "Cannot write JUnit report to " << options.junitPath << std::endl;
+    }
+
+    std::ofstream jsonFile;
+    JsonReporter json(jsonFile);
+    if (!options.jsonPath.empty())
+    {
+        jsonFile.open(options.jsonPath.c_str());
+        if (jsonFile)
+            reporters.add(json);
+        else
+            out << "Cannot write JSON report to " << options.jsonPath << std::endl;
+    }
+
+    /*
+     * The journal is appended to, including by the watchdog when it
+     * aborts the run, so the writes of both land at its end.
+     */
+    std::ofstream journalFile;
+    JournalReporter journal(journalFile);
+    if (!build.empty())
+    {
+        if (!continueJournal)
+        {
+            std::ofstream header(options.journalPath.c_str());
+            header << s_journalHeader << build << std::endl;
+        }
+        journalFile.open(options.journalPath.c_str(), std::ios::app);
+        if (journalFile)
+            reporters.add(journal);
+        else
+            out << "Cannot write the journal to " << options.journalPath << std::endl;
+    }
+
+    Reporter *events = &reporters;
+#if EMBTEST_HAS_THREADS
+    std::unique_ptr<AsyncReporter> async;
+    if (options.asyncReporting)
+    {
+        async.reset(new AsyncReporter(reporters));
+        events = async.get();
+    }
+#endif
+
+    RunInfo info;
+    info.testCount = testCount;
+    info.jobs = jobs;
+    info.workers = workers;
+    info.shardIndex = options.shardIndex;
+    info.shardCount = options.shardCount;
+    events->runStarting(info);
+
+    std::vector<size_t> schedule(testCount);
+    for (size_t i=0ul; i<testCount; ++i)
+        schedule[i] = i;
+    if (!history.empty() && (workers > 0 || jobs > 1))
+        tests.scheduleLongestFirst(order, history, schedule);
+
+    /*
+     * Worker processes are timed by the parent. A run in this
+     * process is timed by a watchdog thread, which ends the run
+     * if a test hangs.
+     */
+#if EMBTEST_HAS_THREADS
+    std::unique_ptr<Watchdog> watchdog;
+    if (workers == 0 && (options.testTimeoutMs > 0 || options.runTimeoutMs > 0))
+    {
+        watchdog.reset(new Watchdog(options.testTimeoutMs, options.runTimeoutMs,
+                                    [&tests, &options, &build]() {
+            tests.reportAbort(std::cerr);
+            if (!options.resultsPath.empty())
+            {
+                std::ofstream results(options.resultsPath.c_str());
+                tests.writeResults(results);
+            }
+            if (!build.empty())
+            {
+                std::ofstream journal(options.journalPath.c_str(), std::ios::app);
+                tests.writeJournal(journal);
+            }
+        }));
+        s_watchdog = watchdog.get();
+    }
+#endif
+
+    /*
+     * Environments are set up here, before any worker is forked,
+     * so the workers inherit their state.
+     */
+    std::string environmentError;
+    size_t environmentCount = EnvironmentList::setUp(environmentError);
+
+    if (!environmentError.empty())
+    {
+        tests.failTests(order, environmentError, *events);
+    }
+    else if (workers > 0)
+    {
+        tests.runInWorkers(order, schedule, workers, *events);
+    }
+    else if (jobs > 1)
+    {
+        tests.runParallel(order, schedule, jobs, *events);
+    }
+    else
+    {
+        for (size_t i=0ul; i<testCount; ++i)
+        {
+            tests.runTest(order[i], *events);
+        }
+    }
+
+    // Suites with tests run by the workers may still be set up here.
+    tests.tearDownSuites();
+    EnvironmentList::tearDown(environmentCount);
+
+#if EMBTEST_HAS_THREADS
+    s_watchdog = 0;
+    watchdog.reset();
+#endif
+
+    size_t failedCount = tests.getFailedTestCount();
+    size_t disabledCount = tests.getDisabledTestCount();
+    size_t passedCount = testCount - disabledCount - failedCount;
+
+    RunSummary summary;
+    summary.total = testCount;
+    summary.disabled = disabledCount;
+    summary.failed = failedCount;
+    summary.passed = passedCount;
+    events->runFinished(summary);
+
+    if (!options.historyPath.empty())
+    {
+        tests.updateHistory(history);
+        if (!writeHistory(options.historyPath, history))
+            out << "Cannot write timing history to " << options.historyPath << std::endl;
+    }
+
+    if (!options.resultsPath.empty())
+    {
+        std::ofstream results(options.resultsPath.c_str());
+        if (results)
+            tests.writeResults(results);
+        else
+            out << "Cannot write results to " << options.resultsPath << std::endl;
+    }
 
     // Reset the s_outstream to ensure it's always valid
     s_outstream = &std::cout;
 
-    return (failedCount > 0) ? 1 : 0;
+    // A resumed run also fails for the tests that failed before.
+    return (failedCount + journalFailed > 0) ? 1 : 0;
 }
 
 } // embtest::
@@ -0,0 +1,738 @@
+/*
+ * Reporters built into the embtest library.
+ *
+ * Copyright (c) 2018,2024 Brent Burton
+ *
+ * SDPX-License-Identifier: ISC
+ */
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <iomanip>
+#include <sstream>
+
+#include "embtest_reporters.hpp"
+
+namespace embtest {
+
+/*
+ * Format a duration in nanoseconds as milliseconds.
+ */
+static std::string formatMs(double ns)
+{
+    std::ostringstream text;
+    text << std::fixed << std::setprecision(3) << ns / 1e6 << " ms";
+    return text.str();
+}
+
+ConsoleReporter::ConsoleReporter(std::ostream &out, unsigned slowestCount)
+    : m_out(out)
+    , m_slowestCount(slowestCount)
+{ }
+
+void ConsoleReporter::runStarting(RunInfo const &info)
+{
+    m_out << "Tests starting. " << info.testCount << " tests to run";
+    if (info.shardCount > 1)
+        m_out << " in shard " << info.shardIndex << " of " << info.shardCount;
+    if (info.workers > 0)
+        m_out << " in " << info.workers << " worker processes";
+    else if (info.jobs > 1)
+        m_out << " on " << info.jobs << " threads";
+    m_out << "\n";
+    m_out.flush();
+}
+
+void ConsoleReporter::testStarting(TestInfo const &test)
+{
+    m_out << "[--------] " << test << "\n"
+          << "[running ]\n";
+}
+
+void ConsoleReporter::testOutput(TestInfo const &, std::string const &text)
+{
+    m_out << text;
+}
+
+void ConsoleReporter::testFailure(TestInfo const &, TestFailure const &failure)
+{
+    switch (failure.kind) {
+        case FailureAssertion:
+            m_out << "Failure: (line " << failure.line << ") " << failure.file << "\n";
+            break;
+        case FailureException:
+            m_out << "[EXCEPTED] ";
+            break;
+        case FailureCrash:
+            m_out << "[CRASHED ] ";
+            break;
+        case FailureTimeout:
+            m_out << "[TIMEOUT ] ";
+            break;
+        case FailureLeak:
+            m_out << "[ LEAKED ] ";
+            break;
+        case FailureNotRun:
+            m_out << "[ NOTRUN ] ";
+            break;
+    }
+    m_out << failure.message;
+    m_out.flush();
+}
+
+void ConsoleReporter::testFinished(TestResult const &result)
+{
+    if (result.status == StatusDisabled)
+        return;
+
+    BenchmarkStats const &stats = result.benchmark;
+    if (stats.repetitions > 0)
+    {
+        std::ios::fmtflags flags = m_out.flags();
+        std::streamsize precision = m_out.precision();
+        m_out << "[ BENCH  ] " << std::fixed << std::setprecision(1)
+              << stats.median << " ns/op (MAD " << stats.mad
+              << ", min " << stats.min << ", max " << stats.max << ", "
+              << stats.repetitions << " x " << stats.iterations << " iterations)\n";
+        m_out.flags(flags);
+        m_out.precision(precision);
+        m_benchmarks.push_back(result);
+    }
+
+    if (result.status == StatusFailed)
+    {
+        m_out << "[ FAILED ] " << result.test;
+        m_failed.push_back(result.test);
+    }
+    else
+    {
+        m_out << "[ PASSED ] " << result.test;
+    }
+    char const *separator = " (";
+    if (result.timing.wallNs() > 0)
+    {
+        m_out << separator << formatMs(result.timing.wallNs());
+        separator = ", ";
+    }
+    AllocationStats const &allocations = result.allocations;
+    if (allocations.tracked)
+    {
+        m_out << separator << allocations.allocations << " allocs, "
+              << allocations.bytes << " bytes, peak " << allocations.peakBytes << " bytes";
+        separator = ", ";
+    }
+    if (separator[0] == ',')
+        m_out << ")";
+    m_out << "\n";
+    m_out.flush();
+
+    /*
+     * Keep only the slowest tests, in a heap with the
+     * fastest of them on top.
+     */
+    if (m_slowestCount > 0)
+    {
+        auto faster = [](Slow const &a, Slow const &b) {
+            return a.timing.wallNs() > b.timing.wallNs();
+        };
+        Slow slow = { result.test, result.timing, result.counters };
+        m_slowest.push_back(slow);
+        std::push_heap(m_slowest.begin(), m_slowest.end(), faster);
+        if (m_slowest.size() > m_slowestCount)
+        {
+            std::pop_heap(m_slowest.begin(), m_slowest.end(), faster);
+            m_slowest.pop_back();
+        }
+    }
+}
+
+void ConsoleReporter::runFinished(RunSummary const &summary)
+{
+    m_out << "[  DONE  ]\n";
+
+    if (!m_benchmarks.empty())
+        reportBenchmarks();
+
+    if (!m_failed.empty())
+        reportFailedTests();
+
+    if (!m_slowest.empty())
+        reportSlowestTests();
+
+    m_out << "-- Test results --\n"
+          << " Total tests: " << summary.total << "\n"
+          << " Disabled:    " << summary.disabled << "\n"
+          << " Failed:      " << summary.failed << "\n"
+          << " Passed:      " << summary.passed << "\n";
+    m_out.flush();
+}
+
+/**
+ * Report the measurements of the benchmarks that ran.
+ */
+void ConsoleReporter::reportBenchmarks()
+{
+    std::ios::fmtflags flags = m_out.flags();
+    std::streamsize precision = m_out.precision();
+
+    m_out << "-- Benchmark results --\n"
+          << std::setw(14) << "median ns/op"
+          << std::setw(12) << "MAD"
+          << std::setw(14) << "min"
+          << std::setw(14) << "max"
+          << std::setw(14) << "iterations" << "  benchmark\n";
+    m_out << std::fixed << std::setprecision(1);
+    for (size_t i=0; i < m_benchmarks.size(); ++i)
+    {
+        BenchmarkStats const &stats = m_benchmarks[i].benchmark;
+        m_out << std::setw(14) << stats.median
+              << std::setw(12) << stats.mad
+              << std::setw(14) << stats.min
+              << std::setw(14) << stats.max
+              << std::setw(14) << stats.iterations
+              << "  " << m_benchmarks[i].test << "\n";
+    }
+    m_out.flags(flags);
+    m_out.precision(precision);
+}
+
+/**
+ * Report the test names that failed
+ */
+void ConsoleReporter::reportFailedTests()
+{
+    m_out << "[--------]\n";
+    for (size_t i=0; i < m_failed.size(); ++i)
+        m_out << "[ FAILED ] " << m_failed[i] << "\n";
+    m_out << "[--------]\n";
+}
+
+/**
+ * Report the tests with the longest wall-clock time,
+ * with the time spent in each phase.
+ */
+void ConsoleReporter::reportSlowestTests()
+{
+    static char const *const counterLabels[CounterCount] = {
+        "cycles", "instrs", "br-miss", "cache-miss", "task-clk", "faults", "ctx-sw"
+    };
+
+    std::sort_heap(m_slowest.begin(), m_slowest.end(),
+                   [](Slow const &a, Slow const &b) {
+                       return a.timing.wallNs() > b.timing.wallNs();
+                   });
+
+    // Show the event counters that any of these tests measured.
+    unsigned measured = 0;
+    for (size_t i=0; i < m_slowest.size(); ++i)
+        measured |= m_slowest[i].counters.measured;
+
+    std::ios::fmtflags flags = m_out.flags();
+    std::streamsize precision = m_out.precision();
+
+    m_out << "-- Slowest " << m_slowest.size() << " tests (ms) --\n"
+          << std::setw(10) << "wall" << std::setw(10) << "cpu"
+          << std::setw(10) << "ctor" << std::setw(10) << "SetUp"
+          << std::setw(10) << "body" << std::setw(10) << "TearDown"
+          << std::setw(10) << "dtor";
+    for (int c=0; c < CounterCount; ++c)
+        if ((measured >> c) & 1u)
+            m_out << std::setw(12) << counterLabels[c];
+    m_out << "  test\n";
+    m_out << std::fixed << std::setprecision(3);
+    for (size_t i=0; i < m_slowest.size(); ++i)
+    {
+        TestTiming const &timing = m_slowest[i].timing;
+        m_out << std::setw(10) << timing.wallNs() / 1e6
+              << std::setw(10) << timing.cpuNs() / 1e6;
+        for (int p=0; p < PhaseCount; ++p)
+            m_out << std::setw(10) << timing.phases[p].wallNs / 1e6;
+
+        PerfCounters const &counters = m_slowest[i].counters;
+        for (int c=0; c < CounterCount; ++c)
+        {
+            if (!((measured >> c) & 1u))
+                continue;
+            m_out << std::setw(12);
+            if (!counters.has(static_cast<PerfCounter>(c)))
+                m_out << "-";
+            else if (c == CounterTaskClock)
+                m_out << counters.values[c] / 1e6;
+            else
+                m_out << counters.values[c];
+        }
+        m_out << "  " << m_slowest[i].test << "\n";
+    }
+    m_out.flags(flags);
+    m_out.precision(precision);
+}
+
+/*
+ * Names for the machine-readable reports.
+ */
+static char const* failureKindName(FailureKind kind)
+{
+    switch (kind) {
+        case FailureAssertion: return "assertion";
+        case FailureException: return "exception";
+        case FailureCrash:     return "crash";
+        case FailureTimeout:   return "timeout";
+        case FailureLeak:      return "leak";
+        case FailureNotRun:    return "not_run";
+    }
+    return "unknown";
+}
+
+static char const* statusName(TestStatus status)
+{
+    switch (status) {
+        case StatusPassed:   return "passed";
+        case StatusFailed:   return "failed";
+        case StatusDisabled: return "disabled";
+    }
+    return "unknown";
+}
+
+/**
+ * XmlText streams text escaped for XML content or attributes.
+ * Control characters not allowed in XML 1.0 become '?'.
+ */
+struct XmlText
+{
+    std::string const &text;
+};
+
+static std::ostream& operator<<(std::ostream &out, XmlText const &xml)
+{
+    for (size_t i=0; i < xml.text.size(); ++i)
+    {
+        unsigned char c = static_cast<unsigned char>(xml.text[i]);
+        switch (c) {
+            case '&':  out << "&amp;";  break;
+            case '<':  out << "&lt;";   break;
+            case '>':  out << "&gt;";   break;
+            case '"':  out << "&quot;"; break;
+            case '\'': out << "&apos;"; break;
+            default:
+                if (c < 0x20 && c != '\t' && c != '\n' && c != '\r')
+                    out << '?';
+                else
+                    out << xml.text[i];
+        }
+    }
+    return out;
+}
+
+/**
+ * JsonText streams text as a quoted JSON string.
+ */
+struct JsonText
+{
+    std::string const &text;
+};
+
+static std::ostream& operator<<(std::ostream &out, JsonText const &json)
+{
+    out << '"';
+    for (size_t i=0; i < json.text.size(); ++i)
+    {
+        unsigned char c = static_cast<unsigned char>(json.text[i]);
+        switch (c) {
+            case '"':  out << "\\\""; break;
+            case '\\': out << "\\\\"; break;
+            case '\n': out << "\\n"; break;
+            case '\r': out << "\\r"; break;
+            case '\t': out << "\\t"; break;
+            default:
+                if (c < 0x20)
+                {
+                    char code[8];
+                    std::snprintf(code, sizeof(code), "\\u%04x", c);
+                    out << code;
+                }
+                else
+                    out << json.text[i];
+        }
+    }
+    return out << '"';
+}
+
+JUnitReporter::JUnitReporter(std::ostream &out)
+    : m_out(out)
+    , m_suiteName(0)
+{ }
+
+void JUnitReporter::runStarting(RunInfo const &)
+{
+    m_out << "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+          << "<testsuites name=\"embtest\">\n";
+    m_out.flush();
+}
+
+void JUnitReporter::testOutput(TestInfo const &, std::string const &text)
+{
+    m_output += text;
+}
+
+void JUnitReporter::testFailure(TestInfo const &, TestFailure const &failure)
+{
+    m_failures.push_back(failure);
+}
+
+void JUnitReporter::testFinished(TestResult const &result)
+{
+    std::string suite(result.test.suiteName);
+    std::string name(result.test.testName);
+
+    if (!m_suiteName || std::strcmp(m_suiteName, result.test.suiteName) != 0)
+    {
+        if (m_suiteName)
+            m_out << "  </testsuite>\n";
+        m_out << "  <testsuite name=\"" << XmlText{suite} << "\">\n";
+        m_suiteName = result.test.suiteName;
+    }
+
+    std::ios::fmtflags flags = m_out.flags();
+    std::streamsize precision = m_out.precision();
+    m_out << "    <testcase classname=\"" << XmlText{suite}
+          << "\" name=\"" << XmlText{name}
+          << "\" time=\"" << std::fixed << std::setprecision(6)
+          << result.timing.wallNs() / 1e9 << "\"";
+    m_out.flags(flags);
+    m_out.precision(precision);
+
+    PerfCounters const &counters = result.counters;
+    if (result.status == StatusPassed && m_failures.empty() && m_output.empty() &&
+        !counters.measured)
+    {
+        m_out << "/>\n";
+    }
+    else
+    {
+        m_out << ">\n";
+        if (counters.measured)
+        {
+            m_out << "      <properties>\n";
+            for (int c=0; c < CounterCount; ++c)
+            {
+                if (!counters.has(static_cast<PerfCounter>(c)))
+                    continue;
+                m_out << "        <property name=\"" << perfCounterName(static_cast<PerfCounter>(c))
+                      << "\" value=\"" << counters.values[c] << "\"/>\n";
+            }
+            m_out << "      </properties>\n";
+        }
+        if (result.status == StatusDisabled)
+            m_out << "      <skipped message=\"disabled\"/>\n";
+        for (size_t i=0; i < m_failures.size(); ++i)
+        {
+            TestFailure const &failure = m_failures[i];
+            std::string const &message = failure.message;
+            std::string::size_type begin = message.find_first_not_of(" :");
+            std::string::size_type end = message.find('\n', begin);
+            std::string summary = begin == std::string::npos ?
+                std::string() : message.substr(begin, end - begin);
+            m_out << "      <failure type=\"" << failureKindName(failure.kind)
+                  << "\" message=\"" << XmlText{summary} << "\">";
+            if (failure.file)
+            {
+                std::string location(failure.file);
+                m_out << XmlText{location} << ':' << failure.line << "\n";
+            }
+            m_out << XmlText{message} << "</failure>\n";
+        }
+        if (!m_output.empty())
+            m_out << "      <system-out>" << XmlText{m_output} << "</system-out>\n";
+        m_out << "    </testcase>\n";
+    }
+    m_out.flush();
+
+    m_output.clear();
+    m_failures.clear();
+}
+
+void JUnitReporter::runFinished(RunSummary const &)
+{
+    if (m_suiteName)
+        m_out << "  </testsuite>\n";
+    m_out << "</testsuites>\n";
+    m_out.flush();
+}
+
+JsonReporter::JsonReporter(std::ostream &out)
+    : m_out(out)
+{ }
+
+void JsonReporter::runStarting(RunInfo const &info)
+{
+    m_out << "{\"type\":\"run\",\"version\":\"" << versionString
+          << "\",\"tests\":" << info.testCount
+          << ",\"jobs\":" << info.jobs
+          << ",\"workers\":" << info.workers
+          << ",\"shard_index\":" << info.shardIndex
+          << ",\"shard_count\":" << info.shardCount << "}\n";
+    m_out.flush();
+}
+
+void JsonReporter::testOutput(TestInfo const &, std::string const &text)
+{
+    m_output += text;
+}
+
+void JsonReporter::testFailure(TestInfo const &, TestFailure const &failure)
+{
+    m_failures.push_back(failure);
+}
+
+void JsonReporter::testFinished(TestResult const &result)
+{
+    static char const *const phaseNames[PhaseCount] = {
+        "ctor", "SetUp", "body", "TearDown", "dtor"
+    };
+    std::string suite(result.test.suiteName);
+    std::string name(result.test.testName);
+
+    std::ios::fmtflags flags = m_out.flags();
+    std::streamsize precision = m_out.precision();
+    m_out << std::fixed << std::setprecision(0);
+
+    m_out << "{\"type\":\"test\",\"suite\":" << JsonText{suite}
+          << ",\"name\":" << JsonText{name}
+          << ",\"status\":\"" << statusName(result.status) << "\""
+          << ",\"wall_ns\":" << result.timing.wallNs()
+          << ",\"cpu_ns\":" << result.timing.cpuNs()
+          << ",\"phases_ns\":{";
+    for (int p=0; p < PhaseCount; ++p)
+        m_out << (p ? "," : "") << '"' << phaseNames[p] << "\":"
+              << result.timing.phases[p].wallNs;
+    m_out << "}";
+
+    BenchmarkStats const &stats = result.benchmark;
+    if (stats.repetitions > 0)
+    {
+        m_out << std::setprecision(1)
+              << ",\"benchmark\":{\"median_ns\":" << stats.median
+              << ",\"mad_ns\":" << stats.mad
+              << ",\"min_ns\":" << stats.min
+              << ",\"max_ns\":" << stats.max
+              << ",\"iterations\":" << stats.iterations
+              << ",\"repetitions\":" << stats.repetitions << "}";
+    }
+
+    PerfCounters const &counters = result.counters;
+    if (counters.measured)
+    {
+        m_out << ",\"counters\":{";
+        char const *separator = "";
+        for (int c=0; c < CounterCount; ++c)
+        {
+            if (!counters.has(static_cast<PerfCounter>(c)))
+                continue;
+            m_out << separator << '"' << perfCounterName(static_cast<PerfCounter>(c))
+                  << "\":" << counters.values[c];
+            separator = ",";
+        }
+        m_out << "}";
+    }
+
+    AllocationStats const &allocations = result.allocations;
+    if (allocations.tracked)
+    {
+        m_out << ",\"allocations\":{\"count\":" << allocations.allocations
+              << ",\"bytes\":" << allocations.bytes
+              << ",\"peak_bytes\":" << allocations.peakBytes << "}";
+    }
+
+    m_out << ",\"failures\":[";
+    for (size_t i=0; i < m_failures.size(); ++i)
+    {
+        TestFailure const &failure = m_failures[i];
+        m_out << (i ? "," : "") << "{\"kind\":\"" << failureKindName(failure.kind) << "\"";
+        if (failure.file)
+        {
+            std::string file(failure.file);
+            m_out << ",\"file\":" << JsonText{file} << ",\"line\":" << failure.line;
+        }
+        m_out << ",\"message\":" << JsonText{failure.message} << "}";
+    }
+    m_out << "]";
+    if (!m_output.empty())
+        m_out << ",\"output\":" << JsonText{m_output};
+    m_out << "}\n";
+    m_out.flush();
+
+    m_out.flags(flags);
+    m_out.precision(precision);
+    m_output.clear();
+    m_failures.clear();
+}
+
+void JsonReporter::runFinished(RunSummary const &summary)
+{
+    m_out << "{\"type\":\"summary\",\"total\":" << summary.total
+          << ",\"disabled\":" << summary.disabled
+          << ",\"failed\":" << summary.failed
+          << ",\"passed\":" << summary.passed << "}\n";
+    m_out.flush();
+}
+
+JournalReporter::JournalReporter(std::ostream &out)
+    : m_out(out)
+    , m_notRun(false)
+{ }
+
+void JournalReporter::testFailure(TestInfo const &, TestFailure const &failure)
+{
+    if (failure.kind == FailureNotRun)
+        m_notRun = true;
+}
+
+void JournalReporter::testFinished(TestResult const &result)
+{
+    if (!m_notRun)
+    {
+        writeEntry(m_out, result.status, result.test);
+        m_out.flush();
+    }
+    m_notRun = false;
+}
+
+void JournalReporter::writeEntry(std::ostream &out, TestStatus status, TestInfo const &test)
+{
+    static char const letters[] = { 'P', 'F', 'D' };
+    out << letters[status] << ' ' << test << '\n';
+}
+
+void ReporterList::runStarting(RunInfo const &info)
+{
+    for (size_t i=0; i < m_reporters.size(); ++i)
+        m_reporters[i]->runStarting(info);
+}
+
+void ReporterList::testStarting(TestInfo const &test)
+{
+    for (size_t i=0; i < m_reporters.size(); ++i)
+        m_reporters[i]->testStarting(test);
+}
+
+void ReporterList::testOutput(TestInfo const &test, std::string const &text)
+{
+    for (size_t i=0; i < m_reporters.size(); ++i)
+        m_reporters[i]->testOutput(test, text);
+}
+
+void ReporterList::testFailure(TestInfo const &test, TestFailure const &failure)
+{
+    for (size_t i=0; i < m_reporters.size(); ++i)
+        m_reporters[i]->testFailure(test, failure);
+}
+
+void ReporterList::testFinished(TestResult const &result)
+{
+    for (size_t i=0; i < m_reporters.size(); ++i)
+        m_reporters[i]->testFinished(result);
+}
+
+void ReporterList::runFinished(RunSummary const &summary)
+{
+    for (size_t i=0; i < m_reporters.size(); ++i)
+        m_reporters[i]->runFinished(summary);
+}
+
+#if !defined(EMBTEST_NO_THREADS)
+AsyncReporter::AsyncReporter(Reporter &target)
+    : m_target(target)
+    , m_stopping(false)
+    , m_thread(&AsyncReporter::deliver, this)
+{ }
+
+AsyncReporter::~AsyncReporter()
+{
+    stop();
+}
+
+/*
+ * Events are queued as copies, since the caller's
+ * arguments don't outlive the call.
+ */
+void AsyncReporter::runStarting(RunInfo const &info)
+{
+    Reporter &target = m_target;
+    post([&target, info]() { target.runStarting(info); });
+}
+
+void AsyncReporter::testStarting(TestInfo const &test)
+{
+    Reporter &target = m_target;
+    post([&target, test]() { target.testStarting(test); });
+}
+
+void AsyncReporter::testOutput(TestInfo const &test, std::string const &text)
+{
+    Reporter &target = m_target;
+    post([&target, test, text]() { target.testOutput(test, text); });
+}
+
+void AsyncReporter::testFailure(TestInfo const &test, TestFailure const &failure)
+{
+    Reporter &target = m_target;
+    post([&target, test, failure]() { target.testFailure(test, failure); });
+}
+
+void AsyncReporter::testFinished(TestResult const &result)
+{
+    Reporter &target = m_target;
+    post([&target, result]() { target.testFinished(result); });
+}
+
+void AsyncReporter::runFinished(RunSummary const &summary)
+{
+    Reporter &target = m_target;
+    post([&target, summary]() { target.runFinished(summary); });
+    stop();
+}
+
+void AsyncReporter::post(std::function<void()> const &event)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_events.push_back(event);
+    }
+    m_ready.notify_one();
+}
+
+/*
+ * Deliver what is queued, then end the thread.
+ */
+void AsyncReporter::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_ready.notify_one();
+    if (m_thread.joinable())
+        m_thread.join();
+}
+
+void AsyncReporter::deliver()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    for (;;)
+    {
+        m_ready.wait(lock, [this]() { return m_stopping || !m_events.empty(); });
+        if (m_events.empty())
+            return;
+
+        std::function<void()> event;
+        event.swap(m_events.front());
+        m_events.pop_front();
+
+        lock.unlock();
+        event();
+        lock.lock();
+    }
+}
+#endif
+
+} // embtest::
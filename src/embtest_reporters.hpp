@@ -0,0 +1,188 @@
+/*
+ * Reporters built into the embtest library.
+ *
+ * Copyright (c) 2018,2024 Brent Burton
+ *
+ * SDPX-License-Identifier: ISC
+ */
+#pragma once
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <functional>
+
+#if !defined(EMBTEST_NO_THREADS)
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#endif
+
+#include "embtest_runner.hpp"
+
+namespace embtest {
+
+/**
+ * The ConsoleReporter writes the human-readable report of a run.
+ * Output is flushed when a test finishes or fails and when the
+ * run ends, not on every line.
+ */
+class ConsoleReporter : public Reporter
+{
+  public:
+    ConsoleReporter(std::ostream &out, unsigned slowestCount);
+
+    virtual void runStarting(RunInfo const &info);
+    virtual void testStarting(TestInfo const &test);
+    virtual void testOutput(TestInfo const &test, std::string const &text);
+    virtual void testFailure(TestInfo const &test, TestFailure const &failure);
+    virtual void testFinished(TestResult const &result);
+    virtual void runFinished(RunSummary const &summary);
+
+  private:
+    struct Slow
+    {
+        TestInfo     test;
+        TestTiming   timing;
+        PerfCounters counters;
+    };
+
+    void reportBenchmarks();
+    void reportFailedTests();
+    void reportSlowestTests();
+
+    std::ostream               &m_out;
+    unsigned                    m_slowestCount;
+    std::vector<TestInfo>       m_failed;
+    std::vector<TestResult>     m_benchmarks;
+    std::vector<Slow>           m_slowest;   ///< a min-heap on wall time
+};
+
+/**
+ * The JUnitReporter writes a JUnit XML report. Each test case is
+ * written and flushed as its test finishes, with one testsuite
+ * element per run of consecutive tests from the same suite, so
+ * only the current test is held in memory. A file cut short by a
+ * killed run holds every finished test, and is completed by
+ * appending the closing tags.
+ */
+class JUnitReporter : public Reporter
+{
+  public:
+    explicit JUnitReporter(std::ostream &out);
+
+    virtual void runStarting(RunInfo const &info);
+    virtual void testOutput(TestInfo const &test, std::string const &text);
+    virtual void testFailure(TestInfo const &test, TestFailure const &failure);
+    virtual void testFinished(TestResult const &result);
+    virtual void runFinished(RunSummary const &summary);
+
+  private:
+    std::ostream             &m_out;
+    char const               *m_suiteName;   ///< of the open testsuite, or null
+    std::string               m_output;      ///< of the current test
+    std::vector<TestFailure>  m_failures;    ///< of the current test
+};
+
+/**
+ * The JsonReporter writes JSON Lines: one JSON object per line,
+ * for the start of the run, each finished test, and the final
+ * counts. Each line is flushed as it is written, so every
+ * complete line of a file cut short by a killed run is valid.
+ */
+class JsonReporter : public Reporter
+{
+  public:
+    explicit JsonReporter(std::ostream &out);
+
+    virtual void runStarting(RunInfo const &info);
+    virtual void testOutput(TestInfo const &test, std::string const &text);
+    virtual void testFailure(TestInfo const &test, TestFailure const &failure);
+    virtual void testFinished(TestResult const &result);
+    virtual void runFinished(RunSummary const &summary);
+
+  private:
+    std::ostream             &m_out;
+    std::string               m_output;      ///< of the current test
+    std::vector<TestFailure>  m_failures;    ///< of the current test
+};
+
+/**
+ * The JournalReporter appends one line per finished test to a run
+ * journal: a status letter, 'P'assed, 'F'ailed or 'D'isabled, and
+ * the test's full name. Each line is flushed as it is written, so
+ * a killed run leaves every reported test in the journal. Tests
+ * that didn't start before the run timed out are left out.
+ */
+class JournalReporter : public Reporter
+{
+  public:
+    explicit JournalReporter(std::ostream &out);
+
+    virtual void testFailure(TestInfo const &test, TestFailure const &failure);
+    virtual void testFinished(TestResult const &result);
+
+    /**
+     * Write one journal line for \c test with \c status.
+     */
+    static void writeEntry(std::ostream &out, TestStatus status, TestInfo const &test);
+
+  private:
+    std::ostream &m_out;
+    bool          m_notRun;      ///< the current test never started
+};
+
+/**
+ * A ReporterList passes each event on to every reporter
+ * in the list, in order.
+ */
+class ReporterList : public Reporter
+{
+  public:
+    void add(Reporter &reporter) { m_reporters.push_back(&reporter); }
+
+    virtual void runStarting(RunInfo const &info);
+    virtual void testStarting(TestInfo const &test);
+    virtual void testOutput(TestInfo const &test, std::string const &text);
+    virtual void testFailure(TestInfo const &test, TestFailure const &failure);
+    virtual void testFinished(TestResult const &result);
+    virtual void runFinished(RunSummary const &summary);
+
+  private:
+    std::vector<Reporter*> m_reporters;
+};
+
+#if !defined(EMBTEST_NO_THREADS)
+/**
+ * An AsyncReporter queues events and delivers them to another
+ * reporter on its own thread, in the order they were queued.
+ * runFinished() waits until every event has been delivered.
+ */
+class AsyncReporter : public Reporter
+{
+  public:
+    explicit AsyncReporter(Reporter &target);
+    virtual ~AsyncReporter();
+
+    virtual void runStarting(RunInfo const &info);
+    virtual void testStarting(TestInfo const &test);
+    virtual void testOutput(TestInfo const &test, std::string const &text);
+    virtual void testFailure(TestInfo const &test, TestFailure const &failure);
+    virtual void testFinished(TestResult const &result);
+    virtual void runFinished(RunSummary const &summary);
+
+  private:
+    void post(std::function<void()> const &event);
+    void stop();
+    void deliver();
+
+    Reporter                          &m_target;
+    std::mutex                         m_mutex;
+    std::condition_variable            m_ready;
+    std::deque<std::function<void()> > m_events;
+    bool                               m_stopping;
+    std::thread                        m_thread;
+};
+#endif
+
+} // embtest::
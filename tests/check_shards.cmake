@@ -0,0 +1,52 @@
+# Check that shards are balanced by the timing history when one is
+# given, and dealt round-robin otherwise.
+#
+# Usage: cmake -DTEST_BINARY=path -DWORK_DIR=dir -P check_shards.cmake
+#
+# Copyright (c) 2018,2024 Brent Burton
+#
+# SDPX-License-Identifier: ISC
+
+set(HISTORY "${WORK_DIR}/history.txt")
+
+file(MAKE_DIRECTORY "${WORK_DIR}")
+file(WRITE "${HISTORY}"
+    "# embtest timing history\n"
+    "900000 ByteOrder.byte1\n"
+    "100 ByteOrder.byte2\n"
+    "100 ByteOrder.byte3\n"
+    "100 ByteOrder.byte4\n"
+    "100 ByteOrder.structSize\n")
+
+# List shard INDEX of 2 into VARIABLE, with the extra arguments.
+function(list_shard index variable)
+    execute_process(
+        COMMAND "${TEST_BINARY}" --list --filter=ByteOrder.*
+                --shard-count=2 --shard-index=${index} ${ARGN}
+        RESULT_VARIABLE status
+        OUTPUT_VARIABLE output
+        ERROR_VARIABLE output)
+    if (NOT status EQUAL 0)
+        message(FATAL_ERROR "Listing shard ${index} failed:\n${output}")
+    endif()
+    string(REGEX REPLACE "[ \n]+" " " output "${output}")
+    string(STRIP "${output}" output)
+    set(${variable} "${output}" PARENT_SCOPE)
+endfunction()
+
+function(expect actual expected)
+    if (NOT actual STREQUAL expected)
+        message(FATAL_ERROR "Expected \"${expected}\", got \"${actual}\"")
+    endif()
+endfunction()
+
+# The long test alone takes as long as the other four.
+list_shard(0 first --history=${HISTORY})
+list_shard(1 second --history=${HISTORY})
+expect("${first}" "ByteOrder. byte1")
+expect("${second}" "ByteOrder. byte2 byte3 byte4 structSize")
+
+list_shard(0 first)
+list_shard(1 second)
+expect("${first}" "ByteOrder. byte1 byte3 structSize")
+expect("${second}" "ByteOrder. byte2 byte4")
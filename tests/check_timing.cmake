@@ -0,0 +1,43 @@
+# Check that passing tests are reported with their duration, and
+# recorded in the timing history, when run in parallel.
+#
+# Usage: cmake -DTEST_BINARY=path -DMODE=--jobs=2 -DWORK_DIR=dir -P check_timing.cmake
+#
+# Copyright (c) 2018,2024 Brent Burton
+#
+# SDPX-License-Identifier: ISC
+
+set(TESTS byte1 byte2 byte3 byte4 structSize)
+set(HISTORY "${WORK_DIR}/history.txt")
+set(JSON "${WORK_DIR}/results.json")
+
+file(MAKE_DIRECTORY "${WORK_DIR}")
+file(REMOVE "${HISTORY}" "${JSON}")
+
+execute_process(
+    COMMAND "${TEST_BINARY}" --filter=ByteOrder.* ${MODE}
+            --history=${HISTORY} --json=${JSON}
+    RESULT_VARIABLE status
+    OUTPUT_VARIABLE output
+    ERROR_VARIABLE output)
+if (NOT status EQUAL 0)
+    message(FATAL_ERROR "${TEST_BINARY} ${MODE} failed:\n${output}")
+endif()
+
+file(READ "${HISTORY}" history)
+file(READ "${JSON}" json)
+foreach(test ${TESTS})
+    if (NOT output MATCHES "\\[ PASSED \\] ByteOrder\\.${test} \\(([0-9.]+) ms")
+        message(FATAL_ERROR "No duration for ByteOrder.${test}:\n${output}")
+    endif()
+    if (CMAKE_MATCH_1 STREQUAL "0.000")
+        message(FATAL_ERROR "ByteOrder.${test} reported as taking 0 ms:\n${output}")
+    endif()
+    if (NOT history MATCHES "(^|\n)([0-9.e+]+) ByteOrder\\.${test}\n" OR CMAKE_MATCH_2 EQUAL 0)
+        message(FATAL_ERROR "No history entry for ByteOrder.${test}:\n${history}")
+    endif()
+    if (NOT json MATCHES "\"name\":\"${test}\",\"status\":\"passed\",\"wall_ns\":([0-9.e+]+)"
+        OR CMAKE_MATCH_1 EQUAL 0)
+        message(FATAL_ERROR "No wall_ns for ByteOrder.${test}:\n${json}")
+    endif()
+endforeach()
@@ -6,7 +6,7 @@
  * SDPX-License-Identifier: ISC
  */
 #include <iostream>
-#include "embtest.hpp"
+#include "embtest_runner.hpp"
 
 int main(int argc, char **argv)
 {
@@ -18,8 +18,19 @@ int main(int argc, char **argv)
      *
      * embtest::runAndReport() accepts a std::ostream& so that all test
      * output can be redirected as necessry.
+     *
+     * embtest::parseArguments() picks up run options such as --jobs=N.
      */
-    int result = embtest::runAndReport(std::cout);
+    embtest::RunOptions options;
+    if (!embtest::parseArguments(argc, argv, options))
+    {
+        std::cerr << "Invalid arguments" << std::endl;
+        return 2;
+    }
+
+    int result = embtest::runAndReport(std::cout, options);
+    if (options.listTests)
+        return result;
 
     std::cout
         << std::endl
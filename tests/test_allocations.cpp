@@ -0,0 +1,37 @@
+/*
+ * Example unit test for the embtest library.
+ *
+ * Copyright (c) 2018,2024 Brent Burton
+ *
+ * SDPX-License-Identifier: ISC
+ */
+#include <memory>
+#include <vector>
+#include "embtest.hpp"
+
+TEST(Allocations, noAllocations)
+{
+    int sum = 0;
+    EXPECT_NO_ALLOCATIONS {
+        for (int i=0; i < 10; ++i)
+            sum += i;
+        embtest::DoNotOptimize(sum);
+    }
+    EXPECT_EQ(45, sum);
+}
+
+TEST(Allocations, withinBudget)
+{
+    EXPECT_MAX_ALLOCATIONS(1) {
+        std::unique_ptr<int> value(new int(42));
+        EXPECT_EQ(42, *value);
+    }
+}
+
+TEST(Allocations, overBudget_ShouldFail)
+{
+    EXPECT_NO_ALLOCATIONS {
+        std::vector<int> values(16);
+        embtest::DoNotOptimize(values.data());
+    }
+}
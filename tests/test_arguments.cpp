@@ -0,0 +1,40 @@
+/*
+ * Example unit test for the embtest library.
+ *
+ * Copyright (c) 2018,2024 Brent Burton
+ *
+ * SDPX-License-Identifier: ISC
+ */
+#include <cstring>
+#include "embtest_runner.hpp"
+
+TEST(Arguments, jobsForms)
+{
+    char prog[] = "prog", j4[] = "-j4", j[] = "-j", two[] = "2";
+    char *argv[] = { prog, j4, 0 };
+    int argc = 2;
+    embtest::RunOptions options;
+    ASSERT_TRUE(embtest::parseArguments(argc, argv, options));
+    EXPECT_EQ(options.jobs, 4u);
+    EXPECT_EQ(argc, 1);
+
+    char *spaced[] = { prog, j, two, 0 };
+    argc = 3;
+    ASSERT_TRUE(embtest::parseArguments(argc, spaced, options));
+    EXPECT_EQ(options.jobs, 2u);
+    EXPECT_EQ(argc, 1);
+}
+
+TEST(Arguments, applicationDashJLeftAlone)
+{
+    char prog[] = "prog", json[] = "-json", jitter[] = "-jitter", j[] = "-j", x[] = "x";
+    char *argv[] = { prog, json, jitter, j, x, 0 };
+    int argc = 5;
+    embtest::RunOptions options;
+    ASSERT_TRUE(embtest::parseArguments(argc, argv, options));
+    EXPECT_EQ(options.jobs, 1u);
+    ASSERT_EQ(argc, 5);
+    EXPECT_EQ(std::strcmp(argv[1], "-json"), 0);
+    EXPECT_EQ(std::strcmp(argv[2], "-jitter"), 0);
+    EXPECT_EQ(std::strcmp(argv[3], "-j"), 0);
+}
@@ -5,6 +5,7 @@
  *
  * SDPX-License-Identifier: ISC
  */
+#include <string>
 #include "embtest.hpp"
 
 // ---- Boolean
@@ -192,3 +193,18 @@ TEST(AssertionFail, UnsignedAssertGE_ShouldFail)
 {
     ASSERT_GE(0u, 1u);
 }
+
+// ---- strings and enums
+
+enum class Direction { Up, Down };
+
+TEST(AssertionFail, StringExpectEQ_ShouldFail)
+{
+    std::string hello("hello");
+    EXPECT_EQ(hello, "world");
+}
+
+TEST(AssertionFail, ScopedEnumExpectEQ_ShouldFail)
+{
+    EXPECT_EQ(Direction::Up, Direction::Down);
+}
@@ -5,6 +5,7 @@
  *
  * SDPX-License-Identifier: ISC
  */
+#include <string>
 #include "embtest.hpp"
 
 // ---- Boolean
@@ -192,3 +193,27 @@ TEST(AssertionPass, UnsignedAssertGT)
 {
     ASSERT_GT(1u, 0u);
 }
+
+// ---- strings, pointers and enums
+
+enum class Direction { Up, Down };
+
+TEST(AssertionPass, StringExpectEQ)
+{
+    std::string hello("hello");
+    EXPECT_EQ(hello, "hello");
+}
+
+TEST(AssertionPass, PointerExpectEQ)
+{
+    int value = 0;
+    int *pointer = &value;
+    int *none = nullptr;
+    EXPECT_EQ(pointer, &value);
+    EXPECT_EQ(none, nullptr);
+}
+
+TEST(AssertionPass, ScopedEnumExpectNE)
+{
+    EXPECT_NE(Direction::Up, Direction::Down);
+}
@@ -0,0 +1,66 @@
+/*
+ * Example benchmarks for the embtest library. These only run
+ * when the test program is given --benchmarks.
+ *
+ * Copyright (c) 2018,2024 Brent Burton
+ *
+ * SDPX-License-Identifier: ISC
+ */
+#include <string>
+#include <vector>
+#include <ostream>
+#include "embtest.hpp"
+
+BENCHMARK(Benchmarks, emptyLoop)
+{
+    embtest::ClobberMemory();
+}
+
+BENCHMARK(Benchmarks, stringConcat)
+{
+    std::string s = std::string("Hello, ") + "world";
+    embtest::DoNotOptimize(s);
+}
+
+BENCHMARK(Benchmarks, vectorPushBack)
+{
+    std::vector<int> v;
+    for (int i=0; i < 64; ++i)
+        v.push_back(i);
+    embtest::DoNotOptimize(v.data());
+    ASSERT_EQ(v.size(), 64u);
+}
+
+/*
+ * Passing assertions should cost about a compare and a branch,
+ * and never copy their operands. The first benchmark makes a
+ * thousand assertions per iteration.
+ */
+static std::vector<int> const s_ints(1000, 7);
+
+struct Samples
+{
+    std::vector<int> values;
+
+    bool operator==(Samples const &other) const { return values == other.values; }
+};
+
+static std::ostream& operator<<(std::ostream &out, Samples const &samples)
+{
+    return out << samples.values.size() << " samples";
+}
+
+static Samples s_expected = { std::vector<int>(1000, 7) };
+static Samples s_actual = { std::vector<int>(1000, 7) };
+
+BENCHMARK(Assertions, thousandExpectEq)
+{
+    for (size_t i=0; i < s_ints.size(); ++i)
+        EXPECT_EQ(s_ints[i], 7);
+}
+
+BENCHMARK(Assertions, expectEqLargeOperands)
+{
+    embtest::ClobberMemory();
+    EXPECT_EQ(s_actual, s_expected);
+}
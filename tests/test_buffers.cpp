@@ -0,0 +1,75 @@
+/*
+ * Example unit test for the embtest library.
+ *
+ * Copyright (c) 2018,2024 Brent Burton
+ *
+ * SDPX-License-Identifier: ISC
+ */
+#include <array>
+#include <cstdint>
+#include <list>
+#include <string>
+#include <vector>
+#include "embtest.hpp"
+
+static std::vector<uint8_t> frame(size_t size)
+{
+    std::vector<uint8_t> bytes(size);
+    for (size_t i=0; i < size; ++i)
+        bytes[i] = static_cast<uint8_t>(i * 7);
+    return bytes;
+}
+
+TEST(Buffers, bytesEqual)
+{
+    std::vector<uint8_t> decoded = frame(1 << 20);
+    std::vector<uint8_t> expected = frame(1 << 20);
+    EXPECT_BYTES_EQ(decoded.data(), expected.data(), decoded.size());
+}
+
+TEST(Buffers, rangesEqual)
+{
+    std::vector<int> values = { 1, 2, 3, 4 };
+    std::array<int, 4> expected = {{ 1, 2, 3, 4 }};
+    int array[4] = { 1, 2, 3, 4 };
+    EXPECT_RANGE_EQ(values, expected);
+    EXPECT_RANGE_EQ(array, values);
+}
+
+TEST(Buffers, rangesOfStringsEqual)
+{
+    std::list<std::string> names = { "left", "right" };
+    std::vector<std::string> expected = { "left", "right" };
+    EXPECT_RANGE_EQ(names, expected);
+}
+
+TEST(Buffers, bytesDiffer_ShouldFail)
+{
+    std::vector<uint8_t> decoded = frame(1 << 20);
+    std::vector<uint8_t> expected = frame(1 << 20);
+    decoded[100000] ^= 0xff;
+    decoded[100003] ^= 0x01;
+    EXPECT_BYTES_EQ(decoded.data(), expected.data(), decoded.size());
+}
+
+TEST(Buffers, rangeElementsDiffer_ShouldFail)
+{
+    std::vector<uint16_t> samples(4096, 0x1234);
+    std::vector<uint16_t> expected(4096, 0x1234);
+    samples[1000] = 0x1235;
+    EXPECT_RANGE_EQ(samples, expected);
+}
+
+TEST(Buffers, rangeSizesDiffer_ShouldFail)
+{
+    std::vector<int> values = { 1, 2, 3 };
+    std::vector<int> expected = { 1, 2, 3, 4 };
+    EXPECT_RANGE_EQ(values, expected);
+}
+
+TEST(Buffers, rangeOfStringsDiffer_ShouldFail)
+{
+    std::list<std::string> names = { "left", "middle", "right" };
+    std::vector<std::string> expected = { "left", "centre", "right" };
+    EXPECT_RANGE_EQ(names, expected);
+}
@@ -0,0 +1,44 @@
+/*
+ * Example death tests for the embtest library.
+ *
+ * Copyright (c) 2018,2024 Brent Burton
+ *
+ * SDPX-License-Identifier: ISC
+ */
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include "embtest.hpp"
+
+static void crashWithMessage()
+{
+    std::fprintf(stderr, "fatal: table corrupted\n");
+    std::abort();
+}
+
+TEST(DeathTest, abortIsDeath)
+{
+    EXPECT_DEATH(crashWithMessage(), "table corrupted");
+}
+
+TEST(DeathTest, nullWrite)
+{
+    ASSERT_DEATH(*((volatile int*)0) = 42, "");
+}
+
+TEST(DeathTest, exitCode)
+{
+    EXPECT_EXIT(std::exit(3), embtest::ExitedWithCode(3), "");
+    EXPECT_EXIT(std::raise(SIGTERM), embtest::KilledBySignal(SIGTERM), "");
+}
+
+TEST(DeathTest, survives_ShouldFail)
+{
+    EXPECT_DEATH(std::puts("still alive"), "");
+}
+
+TEST(DeathTest, assertLeavesTest_ShouldFail)
+{
+    EXPECT_DEATH({ ASSERT_TRUE(false); std::abort(); }, "");
+    std::puts("the parent goes on after the death test");
+}
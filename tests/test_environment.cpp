@@ -0,0 +1,43 @@
+/*
+ * Example global environment for the embtest library.
+ *
+ * Copyright (c) 2018,2024 Brent Burton
+ *
+ * SDPX-License-Identifier: ISC
+ */
+#include "embtest_runner.hpp"
+
+/**
+ * A global environment builds read-only state once for the
+ * whole run. Worker processes inherit it from the parent.
+ */
+class CubeEnvironment: public embtest::Environment
+{
+  public:
+    virtual void SetUp()
+    {
+        for (int i=0; i < 8; ++i)
+            s_cubes[i] = i * i * i;
+        s_ready = true;
+    }
+
+    virtual void TearDown()
+    {
+        s_ready = false;
+    }
+
+    static bool s_ready;
+    static int  s_cubes[8];
+};
+
+bool CubeEnvironment::s_ready = false;
+int  CubeEnvironment::s_cubes[8];
+
+static CubeEnvironment s_cubeEnvironment;
+static embtest::Environment *s_addedCubes = embtest::addEnvironment(&s_cubeEnvironment);
+
+TEST(Environment, isSetUp)
+{
+    ASSERT_TRUE(CubeEnvironment::s_ready);
+    EXPECT_EQ(CubeEnvironment::s_cubes[2], 8);
+}
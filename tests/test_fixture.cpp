@@ -52,3 +52,45 @@ TEST_F(ByteOrder, structSize)
 {
     EXPECT_EQ(sizeof(m_intBytes), sizeof(int));
 }
+
+/**
+ * A fixture with state shared by all of its tests. The table
+ * is built once, before the first test of the suite runs, and
+ * released after the last one.
+ */
+class SquareTable: public embtest::Test
+{
+  public:
+    static void SetUpTestSuite()
+    {
+        s_setUpCount++;
+        s_squares = new int[16];
+        for (int i=0; i < 16; ++i)
+            s_squares[i] = i * i;
+    }
+
+    static void TearDownTestSuite()
+    {
+        delete[] s_squares;
+        s_squares = 0;
+    }
+
+  protected:
+    static int  s_setUpCount;
+    static int *s_squares;
+};
+
+int  SquareTable::s_setUpCount = 0;
+int *SquareTable::s_squares = 0;
+
+TEST_F(SquareTable, sharedTable)
+{
+    ASSERT_TRUE(s_squares != 0);
+    EXPECT_EQ(s_squares[3], 9);
+}
+
+TEST_F(SquareTable, setUpOnce)
+{
+    ASSERT_TRUE(s_squares != 0);
+    EXPECT_EQ(s_setUpCount, 1);
+}
@@ -0,0 +1,103 @@
+/*
+ * Example unit test for the embtest library.
+ *
+ * Copyright (c) 2018,2024 Brent Burton
+ *
+ * SDPX-License-Identifier: ISC
+ */
+#include <cmath>
+#include <limits>
+#include <vector>
+#include "embtest.hpp"
+
+template <typename T>
+static std::vector<T> wave(size_t size)
+{
+    std::vector<T> values(size);
+    for (size_t i=0; i < size; ++i)
+        values[i] = static_cast<T>(std::sin(i * 0.001) * 100);
+    return values;
+}
+
+TEST(FloatArrays, fpeq)
+{
+    EXPECT_FPEQ(0.1 + 0.2, 0.3, 1e-6f);
+    ASSERT_FPEQ(1.0f / 3, 0.333333f, 1e-6f);
+}
+
+TEST(FloatArrays, nearFloats)
+{
+    std::vector<float> computed = wave<float>(1 << 20);
+    std::vector<float> expected = wave<float>(1 << 20);
+    for (size_t i=0; i < computed.size(); i += 3)
+        computed[i] *= 1.000001f;
+    computed[7] = expected[7] = std::numeric_limits<float>::infinity();
+    EXPECT_ARRAY_NEAR(computed.data(), expected.data(), computed.size(), 0, 1e-5);
+}
+
+TEST(FloatArrays, nearDoubles)
+{
+    std::vector<double> computed = wave<double>(1001);
+    std::vector<double> expected = wave<double>(1001);
+    computed[1000] += 1e-9;
+    ASSERT_ARRAY_NEAR(computed.data(), expected.data(), computed.size(), 1e-8, 0);
+}
+
+/**
+ * A NaN tolerance caps the allowance at the largest finite value,
+ * on every CPU, so only infinities and NaNs in the arrays fail.
+ */
+TEST(FloatArrays, nanTolerance)
+{
+    float const nan = std::numeric_limits<float>::quiet_NaN();
+    std::vector<float> computed = wave<float>(1003);
+    std::vector<float> expected = wave<float>(1003);
+    computed[500] += 50.0f;
+    EXPECT_ARRAY_NEAR(computed.data(), expected.data(), computed.size(), nan, 0);
+
+    std::vector<double> doubles = wave<double>(1003);
+    std::vector<double> expectedDoubles = wave<double>(1003);
+    doubles[0] = -doubles[1002];
+    EXPECT_ARRAY_NEAR(doubles.data(), expectedDoubles.data(), doubles.size(), 0,
+                      std::numeric_limits<double>::quiet_NaN());
+}
+
+TEST(FloatArrays, withinUlps)
+{
+    std::vector<float> computed = wave<float>(1003);
+    std::vector<float> expected = wave<float>(1003);
+    computed[5] = std::nextafter(computed[5], 1000.0f);
+    computed[1002] = std::nextafter(computed[1002], -1000.0f);
+    computed[0] = -0.0f;
+    EXPECT_ARRAY_ULPS(computed.data(), expected.data(), computed.size(), 1);
+
+    std::vector<double> doubles = wave<double>(1003);
+    std::vector<double> expectedDoubles = wave<double>(1003);
+    doubles[999] = std::nextafter(std::nextafter(doubles[999], 0.0), 0.0);
+    EXPECT_ARRAY_ULPS(doubles.data(), expectedDoubles.data(), doubles.size(), 2);
+}
+
+TEST(FloatArrays, fpeq_ShouldFail)
+{
+    EXPECT_FPEQ(0.1 + 0.2, 0.31, 1e-6f);
+}
+
+TEST(FloatArrays, nearFloats_ShouldFail)
+{
+    std::vector<float> computed = wave<float>(1 << 20);
+    std::vector<float> expected = wave<float>(1 << 20);
+    computed[1000] += 0.5f;
+    computed[2000] += 0.005f;
+    computed[3000] = std::numeric_limits<float>::quiet_NaN();
+    EXPECT_ARRAY_NEAR(computed.data(), expected.data(), computed.size(), 1e-4, 1e-5);
+}
+
+TEST(FloatArrays, ulpsDoubles_ShouldFail)
+{
+    std::vector<double> computed = wave<double>(100000);
+    std::vector<double> expected = wave<double>(100000);
+    for (size_t i=0; i < computed.size(); i += 1000)
+        computed[i] = std::nextafter(std::nextafter(computed[i], 1000.0), 1000.0);
+    computed[5000] = -computed[5000];
+    EXPECT_ARRAY_ULPS(computed.data(), expected.data(), computed.size(), 1);
+}
@@ -5,6 +5,7 @@
  *
  * SDPX-License-Identifier: ISC
  */
+#include <ostream>
 #include <stdexcept>
 #include "embtest.hpp"
 
@@ -0,0 +1,182 @@
+/*
+ * Example value-parameterized tests for the embtest library.
+ *
+ * Copyright (c) 2018,2024 Brent Burton
+ *
+ * SDPX-License-Identifier: ISC
+ */
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#if !defined(EMBTEST_NO_THREADS)
+#include <thread>
+#endif
+#include "embtest.hpp"
+
+/**
+ * A fixture for value-parameterized tests derives from
+ * embtest::TestWithParam<T>. Each case reads its value with
+ * GetParam().
+ */
+class Squares: public embtest::TestWithParam<int>
+{
+};
+
+TEST_P(Squares, nonNegative)
+{
+    int n = GetParam();
+    EXPECT_GE(n * n, 0);
+}
+
+TEST_P(Squares, belowCube)
+{
+    int n = GetParam();
+    EXPECT_LE(n * n, n * n * n);
+}
+
+INSTANTIATE_TEST_SUITE_P(Small, Squares, embtest::Range(1, 10));
+INSTANTIATE_TEST_SUITE_P(Picked, Squares, embtest::Values(100, 1000));
+
+class Words: public embtest::TestWithParam<std::string>
+{
+};
+
+TEST_P(Words, notEmpty)
+{
+    EXPECT_FALSE(GetParam().empty());
+}
+
+static char const *const s_words[] = { "alpha", "beta", "gamma" };
+
+INSTANTIATE_TEST_SUITE_P(Greek, Words, embtest::ValuesIn(s_words));
+
+class Grid: public embtest::TestWithParam<std::tuple<int, bool> >
+{
+};
+
+TEST_P(Grid, combined)
+{
+    int width = std::get<0>(GetParam());
+    bool wide = std::get<1>(GetParam());
+    EXPECT_TRUE(width > 0);
+    EXPECT_TRUE(wide || width < 8);
+}
+
+INSTANTIATE_TEST_SUITE_P(All, Grid,
+                         embtest::Combine(embtest::Values(1, 2, 4), embtest::Bool()));
+INSTANTIATE_TEST_SUITE_P(Latin, Words, embtest::Values("lorem", "ipsum"));
+
+/**
+ * Combine() builds each value as the parameter type, so a struct
+ * with a matching constructor works as well as a std::tuple.
+ */
+struct Extent
+{
+    Extent(int w, int h) : width(w), height(h) {}
+
+    int width;
+    int height;
+};
+
+class Extents: public embtest::TestWithParam<Extent>
+{
+};
+
+TEST_P(Extents, area)
+{
+    EXPECT_GT(GetParam().width * GetParam().height, 0);
+    EXPECT_LT(GetParam().width, 4);
+}
+
+INSTANTIATE_TEST_SUITE_P(Few, Extents,
+                         embtest::Combine(embtest::Range(1, 4), embtest::Values(2, 3)));
+
+/**
+ * Assertions in a fixture's static members, and in lambdas that
+ * don't capture the test, are of the running case.
+ */
+class Shared: public embtest::TestWithParam<int>
+{
+  public:
+    static void SetUpTestSuite()
+    {
+        s_base = 10;
+        EXPECT_EQ(s_base, 10);
+    }
+
+  protected:
+    static int s_base;
+};
+
+int Shared::s_base = 0;
+
+TEST_P(Shared, staticSetUpAsserts)
+{
+    EXPECT_EQ(s_base + GetParam(), 10 + GetParam());
+}
+
+#if !defined(EMBTEST_NO_THREADS)
+TEST_P(Shared, helperThreadAsserts)
+{
+    int n = GetParam();
+    std::thread helper([n] { EXPECT_GE(n, 0); });
+    helper.join();
+}
+#endif
+
+INSTANTIATE_TEST_SUITE_P(Few, Shared, embtest::Values(0, 1, 2));
+
+class HelperFails: public embtest::TestWithParam<int>
+{
+};
+
+#if !defined(EMBTEST_NO_THREADS)
+TEST_P(HelperFails, helperThread_ShouldFail)
+{
+    int n = GetParam();
+    std::thread helper([n] { EXPECT_LT(n, 0); });
+    helper.join();
+}
+#endif
+
+INSTANTIATE_TEST_SUITE_P(One, HelperFails, embtest::Values(7));
+
+TEST(Generators, rangeSizes)
+{
+    EXPECT_EQ(embtest::Range(0, 10).size(), 10u);
+    EXPECT_EQ(embtest::Range(0, 10, 3).size(), 4u);
+    EXPECT_EQ(embtest::Range(-5, 5, 5).size(), 2u);
+    EXPECT_EQ(embtest::Range(5, 5).size(), 0u);
+    EXPECT_EQ(embtest::Range(10, 0).size(), 0u);
+    EXPECT_EQ(embtest::Range(0u, 100000u).size(), 100000u);
+
+    embtest::RangeGenerator<double> tenths = embtest::Range(0.0, 1.0, 0.1);
+    ASSERT_EQ(tenths.size(), 10u);
+    EXPECT_LT(tenths.at(9), 1.0);
+    EXPECT_EQ(embtest::Range(0.0, 1.05, 0.1).size(), 11u);
+}
+
+TEST(Generators, rangeRejectsNonPositiveStep)
+{
+    bool thrown = false;
+    try
+    {
+        embtest::Range(0, 10, 0);
+    }
+    catch (std::invalid_argument &)
+    {
+        thrown = true;
+    }
+    EXPECT_TRUE(thrown);
+
+    thrown = false;
+    try
+    {
+        embtest::Range(10, 0, -1);
+    }
+    catch (std::invalid_argument &)
+    {
+        thrown = true;
+    }
+    EXPECT_TRUE(thrown);
+}
@@ -0,0 +1,43 @@
+/*
+ * Example unit test for the embtest library.
+ *
+ * Copyright (c) 2018,2024 Brent Burton
+ *
+ * SDPX-License-Identifier: ISC
+ */
+#include <chrono>
+#include "embtest.hpp"
+
+static void sumTen()
+{
+    unsigned sum = 0;
+    for (unsigned i=0; i < 10; ++i)
+        embtest::DoNotOptimize(sum += i);
+}
+
+static void sumThousand()
+{
+    unsigned sum = 0;
+    for (unsigned i=0; i < 1000; ++i)
+        embtest::DoNotOptimize(sum += i);
+}
+
+TEST(Performance, fasterThan)
+{
+    EXPECT_FASTER_THAN(sumThousand, sumTen, 0.5);
+}
+
+TEST(Performance, durationWithinBudget)
+{
+    EXPECT_DURATION_LT(sumTen(), std::chrono::milliseconds(1));
+}
+
+TEST(Performance, slower_ShouldFail)
+{
+    EXPECT_FASTER_THAN(sumTen, sumThousand, 1.0);
+}
+
+TEST(Performance, overBudget_ShouldFail)
+{
+    EXPECT_DURATION_LT(sumThousand(), std::chrono::nanoseconds(1));
+}
@@ -0,0 +1,50 @@
+/*
+ * Example unit test for the embtest library.
+ *
+ * Copyright (c) 2018,2024 Brent Burton
+ *
+ * SDPX-License-Identifier: ISC
+ */
+#if !defined(EMBTEST_NO_THREADS)
+#include <atomic>
+#include <ostream>
+#include <thread>
+#include <vector>
+#include "embtest.hpp"
+
+TEST(Threads, assertionsOnHelperThreads)
+{
+    std::atomic<int> counter(0);
+    std::vector<std::thread> helpers;
+    for (int t=0; t < 4; ++t)
+    {
+        helpers.push_back(std::thread([&counter] {
+            for (int i=0; i < 10000; ++i)
+            {
+                int value = counter.fetch_add(1) + 1;
+                EXPECT_GT(value, 0);
+                EXPECT_LE(value, 40000);
+            }
+        }));
+    }
+    for (size_t t=0; t < helpers.size(); ++t)
+        helpers[t].join();
+    EXPECT_EQ(counter.load(), 40000);
+}
+
+TEST(Threads, failuresOnHelperThreads_ShouldFail)
+{
+    std::vector<std::thread> helpers;
+    for (int t=0; t < 4; ++t)
+    {
+        helpers.push_back(std::thread([t] {
+            for (int i=0; i < 1000; ++i)
+                EXPECT_NE(i, 500 + t);
+            FAIL() << "helper " << t << " done\n";
+        }));
+    }
+    EXPECT_EQ(helpers.size(), 5u);
+    for (size_t t=0; t < helpers.size(); ++t)
+        helpers[t].join();
+}
+#endif
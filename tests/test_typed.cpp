@@ -0,0 +1,36 @@
+/*
+ * Example typed tests for the embtest library.
+ *
+ * Copyright (c) 2018,2024 Brent Burton
+ *
+ * SDPX-License-Identifier: ISC
+ */
+#include <vector>
+#include <deque>
+#include "embtest.hpp"
+
+/**
+ * A typed test fixture is a class template. Each TYPED_TEST()
+ * of it runs once for every type in its TYPED_TEST_SUITE().
+ */
+template <typename T>
+class Containers: public embtest::Test
+{
+  protected:
+    T m_container;
+};
+
+TYPED_TEST_SUITE(Containers, embtest::Types<std::vector<int>, std::deque<int> >);
+
+TYPED_TEST(Containers, startsEmpty)
+{
+    EXPECT_TRUE(this->m_container.empty());
+}
+
+TYPED_TEST(Containers, pushBack)
+{
+    this->m_container.push_back(7);
+    TypeParam copy(this->m_container);
+    ASSERT_EQ(copy.size(), 1u);
+    EXPECT_EQ(copy.back(), 7);
+}
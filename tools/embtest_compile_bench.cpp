@@ -0,0 +1,237 @@
+/*
+ * Measure how long test files take to compile against the
+ * embtest header, with and without EMBTEST_LEAN_HEADER, and
+ * optionally against a baseline header.
+ *
+ * Copyright (c) 2018,2024 Brent Burton
+ *
+ * SDPX-License-Identifier: ISC
+ */
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+/*
+ * The compiler, its flags and the embtest include directory are
+ * those of the build that made this tool.
+ */
+#if !defined(EMBTEST_BENCH_CXX) || !defined(EMBTEST_BENCH_FLAGS) || !defined(EMBTEST_BENCH_INCLUDE)
+#error EMBTEST_BENCH_CXX, EMBTEST_BENCH_FLAGS and EMBTEST_BENCH_INCLUDE must be defined
+#endif
+
+/*
+ * Write a synthetic test file, shaped like a typical one: a
+ * fixture, plain tests and fixture tests, with assertions on
+ * integers, floating point values, strings and booleans.
+ */
+static bool writeTestFile(std::string const &path, unsigned index)
+{
+    std::ofstream out(path.c_str());
+    std::string suite = "Synthetic" + std::to_string(index);
+    out << "#include <string>\n"
+        << "#include \"embtest.hpp\"\n\n"
+        << "class " << suite << "Fixture : public embtest::Test\n"
+        << "{\n"
+        << "  protected:\n"
+        << "    void SetUp() { m_count = " << index << "; m_name = \"" << suite << "\"; }\n"
+        << "    int         m_count;\n"
+        << "    std::string m_name;\n"
+        << "};\n";
+    for (unsigned t=0; t < 8; ++t)
+    {
+        out << "\nTEST(" << suite << ", plain" << t << ")\n"
+            << "{\n"
+            << "    int value = " << t << ";\n"
+            << "    EXPECT_EQ(value, " << t << ");\n"
+            << "    EXPECT_NE(value, " << t + 1 << ");\n"
+            << "    EXPECT_LT(value * 0.5, " << t + 1 << ".0);\n"
+            << "    ASSERT_GE(value + 1u, 1u);\n"
+            << "    EXPECT_TRUE(value >= 0);\n"
+            << "}\n"
+            << "\nTEST_F(" << suite << "Fixture, fixture" << t << ")\n"
+            << "{\n"
+            << "    EXPECT_EQ(m_count, " << index << ");\n"
+            << "    EXPECT_EQ(m_name, \"" << suite << "\");\n"
+            << "    EXPECT_FALSE(m_name.empty());\n"
+            << "}\n";
+    }
+    out.flush();
+    return static_cast<bool>(out);
+}
+
+static long fileSize(std::string const &path)
+{
+    std::ifstream in(path.c_str(), std::ios::binary | std::ios::ate);
+    return in ? static_cast<long>(in.tellg()) : -1;
+}
+
+/*
+ * A header to compile against: the include directory, and whether
+ * EMBTEST_LEAN_HEADER is defined.
+ */
+struct Mode
+{
+    char const  *name;
+    std::string  include;
+    bool         lean;
+};
+
+struct Measurement
+{
+    double ms;
+    long   bytes;
+};
+
+static int const labelWidth = 18;
+static int const columnWidth = 10;
+
+/*
+ * Compile \c source against the header of \c mode, and measure the
+ * time it takes and the size of the object file.
+ */
+static bool compile(std::string const &source, unsigned index, Mode const &mode,
+                    Measurement &measurement)
+{
+    std::string object = "synthetic_" + std::to_string(index) + "." + mode.name + ".o";
+    std::ostringstream command;
+    command << EMBTEST_BENCH_CXX << " " << EMBTEST_BENCH_FLAGS
+            << " -I\"" << mode.include << "\""
+            << (mode.lean ? " -DEMBTEST_LEAN_HEADER" : "")
+            << " -c " << source << " -o " << object;
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    int status = std::system(command.str().c_str());
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    if (status != 0)
+    {
+        std::cerr << "Failed: " << command.str() << std::endl;
+        return false;
+    }
+    measurement.ms = elapsed.count();
+    measurement.bytes = fileSize(object);
+    return true;
+}
+
+/*
+ * Print one row: a label, then the compile times and the object
+ * sizes of the modes.
+ */
+static void printRow(std::string const &label, std::vector<Measurement> const &row)
+{
+    std::cout << "  " << std::left << std::setw(labelWidth) << label << std::right
+              << std::fixed << std::setprecision(1);
+    for (size_t m=0; m < row.size(); ++m)
+        std::cout << std::setw(columnWidth) << row[m].ms;
+    std::cout << "  ";
+    for (size_t m=0; m < row.size(); ++m)
+        std::cout << std::setw(columnWidth) << row[m].bytes;
+    std::cout << "\n";
+}
+
+/*
+ * Usage: embtest_compile_bench [--files=N] [--include=DIR]
+ *
+ * Writes N synthetic test files to the current directory, compiles
+ * each one to an object file against the header in both modes, and
+ * prints the compile time and object size of each file, followed by
+ * their median, minimum and maximum. With --include, each file is
+ * also compiled against the embtest.hpp in DIR, e.g. an older
+ * release, as a baseline. The modes of a file are compiled one
+ * after another, so changes in machine load affect them alike.
+ */
+int main(int argc, char **argv)
+{
+    unsigned files = 50;
+    std::string baseline;
+    for (int i=1; i < argc; ++i)
+    {
+        if (std::strncmp(argv[i], "--files=", 8) == 0 && std::atoi(argv[i] + 8) > 0)
+            files = static_cast<unsigned>(std::atoi(argv[i] + 8));
+        else if (std::strncmp(argv[i], "--include=", 10) == 0 && argv[i][10] != '\0')
+            baseline = argv[i] + 10;
+        else
+        {
+            std::cerr << "Usage: " << argv[0] << " [--files=N] [--include=DIR]" << std::endl;
+            return 2;
+        }
+    }
+
+    std::vector<Mode> modes;
+    if (!baseline.empty())
+    {
+        Mode mode = { "baseline", baseline, false };
+        modes.push_back(mode);
+    }
+    Mode standard = { "default", EMBTEST_BENCH_INCLUDE, false };
+    Mode lean = { "lean", EMBTEST_BENCH_INCLUDE, true };
+    modes.push_back(standard);
+    modes.push_back(lean);
+
+    for (unsigned f=0; f < files; ++f)
+    {
+        if (!writeTestFile("synthetic_" + std::to_string(f) + ".cpp", f))
+        {
+            std::cerr << "Cannot write the synthetic test files" << std::endl;
+            return 2;
+        }
+    }
+
+    std::cout << files << " files compiled with " << EMBTEST_BENCH_CXX << "\n";
+    if (!baseline.empty())
+        std::cout << "baseline header from " << baseline << "\n";
+    int group = static_cast<int>(columnWidth * modes.size());
+    std::cout << "  " << std::setw(labelWidth) << "" << std::right
+              << std::setw(group) << "compile time (ms)" << "  "
+              << std::setw(group) << "object bytes" << "\n"
+              << "  " << std::left << std::setw(labelWidth) << "file" << std::right;
+    for (int column=0; column < 2; ++column)
+    {
+        for (size_t m=0; m < modes.size(); ++m)
+            std::cout << std::setw(columnWidth) << modes[m].name;
+        std::cout << (column == 0 ? "  " : "\n");
+    }
+
+    std::vector<std::vector<Measurement> > measured(modes.size());
+    for (unsigned f=0; f < files; ++f)
+    {
+        std::string source = "synthetic_" + std::to_string(f) + ".cpp";
+        std::vector<Measurement> row(modes.size());
+        for (size_t m=0; m < modes.size(); ++m)
+        {
+            if (!compile(source, f, modes[m], row[m]))
+                return 1;
+            measured[m].push_back(row[m]);
+        }
+        printRow(source, row);
+    }
+
+    // The median, minimum and maximum of each column.
+    std::vector<Measurement> median(modes.size()), low(modes.size()), high(modes.size());
+    for (size_t m=0; m < modes.size(); ++m)
+    {
+        std::vector<Measurement> &column = measured[m];
+        std::sort(column.begin(), column.end(), [](Measurement const &a, Measurement const &b) {
+            return a.ms < b.ms;
+        });
+        median[m].ms = column[column.size() / 2].ms;
+        low[m].ms = column.front().ms;
+        high[m].ms = column.back().ms;
+        std::sort(column.begin(), column.end(), [](Measurement const &a, Measurement const &b) {
+            return a.bytes < b.bytes;
+        });
+        median[m].bytes = column[column.size() / 2].bytes;
+        low[m].bytes = column.front().bytes;
+        high[m].bytes = column.back().bytes;
+    }
+    printRow("median", median);
+    printRow("min", low);
+    printRow("max", high);
+    return 0;
+}
@@ -0,0 +1,98 @@
+/*
+ * Combine the result files of several embtest shards into
+ * one report.
+ *
+ * Copyright (c) 2018,2024 Brent Burton
+ *
+ * SDPX-License-Identifier: ISC
+ */
+#include <fstream>
+#include <iostream>
+#include <set>
+#include <string>
+#include <vector>
+
+/*
+ * Usage: embtest_merge RESULTS...
+ *
+ * Each RESULTS file is written by a test binary run with
+ * --results=FILE. The merged report has the same form as the
+ * summary printed by embtest::runAndReport(), and the exit code
+ * is 1 if any test failed or did not run.
+ */
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        std::cerr << "Usage: " << argv[0] << " RESULTS..." << std::endl;
+        return 2;
+    }
+
+    size_t total = 0, disabled = 0, failed = 0, passed = 0, notrun = 0;
+    std::vector<std::string> failedNames;
+    std::set<std::string> seen;
+
+    for (int i=1; i < argc; ++i)
+    {
+        std::ifstream in(argv[i]);
+        if (!in)
+        {
+            std::cerr << "Cannot read " << argv[i] << std::endl;
+            return 2;
+        }
+
+        std::string line;
+        while (std::getline(in, line))
+        {
+            if (line.empty() || line[0] == '#')
+                continue;
+
+            std::string::size_type space = line.find(' ');
+            if (space == std::string::npos)
+            {
+                std::cerr << argv[i] << ": malformed line: " << line << std::endl;
+                return 2;
+            }
+            std::string state = line.substr(0, space);
+            std::string name = line.substr(space + 1);
+
+            if (!seen.insert(name).second)
+            {
+                std::cerr << argv[i] << ": " << name
+                          << " appears in more than one shard" << std::endl;
+                return 2;
+            }
+
+            total++;
+            if (state == "PASSED")
+                passed++;
+            else if (state == "FAILED")
+            {
+                failed++;
+                failedNames.push_back(name);
+            }
+            else if (state == "DISABLED")
+                disabled++;
+            else
+                notrun++;
+        }
+    }
+
+    if (!failedNames.empty())
+    {
+        std::cout << "[--------]" << std::endl;
+        for (size_t i=0; i < failedNames.size(); ++i)
+            std::cout << "[ FAILED ] " << failedNames[i] << std::endl;
+        std::cout << "[--------]" << std::endl;
+    }
+
+    std::cout << "-- Test results --" << std::endl
+              << " Total tests: " << total << std::endl
+              << " Disabled:    " << disabled << std::endl
+              << " Failed:      " << failed << std::endl
+              << " Passed:      " << passed << std::endl;
+    if (notrun > 0)
+        std::cout << " Not run:     " << notrun << std::endl;
+
+    return (failed > 0 || notrun > 0) ? 1 : 0;
+}